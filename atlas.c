@@ -0,0 +1,222 @@
+/*
+ * Copyright © 2022 IGEL Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *    Tomohito Esaki <etom@igel.co.jp>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <GLES3/gl3.h>
+
+#include "atlas.h"
+#include "gl_state.h"
+#include "shader.h"
+
+static int
+check_header(const struct atlas *atlas)
+{
+	const struct atlas_header *h = atlas->header;
+	size_t end;
+	int i;
+
+	if (atlas->size < sizeof(*h) || h->magic != ATLAS_MAGIC ||
+	    h->version != ATLAS_VERSION)
+		return -1;
+	if (h->format != ATLAS_FORMAT_RGBA8 &&
+	    h->format != ATLAS_FORMAT_ETC2_RGBA8)
+		return -1;
+	if (!h->width || !h->height || !h->levels ||
+	    h->pixels % ATLAS_PIXEL_ALIGN ||
+	    h->pixels < sizeof(*h) + h->n_entries * sizeof(struct atlas_entry))
+		return -1;
+
+	end = h->pixels;
+	for (i = 0; i < h->levels; i++)
+		end += atlas_level_size(h, i);
+	if (end > atlas->size)
+		return -1;
+
+	for (i = 0; i < h->n_entries; i++) {
+		const struct atlas_entry *e = &atlas->entries[i];
+
+		if (e->x + e->w > h->width || e->y + e->h > h->height ||
+		    !memchr(e->name, '\0', ATLAS_NAME_MAX))
+			return -1;
+	}
+
+	return 0;
+}
+
+int
+atlas_open(struct atlas *atlas, const char *path)
+{
+	struct stat st;
+	int fd;
+
+	memset(atlas, 0, sizeof(*atlas));
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		fprintf(stderr, "%s: can't open, build it with atlas-build\n",
+			path);
+		return -1;
+	}
+	if (fstat(fd, &st) < 0 ||
+	    st.st_size < (off_t)sizeof(struct atlas_header)) {
+		fprintf(stderr, "%s: not an atlas\n", path);
+		close(fd);
+		return -1;
+	}
+
+	atlas->size = st.st_size;
+	atlas->map = mmap(NULL, atlas->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (atlas->map == MAP_FAILED) {
+		fprintf(stderr, "%s: mmap failed\n", path);
+		atlas->map = NULL;
+		return -1;
+	}
+
+	atlas->header = atlas->map;
+	atlas->entries = (const struct atlas_entry *)(atlas->header + 1);
+	if (check_header(atlas) < 0) {
+		fprintf(stderr, "%s: bad or stale atlas\n", path);
+		atlas_close(atlas);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* "images/atlas.bin" -> "images/atlas-etc2.bin" */
+static int
+etc2_path(char *buf, size_t size, const char *path)
+{
+	const char *dot = strrchr(path, '.');
+	int len = dot ? (int)(dot - path) : (int)strlen(path);
+	int n;
+
+	n = snprintf(buf, size, "%.*s-etc2%s", len, path, dot ? dot : "");
+	if (n < 0 || (size_t)n >= size)
+		return -1;
+
+	return 0;
+}
+
+int
+atlas_open_best(struct atlas *atlas, const char *path)
+{
+	const char *format = getenv("GL_ATLAS_FORMAT");
+	char etc2[PATH_MAX];
+
+	if (shader_gl_version() >= 30 &&
+	    !(format && strcmp(format, "rgba8") == 0) &&
+	    etc2_path(etc2, sizeof(etc2), path) == 0 &&
+	    access(etc2, R_OK) == 0 && atlas_open(atlas, etc2) == 0) {
+		if (atlas->header->format == ATLAS_FORMAT_ETC2_RGBA8)
+			return 0;
+		atlas_close(atlas);
+	}
+
+	return atlas_open(atlas, path);
+}
+
+void
+atlas_close(struct atlas *atlas)
+{
+	if (atlas->map)
+		munmap(atlas->map, atlas->size);
+	memset(atlas, 0, sizeof(*atlas));
+}
+
+const struct atlas_entry *
+atlas_find(const struct atlas *atlas, const char *name)
+{
+	int i;
+
+	for (i = 0; i < atlas->header->n_entries; i++)
+		if (strcmp(atlas->entries[i].name, name) == 0)
+			return &atlas->entries[i];
+
+	return NULL;
+}
+
+GLuint
+atlas_create_texture(const struct atlas *atlas)
+{
+	const struct atlas_header *h = atlas->header;
+	const uint8_t *pixels = (const uint8_t *)atlas->map + h->pixels;
+	int i, w, hh, levels = h->levels;
+	GLuint texture;
+
+	glGenTextures(1, &texture);
+	gl_state_bind_texture(GL_TEXTURE_2D, texture);
+
+	if (h->format == ATLAS_FORMAT_ETC2_RGBA8) {
+		/* atlas_open_best() only picks these on ES 3.0 */
+		glTexStorage2D(GL_TEXTURE_2D, levels,
+			       GL_COMPRESSED_RGBA8_ETC2_EAC, h->width,
+			       h->height);
+		for (i = 0; i < levels; i++) {
+			w = h->width >> i;
+			hh = h->height >> i;
+			glCompressedTexSubImage2D(GL_TEXTURE_2D, i, 0, 0,
+						  w ? w : 1, hh ? hh : 1,
+						  GL_COMPRESSED_RGBA8_ETC2_EAC,
+						  atlas_level_size(h, i),
+						  pixels);
+			pixels += atlas_level_size(h, i);
+		}
+	} else if (shader_gl_version() >= 30) {
+		glTexStorage2D(GL_TEXTURE_2D, levels, GL_RGBA8, h->width,
+			       h->height);
+		for (i = 0; i < levels; i++) {
+			w = h->width >> i;
+			hh = h->height >> i;
+			glTexSubImage2D(GL_TEXTURE_2D, i, 0, 0, w ? w : 1,
+					hh ? hh : 1, GL_RGBA, GL_UNSIGNED_BYTE,
+					pixels);
+			pixels += atlas_level_size(h, i);
+		}
+	} else {
+		/* ES 2.0 has no mipmaps for non power of two sizes */
+		levels = 1;
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, h->width, h->height, 0,
+			     GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+	}
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+			levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	return texture;
+}
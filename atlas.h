@@ -0,0 +1,67 @@
+/*
+ * Copyright © 2022 IGEL Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *    Tomohito Esaki <etom@igel.co.jp>
+ */
+
+#ifndef ATLAS_H
+#define ATLAS_H
+
+#include <stddef.h>
+
+#include "atlas_format.h"
+
+/*
+ * Read-only view of an atlas cache mapped into memory. Nothing is decoded
+ * at load time; the mapped pixels are handed to GL as they are.
+ */
+struct atlas {
+	void *map;
+	size_t size;
+	const struct atlas_header *header;
+	const struct atlas_entry *entries;
+};
+
+int atlas_open(struct atlas *atlas, const char *path);
+
+/*
+ * Opens the ETC2 variant of path written by atlas-etc2 ("foo-etc2.bin" for
+ * "foo.bin") when the context is ES 3.0 and the file exists, and falls back
+ * to the RGBA8 atlas at path otherwise. GL_ATLAS_FORMAT=rgba8 in the
+ * environment forces the fallback.
+ */
+int atlas_open_best(struct atlas *atlas, const char *path);
+void atlas_close(struct atlas *atlas);
+
+/* Entry called name, or NULL */
+const struct atlas_entry *atlas_find(const struct atlas *atlas,
+				     const char *name);
+
+/*
+ * Uploads all levels to a new texture, immutable on ES 3.0, and leaves it
+ * bound to GL_TEXTURE_2D with linear filtering and clamped edges. ETC2
+ * atlases need ES 3.0.
+ */
+GLuint atlas_create_texture(const struct atlas *atlas);
+
+#endif
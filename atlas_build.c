@@ -0,0 +1,334 @@
+/*
+ * Copyright © 2022 IGEL Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *    Tomohito Esaki <etom@igel.co.jp>
+ */
+
+/*
+ * Packs PNG images into one texture and writes it as an atlas cache, see
+ * atlas_format.h. Runs at build time so that the samples never decode
+ * PNGs.
+ *
+ * usage: atlas-build [-m] [-p border] -o atlas.bin image.png...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <cairo.h>
+
+#include "atlas_format.h"
+
+#define MAX_IMAGES	64
+#define MIN_WIDTH	64
+#define MAX_WIDTH	4096
+
+struct image {
+	cairo_surface_t *surface;
+	struct atlas_entry entry;
+};
+
+static int
+load_image(struct image *img, const char *path)
+{
+	const char *base = strrchr(path, '/');
+	size_t len;
+
+	img->surface = cairo_image_surface_create_from_png(path);
+	if (cairo_surface_status(img->surface) != CAIRO_STATUS_SUCCESS) {
+		fprintf(stderr, "%s: %s\n", path, cairo_status_to_string(
+				cairo_surface_status(img->surface)));
+		return -1;
+	}
+
+	base = base ? base + 1 : path;
+	len = strcspn(base, ".");
+	if (len >= ATLAS_NAME_MAX) {
+		fprintf(stderr, "%s: name too long\n", path);
+		return -1;
+	}
+	memset(&img->entry, 0, sizeof(img->entry));
+	memcpy(img->entry.name, base, len);
+	img->entry.w = cairo_image_surface_get_width(img->surface);
+	img->entry.h = cairo_image_surface_get_height(img->surface);
+
+	return 0;
+}
+
+/*
+ * Shelf packing of the images, tallest first, each with a border on every
+ * side. Returns the height used with the given width, or -1.
+ */
+static int
+pack_shelves(struct image *images, const int *order, int n, int width,
+	     int border)
+{
+	int i, x = 0, y = 0, shelf = 0, w, h;
+	struct image *img;
+
+	for (i = 0; i < n; i++) {
+		img = &images[order[i]];
+		w = img->entry.w + 2 * border;
+		h = img->entry.h + 2 * border;
+		if (w > width)
+			return -1;
+		if (x + w > width) {
+			y += shelf;
+			x = shelf = 0;
+		}
+		img->entry.x = x + border;
+		img->entry.y = y + border;
+		x += w;
+		if (h > shelf)
+			shelf = h;
+	}
+
+	return y + shelf;
+}
+
+static struct image *sort_images;
+
+static int
+compare_height(const void *a, const void *b)
+{
+	const struct atlas_entry *ea = &sort_images[*(const int *)a].entry;
+	const struct atlas_entry *eb = &sort_images[*(const int *)b].entry;
+
+	if (ea->h != eb->h)
+		return eb->h - ea->h;
+	return eb->w - ea->w;
+}
+
+/* Picks the power of two width giving the smallest atlas */
+static int
+pack(struct image *images, int n, int border, int *width, int *height)
+{
+	int order[MAX_IMAGES];
+	int i, w, h, best = 0;
+
+	for (i = 0; i < n; i++)
+		order[i] = i;
+	sort_images = images;
+	qsort(order, n, sizeof(order[0]), compare_height);
+
+	for (w = MIN_WIDTH; w <= MAX_WIDTH; w *= 2) {
+		h = pack_shelves(images, order, n, w, border);
+		/* whole 4x4 blocks for compressed formats */
+		h = (h + 3) & ~3;
+		if (h <= 0 || h > MAX_WIDTH)
+			continue;
+		if (!best || w * h < *width * *height) {
+			*width = w;
+			*height = h;
+			best = 1;
+		}
+	}
+	if (!best)
+		return -1;
+
+	pack_shelves(images, order, n, *width, border);
+	return 0;
+}
+
+static uint32_t
+rgba(uint32_t argb)
+{
+	uint8_t p[4] = {
+		argb >> 16, argb >> 8, argb, argb >> 24,
+	};
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+/* Copies an image and extrudes its edge pixels over the border */
+static void
+blit(uint32_t *dst, int width, const struct image *img, int border)
+{
+	const uint8_t *src = cairo_image_surface_get_data(img->surface);
+	int stride = cairo_image_surface_get_stride(img->surface);
+	const struct atlas_entry *e = &img->entry;
+	int x, y, sx, sy;
+	uint32_t argb;
+
+	for (y = -border; y < e->h + border; y++) {
+		sy = y < 0 ? 0 : y >= e->h ? e->h - 1 : y;
+		for (x = -border; x < e->w + border; x++) {
+			sx = x < 0 ? 0 : x >= e->w ? e->w - 1 : x;
+			memcpy(&argb, src + sy * stride + sx * 4,
+			       sizeof(argb));
+			dst[(e->y + y) * width + e->x + x] = rgba(argb);
+		}
+	}
+}
+
+/* 2x2 box filter of one level into the next */
+static void
+downsample(uint8_t *dst, const uint8_t *src, int w, int h)
+{
+	int dw = w > 1 ? w / 2 : 1, dh = h > 1 ? h / 2 : 1;
+	int x, y, c, x1, y1;
+
+	for (y = 0; y < dh; y++) {
+		y1 = h > 1 ? 1 : 0;
+		for (x = 0; x < dw; x++) {
+			x1 = w > 1 ? 1 : 0;
+			for (c = 0; c < 4; c++) {
+				const uint8_t *p = src +
+					((y * 2) * w + x * 2) * 4 + c;
+
+				dst[(y * dw + x) * 4 + c] =
+					(p[0] + p[x1 * 4] + p[y1 * w * 4] +
+					 p[(y1 * w + x1) * 4] + 2) / 4;
+			}
+		}
+	}
+}
+
+static int
+write_atlas(const char *path, struct image *images, int n, int width,
+	    int height, int mipmap, int border)
+{
+	struct atlas_header header;
+	static const uint8_t zero[ATLAS_PIXEL_ALIGN];
+	uint8_t *pixels, *level;
+	size_t size, offset;
+	int i, w, h, levels = 1;
+	FILE *fp;
+
+	if (mipmap)
+		for (w = width > height ? width : height; w > 1; w /= 2)
+			levels++;
+
+	/* level 0 plus at most a third for the mips */
+	size = (size_t)width * height * 4;
+	pixels = calloc(1, size + size / 2);
+	if (!pixels)
+		return -1;
+	for (i = 0; i < n; i++)
+		blit((uint32_t *)pixels, width, &images[i], border);
+
+	level = pixels;
+	w = width;
+	h = height;
+	for (i = 1; i < levels; i++) {
+		downsample(level + (size_t)w * h * 4, level, w, h);
+		level += (size_t)w * h * 4;
+		w = w > 1 ? w / 2 : 1;
+		h = h > 1 ? h / 2 : 1;
+	}
+	size = level - pixels + (size_t)w * h * 4;
+
+	offset = sizeof(header) + n * sizeof(struct atlas_entry);
+	memset(&header, 0, sizeof(header));
+	header.magic = ATLAS_MAGIC;
+	header.version = ATLAS_VERSION;
+	header.width = width;
+	header.height = height;
+	header.levels = levels;
+	header.n_entries = n;
+	header.format = ATLAS_FORMAT_RGBA8;
+	header.pixels = (offset + ATLAS_PIXEL_ALIGN - 1) &
+		~(ATLAS_PIXEL_ALIGN - 1);
+
+	fp = fopen(path, "wb");
+	if (!fp) {
+		perror(path);
+		free(pixels);
+		return -1;
+	}
+	fwrite(&header, sizeof(header), 1, fp);
+	for (i = 0; i < n; i++)
+		fwrite(&images[i].entry, sizeof(images[i].entry), 1, fp);
+	fwrite(zero, header.pixels - offset, 1, fp);
+	fwrite(pixels, size, 1, fp);
+	free(pixels);
+
+	if (fclose(fp) != 0) {
+		perror(path);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void
+usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-m] [-p border] -o atlas.bin "
+		"image.png...\n"
+		"  -m\tAlso write the mip chain\n"
+		"  -p\tPixels of edge extruded around each image "
+		"(default 1)\n", name);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct image images[MAX_IMAGES];
+	const char *out = NULL;
+	int opt, i, n, width, height, mipmap = 0, border = 1;
+
+	while ((opt = getopt(argc, argv, "mp:o:")) != -1) {
+		switch (opt) {
+		case 'm':
+			mipmap = 1;
+			break;
+		case 'p':
+			border = atoi(optarg);
+			break;
+		case 'o':
+			out = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	n = argc - optind;
+	if (!out || n <= 0 || n > MAX_IMAGES || border < 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	for (i = 0; i < n; i++)
+		if (load_image(&images[i], argv[optind + i]) < 0)
+			return 1;
+
+	if (pack(images, n, border, &width, &height) < 0) {
+		fprintf(stderr, "images don't fit in %dx%d\n", MAX_WIDTH,
+			MAX_WIDTH);
+		return 1;
+	}
+
+	if (write_atlas(out, images, n, width, height, mipmap, border) < 0)
+		return 1;
+
+	for (i = 0; i < n; i++)
+		cairo_surface_destroy(images[i].surface);
+
+	return 0;
+}
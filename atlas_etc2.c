@@ -0,0 +1,472 @@
+/*
+ * Copyright © 2022 IGEL Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *    Tomohito Esaki <etom@igel.co.jp>
+ */
+/*
+ * Compresses an atlas cache written by atlas-build to ETC2 RGBA8, see
+ * atlas_format.h. Runs at build time next to atlas-build.
+ *
+ * The color half of each block only uses the individual and differential
+ * modes ETC2 inherits from ETC1, searched exhaustively over both flips and
+ * all eight modifier tables. The alpha half is EAC with a search around the
+ * block's alpha range.
+ *
+ * usage: atlas-etc2 -o atlas-etc2.bin atlas.bin
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "atlas_format.h"
+
+static const int color_modifiers[8][2] = {
+	{ 2, 8 }, { 5, 17 }, { 9, 29 }, { 13, 42 },
+	{ 18, 60 }, { 24, 80 }, { 33, 106 }, { 47, 183 },
+};
+
+static const int alpha_modifiers[16][8] = {
+	{ -3, -6, -9, -15, 2, 5, 8, 14 },
+	{ -3, -7, -10, -13, 2, 6, 9, 12 },
+	{ -2, -5, -8, -13, 1, 4, 7, 12 },
+	{ -2, -4, -6, -13, 1, 3, 5, 12 },
+	{ -3, -6, -8, -12, 2, 5, 7, 11 },
+	{ -3, -7, -9, -11, 2, 6, 8, 10 },
+	{ -4, -7, -8, -11, 3, 6, 7, 10 },
+	{ -3, -5, -8, -11, 2, 4, 7, 10 },
+	{ -2, -6, -8, -10, 1, 5, 7, 9 },
+	{ -2, -5, -8, -10, 1, 4, 7, 9 },
+	{ -2, -4, -8, -10, 1, 3, 7, 9 },
+	{ -2, -5, -7, -10, 1, 4, 6, 9 },
+	{ -3, -4, -7, -10, 2, 3, 6, 9 },
+	{ -1, -2, -3, -10, 0, 1, 2, 9 },
+	{ -4, -6, -8, -9, 3, 5, 7, 8 },
+	{ -3, -5, -7, -9, 2, 4, 6, 8 },
+};
+
+/* Table 13 has a zero modifier, multiplier 0 is reserved */
+#define ALPHA_FLAT_TABLE	13
+#define ALPHA_FLAT_INDEX	4
+
+/* Pixels of a block, (x, y) at [y * 4 + x] */
+struct block {
+	uint8_t px[16][4];
+};
+
+static inline int
+clamp255(int v)
+{
+	return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+/* Bit of (x, y) in the pixel index fields of both halves */
+static inline int
+pixel_bit(int x, int y)
+{
+	return x * 4 + y;
+}
+
+static void
+fetch_block(struct block *b, const uint8_t *src, int w, int h, int bx,
+	    int by)
+{
+	int x, y, sx, sy;
+
+	/* edge blocks repeat the last row and column */
+	for (y = 0; y < 4; y++) {
+		sy = by * 4 + y < h ? by * 4 + y : h - 1;
+		for (x = 0; x < 4; x++) {
+			sx = bx * 4 + x < w ? bx * 4 + x : w - 1;
+			memcpy(b->px[y * 4 + x], src + (sy * w + sx) * 4, 4);
+		}
+	}
+}
+
+static uint64_t
+encode_alpha(const struct block *b)
+{
+	int min = 255, max = 0, i, t, m, m0, base, base0, k;
+	int err, best_err = -1, best_t = 0, best_m = 1, best_base = 0;
+	uint64_t bits;
+
+	for (i = 0; i < 16; i++) {
+		min = b->px[i][3] < min ? b->px[i][3] : min;
+		max = b->px[i][3] > max ? b->px[i][3] : max;
+	}
+
+	if (min == max) {
+		best_t = ALPHA_FLAT_TABLE;
+		best_base = min;
+		goto pack;
+	}
+
+	for (t = 0; t < 16 && best_err != 0; t++) {
+		const int *mod = alpha_modifiers[t];
+		int span = mod[7] - mod[3];
+
+		m0 = (max - min + span / 2) / span;
+		for (m = m0 - 1; m <= m0 + 1; m++) {
+			if (m < 1 || m > 15)
+				continue;
+			base0 = (min + max - (mod[7] + mod[3]) * m) / 2;
+			for (base = base0 - 2; base <= base0 + 2; base++) {
+				if (base < 0 || base > 255)
+					continue;
+				err = 0;
+				for (i = 0; i < 16; i++) {
+					int a = b->px[i][3], e, be = 1 << 30;
+
+					for (k = 0; k < 8; k++) {
+						e = clamp255(base + mod[k] * m)
+							- a;
+						be = e * e < be ? e * e : be;
+					}
+					err += be;
+				}
+				if (best_err < 0 || err < best_err) {
+					best_err = err;
+					best_t = t;
+					best_m = m;
+					best_base = base;
+				}
+			}
+		}
+	}
+
+pack:
+	bits = (uint64_t)best_base << 56 | (uint64_t)best_m << 52 |
+		(uint64_t)best_t << 48;
+	for (i = 0; i < 16; i++) {
+		const int *mod = alpha_modifiers[best_t];
+		int a = b->px[i][3], e, be = 1 << 30, idx = 0;
+
+		for (k = 0; k < 8; k++) {
+			e = clamp255(best_base + mod[k] * best_m) - a;
+			if (e * e < be) {
+				be = e * e;
+				idx = k;
+			}
+		}
+		bits |= (uint64_t)idx << (45 - 3 * pixel_bit(i % 4, i / 4));
+	}
+
+	return bits;
+}
+
+/*
+ * Best modifier table for the half of the block picked by flip and half,
+ * around base. Returns the squared error and ORs the pixel indices into
+ * *bits.
+ */
+static int
+encode_half(const struct block *b, int flip, int half, const int *base,
+	    int *table, uint64_t *bits)
+{
+	int t, i, k, c, x, y, err, best_err = -1;
+	int idx[8], best_idx[8];
+	int x0 = flip ? 0 : half * 2, y0 = flip ? half * 2 : 0;
+	int w = flip ? 4 : 2;
+
+	for (t = 0; t < 8; t++) {
+		const int a = color_modifiers[t][0], bb = color_modifiers[t][1];
+		const int mod[4] = { a, bb, -a, -bb };
+
+		err = 0;
+		for (i = 0; i < 8; i++) {
+			const uint8_t *p = b->px[(y0 + i / w) * 4 + x0 + i % w];
+			int be = 1 << 30, e, d;
+
+			for (k = 0; k < 4; k++) {
+				e = 0;
+				for (c = 0; c < 3; c++) {
+					d = clamp255(base[c] + mod[k]) - p[c];
+					e += d * d;
+				}
+				if (e < be) {
+					be = e;
+					idx[i] = k;
+				}
+			}
+			err += be;
+		}
+		if (best_err < 0 || err < best_err) {
+			best_err = err;
+			*table = t;
+			memcpy(best_idx, idx, sizeof(idx));
+		}
+	}
+
+	for (i = 0; i < 8; i++) {
+		x = x0 + i % w;
+		y = y0 + i / w;
+		k = pixel_bit(x, y);
+		*bits |= (uint64_t)(best_idx[i] >> 1) << (16 + k) |
+			(uint64_t)(best_idx[i] & 1) << k;
+	}
+
+	return best_err;
+}
+
+static void
+half_average(const struct block *b, int flip, int half, int *avg)
+{
+	int x0 = flip ? 0 : half * 2, y0 = flip ? half * 2 : 0;
+	int w = flip ? 4 : 2, i, c;
+
+	for (c = 0; c < 3; c++) {
+		avg[c] = 0;
+		for (i = 0; i < 8; i++)
+			avg[c] += b->px[(y0 + i / w) * 4 + x0 + i % w][c];
+		avg[c] = (avg[c] + 4) / 8;
+	}
+}
+
+/* Color half in one mode and flip, returns the error */
+static int
+encode_color_mode(const struct block *b, int flip, int diff, uint64_t *out)
+{
+	int avg[2][3], q[2][3], base[2][3], table[2], h, c, err;
+	uint64_t bits = 0;
+
+	for (h = 0; h < 2; h++) {
+		half_average(b, flip, h, avg[h]);
+		for (c = 0; c < 3; c++) {
+			if (diff) {
+				q[h][c] = (avg[h][c] * 31 + 127) / 255;
+				base[h][c] = q[h][c] << 3 | q[h][c] >> 2;
+			} else {
+				q[h][c] = (avg[h][c] * 15 + 127) / 255;
+				base[h][c] = q[h][c] * 17;
+			}
+		}
+	}
+
+	if (diff) {
+		/* anything else selects the T, H or planar modes */
+		for (c = 0; c < 3; c++)
+			if (q[1][c] - q[0][c] < -4 || q[1][c] - q[0][c] > 3)
+				return -1;
+		for (c = 0; c < 3; c++)
+			bits |= (uint64_t)q[0][c] << (59 - c * 8) |
+				(uint64_t)((q[1][c] - q[0][c]) & 7) <<
+				(56 - c * 8);
+	} else {
+		for (c = 0; c < 3; c++)
+			bits |= (uint64_t)q[0][c] << (60 - c * 8) |
+				(uint64_t)q[1][c] << (56 - c * 8);
+	}
+
+	err = encode_half(b, flip, 0, base[0], &table[0], &bits) +
+		encode_half(b, flip, 1, base[1], &table[1], &bits);
+	bits |= (uint64_t)table[0] << 37 | (uint64_t)table[1] << 34 |
+		(uint64_t)diff << 33 | (uint64_t)flip << 32;
+
+	*out = bits;
+	return err;
+}
+
+static uint64_t
+encode_color(const struct block *b)
+{
+	int flip, diff, err, best_err = -1;
+	uint64_t bits, best = 0;
+
+	for (flip = 0; flip < 2; flip++) {
+		for (diff = 0; diff < 2; diff++) {
+			err = encode_color_mode(b, flip, diff, &bits);
+			if (err >= 0 && (best_err < 0 || err < best_err)) {
+				best_err = err;
+				best = bits;
+			}
+		}
+	}
+
+	return best;
+}
+
+static void
+put_be64(uint8_t *dst, uint64_t v)
+{
+	int i;
+
+	for (i = 0; i < 8; i++)
+		dst[i] = v >> (56 - i * 8);
+}
+
+static void
+encode_level(uint8_t *dst, const uint8_t *src, int w, int h)
+{
+	struct block b;
+	int bx, by;
+
+	for (by = 0; by < (h + 3) / 4; by++) {
+		for (bx = 0; bx < (w + 3) / 4; bx++) {
+			fetch_block(&b, src, w, h, bx, by);
+			put_be64(dst, encode_alpha(&b));
+			put_be64(dst + 8, encode_color(&b));
+			dst += ATLAS_ETC2_BLOCK;
+		}
+	}
+}
+
+static uint8_t *
+read_file(const char *path, size_t *size)
+{
+	uint8_t *data;
+	FILE *fp;
+	long len;
+
+	fp = fopen(path, "rb");
+	if (!fp) {
+		perror(path);
+		return NULL;
+	}
+	if (fseek(fp, 0, SEEK_END) < 0 || (len = ftell(fp)) < 0 ||
+	    fseek(fp, 0, SEEK_SET) < 0) {
+		perror(path);
+		fclose(fp);
+		return NULL;
+	}
+
+	data = malloc(len ? len : 1);
+	if (!data || fread(data, 1, len, fp) != (size_t)len) {
+		fprintf(stderr, "%s: read failed\n", path);
+		free(data);
+		fclose(fp);
+		return NULL;
+	}
+	fclose(fp);
+
+	*size = len;
+	return data;
+}
+
+static int
+compress_atlas(const char *out, const char *in)
+{
+	struct atlas_header header, *h;
+	const uint8_t *src;
+	uint8_t *data, *pixels, *dst;
+	size_t size, end, dst_size = 0;
+	int i, w, hh;
+	FILE *fp;
+
+	data = read_file(in, &size);
+	if (!data)
+		return -1;
+
+	h = (struct atlas_header *)data;
+	if (size < sizeof(*h) || h->magic != ATLAS_MAGIC ||
+	    h->version != ATLAS_VERSION || h->format != ATLAS_FORMAT_RGBA8 ||
+	    h->pixels < sizeof(*h)) {
+		fprintf(stderr, "%s: not an RGBA8 atlas\n", in);
+		free(data);
+		return -1;
+	}
+
+	end = h->pixels;
+	header = *h;
+	header.format = ATLAS_FORMAT_ETC2_RGBA8;
+	for (i = 0; i < h->levels; i++) {
+		end += atlas_level_size(h, i);
+		dst_size += atlas_level_size(&header, i);
+	}
+	if (end > size) {
+		fprintf(stderr, "%s: truncated\n", in);
+		free(data);
+		return -1;
+	}
+
+	pixels = malloc(dst_size);
+	if (!pixels) {
+		free(data);
+		return -1;
+	}
+
+	src = data + h->pixels;
+	dst = pixels;
+	for (i = 0; i < h->levels; i++) {
+		w = h->width >> i;
+		hh = h->height >> i;
+		encode_level(dst, src, w ? w : 1, hh ? hh : 1);
+		src += atlas_level_size(h, i);
+		dst += atlas_level_size(&header, i);
+	}
+
+	fp = fopen(out, "wb");
+	if (!fp) {
+		perror(out);
+		free(pixels);
+		free(data);
+		return -1;
+	}
+	/* entries and padding are kept as they are */
+	fwrite(&header, sizeof(header), 1, fp);
+	fwrite(data + sizeof(header), h->pixels - sizeof(header), 1, fp);
+	fwrite(pixels, dst_size, 1, fp);
+	free(pixels);
+	free(data);
+
+	if (fclose(fp) != 0) {
+		perror(out);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void
+usage(const char *name)
+{
+	fprintf(stderr, "usage: %s -o atlas-etc2.bin atlas.bin\n", name);
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *out = NULL;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "o:")) != -1) {
+		switch (opt) {
+		case 'o':
+			out = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (!out || argc - optind != 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (compress_atlas(out, argv[optind]) < 0)
+		return 1;
+
+	return 0;
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright © 2022 IGEL Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *    Tomohito Esaki <etom@igel.co.jp>
+ */
+
+#ifndef ATLAS_FORMAT_H
+#define ATLAS_FORMAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Texture atlas cache written by atlas-build and atlas-etc2.
+ *
+ * The file holds a header, one entry per packed image, and then the pixels
+ * of every mip level starting at header.pixels, level 0 first and each
+ * level tightly packed. Pixels are premultiplied like cairo's and already
+ * in the layout GL takes them in: RGBA8 bytes, or for ETC2 whole 4x4
+ * blocks of 16 bytes with the edge blocks padded. Integers are in the
+ * byte order of the machine that built the file.
+ */
+
+#define ATLAS_MAGIC		0x534c5441	/* "ATLS" */
+#define ATLAS_VERSION		2
+#define ATLAS_NAME_MAX		24
+/* Offset alignment of the pixel data */
+#define ATLAS_PIXEL_ALIGN	64
+
+enum atlas_pixel_format {
+	ATLAS_FORMAT_RGBA8,
+	/* GL_COMPRESSED_RGBA8_ETC2_EAC, core in ES 3.0 */
+	ATLAS_FORMAT_ETC2_RGBA8,
+};
+
+/* Bytes of one 4x4 ETC2 RGBA8 block: EAC alpha then ETC2 color */
+#define ATLAS_ETC2_BLOCK	16
+
+struct atlas_header {
+	uint32_t magic;
+	uint32_t version;
+	uint16_t width, height;
+	uint16_t levels;
+	uint16_t n_entries;
+	uint32_t pixels;
+	uint16_t format;
+	uint16_t reserved;
+};
+
+/* Rectangle of an image in level 0, named after its file without .png */
+struct atlas_entry {
+	char name[ATLAS_NAME_MAX];
+	uint16_t x, y;
+	uint16_t w, h;
+};
+
+static inline size_t
+atlas_level_size(const struct atlas_header *h, int level)
+{
+	size_t w = h->width >> level, hh = h->height >> level;
+
+	w = w ? w : 1;
+	hh = hh ? hh : 1;
+	if (h->format == ATLAS_FORMAT_ETC2_RGBA8)
+		return ((w + 3) / 4) * ((hh + 3) / 4) * ATLAS_ETC2_BLOCK;
+
+	return w * hh * 4;
+}
+
+#endif
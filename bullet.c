@@ -24,42 +24,52 @@
  *    Tomohito Esaki <etom@igel.co.jp>
  */
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
 #include <assert.h>
 #include <time.h>
-#include <cairo.h>
 
-#include <GLES2/gl2.h>
+#include <GLES3/gl31.h>
 
 #include "common.h"
 #include "shader.h"
+#include "atlas.h"
+#include "bullet_analytic.h"
+#include "bullet_gpu.h"
+#include "bullet_grid.h"
+#include "bullet_instanced.h"
+#include "bullet_pattern.h"
+#include "bullet_pool.h"
+#include "bullet_quads.h"
+#include "gl_state.h"
+#include "sprite_batch.h"
+#include "text.h"
+#include "thread_pool.h"
 
 #define WINDOW_WIDTH		1280
 #define WINDOW_HEIGHT		960
 
-#define TEX_WIDTH               512
-#define TEX_HEIGHT              512
-#define TEX_BACK_X              0
-#define TEX_BACK_Y              0
-#define TEX_BULLETS_X           256
-#define TEX_BULLETS_Y           0
-#define TEX_ASCII_X             0
-#define TEX_ASCII_Y             256
-#define TEX_PLAYER_X            TEX_BULLETS_X + 16
-#define TEX_PLAYER_Y            TEX_BULLETS_Y + 40
-#define TEX_ENEMY_X             TEX_BULLETS_X
-#define TEX_ENEMY_Y             TEX_BULLETS_Y + 72
+#define ATLAS_FILE		"images/atlas.bin"
+/* Sprites inside images/img.png */
+#define IMG_PLAYER_X            16
+#define IMG_PLAYER_Y            40
+#define IMG_ENEMY_X             0
+#define IMG_ENEMY_Y             72
 #define TEX_BACK_WIDTH          255
 #define TEX_BACK_HEIGHT         255
 #define TEX_PLAYER_WIDTH        31
 #define TEX_PLAYER_HEIGHT       31
 #define TEX_ENEMY_WIDTH         63
 #define TEX_ENEMY_HEIGHT        63
+/* 8x16 cells of images/ascii_num.png */
+#define ASCII_CHARS		"-0123456789S:G:."
 
 #define MAX_BULLETS     12000
-#define MAX_BUFFER      (MAX_BULLETS + 20) * 18	/* dim=3 x points=6 */
+#define MAX_SPRITES     (MAX_BULLETS + 20)
+#define GRID_CELL	32
+#define PATTERN_FILE	"patterns/keroame.pat"
 
 struct player_t {
 	int x, y;
@@ -67,164 +77,193 @@ struct player_t {
 	int csx, csy, cex, cey;
 };
 
-struct enemy_bullet_t {
-	int type;
-	int flag;
-	int count;
-	int color;
-	int state;
-	int till;
-	double x, y, vx, vy;
-	double angle, speed, base_ang, rem_sp;
-};
-
 struct enemy_t {
 	int x, y;
 	int cw, ch;
 	int csx, csy, cex, cey;
-	struct enemy_bullet_t *bullets;
+	struct bullet_pool bullets;
+	struct thread_pool *threads;
+	struct bullet_pattern *pattern;
+	struct bullet_emitter emitter;
 };
 
 struct gl_info {
-	GLuint sh_position;
-	GLuint sh_texcoord;
-	GLuint sh_texture;
-	GLuint sh_screen_size;
-	GLuint sh_tex_size;
 	GLuint texture;
-	GLuint program;
+	int tex_width, tex_height;
+	/* where images/back.png, img.png and ascii_num.png are in the atlas */
+	struct atlas_entry back, img, ascii;
 };
 
-struct gl_buffer {
-	short *vertex_buffer;
-	short *texcoord_buffer;
-	int p_vertex_buffer;
-	int p_texcoord_buffer;
-	int vertex_count;
+enum bullet_backend {
+	BACKEND_CPU,
+	BACKEND_GPU,
+	BACKEND_ANALYTIC,
+};
+
+/*
+ * Bullets of one frame of the CPU backend, written by simulate() on the
+ * simulation thread while redraw() draws the other frame
+ */
+struct frame {
+	const struct bullet_quads *bullet_quads;
+	int n_bullets;
+	int count;
+	struct sprite_vertex *quads;		/* 4 per bullet */
+	struct bullet_instance *instances;	/* with use_instancing */
 };
 
 struct app {
 	struct player_t player;
 	struct enemy_t enemy;
 	struct gl_info gl;
-	struct gl_buffer buf;
+	struct sprite_batch sprites;
+	int sprite_back;
+	int sprite_under;
+	int sprite_bullets;
+	int sprite_hud;
+	struct text_font font;
+	struct text_label label_bullets;
+	struct text_label label_fps;
+	struct bullet_grid grid;
+	enum bullet_backend backend;
+	struct bullet_gpu gpu;
+	struct bullet_analytic analytic;
+	struct bullet_instanced instanced;
+	int use_instancing;
+	struct bullet_sprite_info bullet_sprites[BULLET_TYPE_COUNT];
+	struct bullet_quads bullet_quads;
+	struct frame frames[2];
+	const struct app_info *info;
 };
 
-#define TO_STRING(x)	#x
-static const char *vert_shader_text = TO_STRING(
-	attribute vec4 position;
-	attribute vec2 texcoord;
-	varying vec2 texcoordVarying;
-	uniform vec2 screenSize;
-	uniform vec2 texSize;
-	void main()
-	{
-		vec4 pos = position;
-		pos.x = pos.x / screenSize.x - (screenSize.x - pos.x) /
-			screenSize.x;
-		pos.y = pos.y / screenSize.y - (screenSize.y - pos.y) /
-			screenSize.y;
-		gl_Position = pos;
-		vec2 tex = texcoord;
-		tex.x = tex.x / texSize.x;
-		tex.y = tex.y / texSize.y;
-		texcoordVarying = tex;
-	});
-
-static const char *frag_shader_text = TO_STRING(
-	precision mediump float;
-	varying vec2 texcoordVarying;
-	uniform sampler2D texture;
-	void main() {
-		gl_FragColor = texture2D(texture, texcoordVarying).bgra;
-	});
-
-static GLuint
-create_texture()
-{
-	cairo_surface_t *bg, *bullet, *ascii;
-	cairo_surface_t *img;
-	cairo_t *cr;
-	unsigned char *data;
-	GLuint texture;
+/* Bullet sprites in images/img.png, one color after another along u */
+static const struct bullet_sprite_info img_bullets[BULLET_TYPE_COUNT] = {
+	[BULLET_TYPE_SMALL] = { 4, 4, 0, 0, 8, 8 },
+	[BULLET_TYPE_LARGE] = { 8, 8, 0, 8, 16, 16 },
+	[BULLET_TYPE_NEEDLE] = { 4, 8, 0, 24, 8, 16 },
+};
 
-	bg = cairo_image_surface_create_from_png("images/back.png");
-	bullet = cairo_image_surface_create_from_png("images/img.png");
-	ascii = cairo_image_surface_create_from_png("images/ascii_num.png");
-
-	img = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
-					 TEX_WIDTH, TEX_HEIGHT);
-	cr = cairo_create(img);
-
-	cairo_set_source_surface(cr, bg, TEX_BACK_X, TEX_BACK_Y);
-	cairo_paint(cr);
-	cairo_set_source_surface(cr, bullet, TEX_BULLETS_X, TEX_BULLETS_Y);
-	cairo_paint(cr);
-	cairo_set_source_surface(cr, ascii, TEX_ASCII_X, TEX_ASCII_Y);
-	cairo_paint(cr);
-	cairo_surface_flush(img);
-	cairo_destroy(cr);
-
-	data = cairo_image_surface_get_data(img);
-	glGenTextures(1, &texture);
-	glBindTexture(GL_TEXTURE_2D, texture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, TEX_WIDTH, TEX_HEIGHT, 0,
-		     GL_RGBA, GL_UNSIGNED_BYTE, data);
-
-	cairo_surface_destroy(bg);
-	cairo_surface_destroy(bullet);
-	cairo_surface_destroy(ascii);
-	cairo_surface_destroy(img);
-
-	return texture;
+static void
+load_texture(struct app *app)
+{
+	struct gl_info *gl = &app->gl;
+	const struct atlas_entry *back, *img, *ascii;
+	struct atlas atlas;
+	int i, ret;
+
+	ret = atlas_open_best(&atlas, ATLAS_FILE);
+	assert(ret == 0);
+	back = atlas_find(&atlas, "back");
+	img = atlas_find(&atlas, "img");
+	ascii = atlas_find(&atlas, "ascii_num");
+	assert(back && img && ascii);
+	gl->back = *back;
+	gl->img = *img;
+	gl->ascii = *ascii;
+	gl->tex_width = atlas.header->width;
+	gl->tex_height = atlas.header->height;
+	gl->texture = atlas_create_texture(&atlas);
+	atlas_close(&atlas);
+
+	for (i = 0; i < BULLET_TYPE_COUNT; i++) {
+		app->bullet_sprites[i] = img_bullets[i];
+		app->bullet_sprites[i].u += gl->img.x;
+		app->bullet_sprites[i].v += gl->img.y;
+	}
+	bullet_quads_init(&app->bullet_quads, app->bullet_sprites);
 }
 
+/*
+ * The opaque background is drawn without blending, bullets and the HUD
+ * are layered over the other sprites
+ */
 static void
-init_gl_buffer(struct gl_buffer *buf)
+init_sprites(struct app *app)
 {
-	buf->vertex_buffer = malloc(MAX_BUFFER * sizeof(short));
-	assert(buf->vertex_buffer);
-	buf->texcoord_buffer = malloc(MAX_BUFFER * sizeof(short));
-	assert(buf->texcoord_buffer);
+	struct sprite_state state = {
+		.blend = SPRITE_BLEND_NONE,
+		.texture = app->gl.texture,
+		.tex_width = app->gl.tex_width,
+		.tex_height = app->gl.tex_height,
+	};
+	int ret;
+
+	ret = sprite_batch_init(&app->sprites, MAX_SPRITES);
+	assert(ret == 0);
+	app->sprite_back = sprite_batch_add_state(&app->sprites, &state);
+	state.layer = 1;
+	state.blend = SPRITE_BLEND_ALPHA;
+	app->sprite_under = sprite_batch_add_state(&app->sprites, &state);
+	state.layer = 2;
+	app->sprite_bullets = sprite_batch_add_state(&app->sprites, &state);
+	state.layer = 3;
+	app->sprite_hud = sprite_batch_add_state(&app->sprites, &state);
+	assert(app->sprite_back >= 0 && app->sprite_under >= 0 &&
+	       app->sprite_bullets >= 0 && app->sprite_hud >= 0);
+
+	text_font_init_grid(&app->font, app->gl.texture, app->gl.tex_width,
+			    app->gl.tex_height, app->gl.ascii.x,
+			    app->gl.ascii.y, 8, 16, 16, ASCII_CHARS);
+	text_label_init(&app->label_bullets, &app->font, WINDOW_WIDTH,
+			WINDOW_HEIGHT - 32, TEXT_ALIGN_RIGHT);
+	text_label_init(&app->label_fps, &app->font, WINDOW_WIDTH,
+			WINDOW_HEIGHT - 16, TEXT_ALIGN_RIGHT);
 }
 
+/*
+ * GL_BULLET_BACKEND picks where bullets are simulated: "cpu", "gpu"
+ * (compute shader, needs ES 3.1) or "analytic" (closed form in the
+ * vertex shader). The default is gpu when the context offers it. On ES 3.0
+ * the CPU backend draws its bullets instanced.
+ */
 static void
-init_gl(void *data)
+init_backend(struct app *app)
 {
-	struct app *app = data;
-	struct gl_info *gl = &app->gl;
-	struct shader_info shader;
-
-	gl->texture = create_texture();
-
-	memset(&shader, 0x0, sizeof(shader));
-	shader.vertex = vert_shader_text;
-	shader.fragment = frag_shader_text;
-	gl->program = shader_build_program(&shader);
-	assert(gl->program);
-	glUseProgram(gl->program);
-
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-	gl->sh_position = glGetAttribLocation(gl->program, "position");
-	gl->sh_texcoord = glGetAttribLocation(gl->program, "texcoord");
-	gl->sh_texture = glGetUniformLocation(gl->program, "texture");
-	gl->sh_screen_size = glGetUniformLocation(gl->program, "screenSize");
-        gl->sh_tex_size = glGetUniformLocation(gl->program, "texSize");
-
-	glEnableVertexAttribArray(gl->sh_position);
-	glEnableVertexAttribArray(gl->sh_texcoord);
-
-	init_gl_buffer(&app->buf);
+	const char *name = getenv("GL_BULLET_BACKEND");
+	const struct bullet_motion *motions;
+	int n_motions, ret = 0;
+
+	if (name && strcmp(name, "cpu") == 0)
+		app->backend = BACKEND_CPU;
+	else if (name && strcmp(name, "analytic") == 0)
+		app->backend = BACKEND_ANALYTIC;
+	else if (bullet_gpu_supported())
+		app->backend = BACKEND_GPU;
+	else
+		app->backend = BACKEND_CPU;
+
+	switch (app->backend) {
+	case BACKEND_CPU:
+		break;
+	case BACKEND_GPU:
+		motions = bullet_pattern_motions(app->enemy.pattern,
+						 &n_motions);
+		ret = bullet_gpu_init(&app->gpu, MAX_BULLETS, motions,
+				      n_motions, app->bullet_sprites);
+		break;
+	case BACKEND_ANALYTIC:
+		ret = bullet_analytic_init(&app->analytic, MAX_BULLETS,
+					   app->bullet_sprites);
+		break;
+	}
+	if (ret < 0) {
+		fprintf(stderr, "bullet backend unavailable, using the CPU\n");
+		app->backend = BACKEND_CPU;
+	}
+	if (app->backend == BACKEND_CPU && shader_gl_version() >= 30)
+		app->use_instancing =
+			bullet_instanced_init(&app->instanced, MAX_BULLETS,
+					      app->bullet_sprites) == 0;
 }
 
 static void
-deinit_gl_buffer(struct gl_buffer *buf)
+init_gl(void *data)
 {
-	free(buf->vertex_buffer);
-	free(buf->texcoord_buffer);
+	struct app *app = data;
+
+	load_texture(app);
+	init_sprites(app);
+	init_backend(app);
 }
 
 static void
@@ -233,10 +272,23 @@ deinit_gl(void *data)
 	struct app *app = data;
 	struct gl_info *gl = &app->gl;
 
-	glDeleteTextures(1, &gl->texture);
-	glDeleteProgram(gl->program);
-
-	deinit_gl_buffer(&app->buf);
+	gl_state_delete_textures(1, &gl->texture);
+
+	text_label_fini(&app->label_bullets);
+	text_label_fini(&app->label_fps);
+	sprite_batch_fini(&app->sprites);
+	switch (app->backend) {
+	case BACKEND_CPU:
+		if (app->use_instancing)
+			bullet_instanced_fini(&app->instanced);
+		break;
+	case BACKEND_GPU:
+		bullet_gpu_fini(&app->gpu);
+		break;
+	case BACKEND_ANALYTIC:
+		bullet_analytic_fini(&app->analytic);
+		break;
+	}
 }
 
 static void
@@ -254,6 +306,10 @@ player_init(struct player_t *player, int w, int h)
 static void
 enemy_init(struct enemy_t *enemy, int w, int h)
 {
+	const struct bullet_motion *motions;
+	const struct bullet_program *program;
+	int n_motions, ret;
+
 	enemy->x = w / 2;
 	enemy->y = h * 8 / 10;
 	enemy->cw = enemy->ch = 96;
@@ -262,173 +318,160 @@ enemy_init(struct enemy_t *enemy, int w, int h)
 	enemy->cex = enemy->x + enemy->cw / 2;
 	enemy->cey = enemy->y + enemy->ch / 2;
 
-	enemy->bullets = calloc(1, MAX_BULLETS * sizeof(struct enemy_bullet_t));
-	assert(enemy->bullets);
+	enemy->pattern = bullet_pattern_load(PATTERN_FILE);
+	assert(enemy->pattern);
+	motions = bullet_pattern_motions(enemy->pattern, &n_motions);
+	ret = bullet_pool_init(&enemy->bullets, MAX_BULLETS, motions,
+			       n_motions);
+	assert(ret == 0);
+
+	program = bullet_pattern_find(enemy->pattern, "keroame");
+	assert(program);
+	bullet_emitter_init(&enemy->emitter, program, enemy->x, enemy->y, 1);
+
+	enemy->threads = thread_pool_create(0);
+	assert(enemy->threads);
+	bullet_pool_set_threads(&enemy->bullets, enemy->threads);
 }
 
 static void
 enemy_deinit(struct enemy_t *enemy)
 {
-	free(enemy->bullets);
+	bullet_pool_fini(&enemy->bullets);
+	thread_pool_destroy(enemy->threads);
+	bullet_pattern_destroy(enemy->pattern);
 }
 
-static void
-bullet_move(struct enemy_bullet_t *bullet)
+static int
+hit_player(void *data, const struct bullet_bucket *b, int bucket, int slot)
 {
-	bullet->x += cos(bullet->angle) * bullet->speed;
-	bullet->y += sin(bullet->angle) * bullet->speed;
-	bullet->count++;
+	bullet_pool_free(data, bucket, slot);
+	return 1;
 }
 
+/* Bullets that reach the player's hitbox are absorbed */
 static void
-bullet_move_with_vec(struct enemy_bullet_t* bullet)
+player_collide(struct player_t *player, struct enemy_t *enemy,
+	       struct bullet_grid *grid)
 {
-	bullet->x += bullet->vx;
-	bullet->y += bullet->vy;
+	bullet_grid_build(grid, &enemy->bullets);
+	bullet_grid_query(grid, player->csx, player->csy,
+			  player->cex, player->cey,
+			  hit_player, &enemy->bullets);
 }
 
-static int
-bullet_is_out(struct enemy_bullet_t* bullet, int w, int h)
+/*
+ * Called from the workers of the pool, each word writing its own range.
+ * The quads go to the frame's array rather than a mapped GL buffer: the
+ * simulation runs a frame ahead of the GL thread, and ES 3.0 has neither
+ * persistent mapping nor drawing from a buffer while it is mapped. The
+ * array still reaches the GPU in one stream map per bin.
+ */
+static void
+emit_bullets(void *data, const struct bullet_bucket *b, int word,
+	     uint64_t visible, int first)
 {
-	if (bullet->x < -40 || w + 40 < bullet->x ||
-	    bullet->y < -40 || h + 40 < bullet->y) {
-		if (bullet->till < bullet->count)
-			return 1;
-	}
-	return 0;
+	struct frame *frame = data;
+	int16_t *quads = (int16_t *)&frame->quads[first * 4];
+
+	if (first < MAX_BULLETS)
+		bullet_quads_emit(frame->bullet_quads, quads,
+				  MAX_BULLETS - first, b, word, visible);
 }
 
 static void
-bullet_calc(struct enemy_bullet_t *bullets, int w, int h)
+emit_instances(void *data, const struct bullet_bucket *b, int word,
+	       uint64_t visible, int first)
 {
+	struct frame *frame = data;
 	int i;
-	for (i = 0; i < MAX_BULLETS; i++) {
-		if (!bullets[i].flag)
-			continue;
-		bullet_move(&bullets[i]);
-		if (bullet_is_out(&bullets[i], w, h))
-			bullets[i].flag = 0;
-	}
-}
 
-static void
-bullet_init(struct enemy_bullet_t *bullet, int tp, int col, double x,
-                 double y, double ang, double sp)
-{
-	bullet->type = tp;
-	bullet->color = col;
-	bullet->x = x;
-	bullet->y = y;
-	bullet->angle = ang;
-	bullet->speed = sp;
-	bullet->count = 0;
+	while (visible && first < MAX_BULLETS) {
+		i = __builtin_ctzll(visible);
+		visible &= visible - 1;
+		bullet_instance_set(&frame->instances[first++], b,
+				    (word << 6) + i);
+	}
 }
 
+/* Returns the number of bullets emitted */
 static int
-enemy_usable_bullet(struct enemy_bullet_t* bullets)
+enemy_main(struct enemy_t *enemy, bullet_emit_at_func emit, void *data,
+	   int w, int h)
 {
-	int i;
-	for (i = 0; i < MAX_BULLETS; i++) {
-		if (bullets[i].flag == 0)
-			return i;
-	}
-	return -1;
+	int n;
+
+	bullet_emitter_step(&enemy->emitter, &enemy->bullets);
+	n = bullet_pool_update_emit_at(&enemy->bullets, w, h, emit, data);
+
+	return n < MAX_BULLETS ? n : MAX_BULLETS;
 }
 
+/* Only the spawns of the frame leave the CPU */
 static void
-spel_keroame(struct enemy_t *enemy)
+enemy_main_gpu(struct enemy_t *enemy, struct player_t *player,
+	       struct bullet_gpu *gpu, int w, int h)
 {
-	struct enemy_bullet_t* bullets = enemy->bullets;
-	static int keroameTim;
-	static int spelCount = 0;
-	double ang;
-	int t, n, i, k;
-
-	t = spelCount % 20;
-	if (t == 0)
-		keroameTim = 190 + rand() % 30 - 15;
-	ang = M_PI * 1.5 + M_PI / 6.0 *
-		sin(M_PI * 2 / keroameTim * spelCount);
-	for (n = 0; n < 8; n++) {
-		int k = enemy_usable_bullet(bullets);
-		if (k < 0)
-			continue;
-		bullet_init(&bullets[k], 1, 4, enemy->x, enemy->y,
-			    0, 0);
-		bullets[k].flag = 1;
-		bullets[k].vx = cos(ang - M_PI / 8.0 * 4.0 +
-				    M_PI / 8.0 * n + M_PI / 16.0) * 3.0;
-		bullets[k].vy = -sin(ang - M_PI / 8.0 * 4.0 + M_PI /
-				     8.0 * n + M_PI / 16.0) * 3.0;
-		bullets[k].till = 150;
-	}
-
-	if (spelCount > 80) {
-		for (i = 0; i < 40; i++) {
-			ang = (rand() % 270 - 45) * M_PI / 180.0;
-			k = enemy_usable_bullet(bullets);
-			if (k < 0)
-				continue;
-			bullet_init(&bullets[k], 2, 4, enemy->x, enemy->y,
-				    0, 0);
-			bullets[k].flag = 1;
-			bullets[k].state = 1;
-			bullets[k].vx = cos(ang) * 1.4 * 1.2;
-			bullets[k].vy = -sin(ang) * 1.4;
-		}
-	}
-	for (i = 0; i < MAX_BULLETS; i++) {
-		double vy;
-		if (!bullets[i].flag)
-			continue;
-		vy = bullets[i].vy;
-		if (bullets[i].state == 0) {
-			if (bullets[i].count < 150)
-				bullets[i].vy -= 0.04;
-			bullet_move_with_vec(&bullets[i]);
-		} else if (bullets[i].state == 1) {
-			if (bullets[i].count < 160)
-				bullets[i].vy -= 0.03;
-			bullet_move_with_vec(&bullets[i]);
-			bullets[i].angle = -atan2(-vy + 0.03, bullets[i].vx);
-		}
-	}
-	spelCount++;
+	bullet_emitter_step(&enemy->emitter, &enemy->bullets);
+	bullet_gpu_update(gpu, &enemy->bullets, w, h, player->csx,
+			  player->csy, player->cex, player->cey);
 }
 
+/* Spawns are uploaded once and never touched again */
 static void
-enemy_main(struct enemy_t *enemy, int w, int h)
+enemy_main_analytic(struct enemy_t *enemy, struct bullet_analytic *analytic,
+		    int w, int h)
 {
-	spel_keroame(enemy);
-	bullet_calc(enemy->bullets, w, h);
+	bullet_emitter_step(&enemy->emitter, &enemy->bullets);
+	bullet_analytic_update(analytic, &enemy->bullets, w, h);
 }
 
+/*
+ * Runs on the simulation thread one frame ahead of redraw(). The GPU and
+ * analytic backends simulate with GL calls and stay in redraw().
+ */
 static void
-add_vertex(struct gl_buffer *buf, int vx, int vy, int uvx, int uvy)
+simulate(void *data, void *state)
 {
-	buf->vertex_buffer[buf->p_vertex_buffer] = vx;
-	buf->p_vertex_buffer++;
-	buf->vertex_buffer[buf->p_vertex_buffer] = vy;
-	buf->p_vertex_buffer++;
-	buf->vertex_buffer[buf->p_vertex_buffer] = 0;
-	buf->p_vertex_buffer++;
-	buf->texcoord_buffer[buf->p_texcoord_buffer] = uvx;
-	buf->p_texcoord_buffer++;
-	buf->texcoord_buffer[buf->p_texcoord_buffer] = uvy;
-	buf->p_texcoord_buffer++;
-	buf->vertex_count++;
+	struct app *app = data;
+	struct frame *frame = state;
+
+	frame->count = 0;
+	if (app->backend != BACKEND_CPU)
+		return;
+
+	if (app->use_instancing)
+		frame->count = enemy_main(&app->enemy, emit_instances, frame,
+					  WINDOW_WIDTH, WINDOW_HEIGHT);
+	else
+		frame->count = enemy_main(&app->enemy, emit_bullets, frame,
+					  WINDOW_WIDTH, WINDOW_HEIGHT);
+	player_collide(&app->player, &app->enemy, &app->grid);
+	frame->n_bullets = app->enemy.bullets.n_live;
 }
 
+/* Bullets of the backends that draw them themselves */
 static void
-add_rect_vertex(struct gl_buffer *buf, int tlx, int tly, int brx, int bry,
-		int tluvx, int tluvy, int bruvx, int bruvy)
+draw_bullets(struct app *app, const struct frame *frame)
 {
-	add_vertex(buf, tlx, bry, tluvx, tluvy);
-	add_vertex(buf, brx, bry, bruvx, tluvy);
-	add_vertex(buf, tlx, tly, tluvx, bruvy);
-	add_vertex(buf, brx, bry, bruvx, tluvy);
-	add_vertex(buf, tlx, tly, tluvx, bruvy);
-	add_vertex(buf, brx, tly, bruvx, bruvy);
+	switch (app->backend) {
+	case BACKEND_CPU:
+		bullet_instanced_draw_data(&app->instanced, frame->instances,
+					   frame->count, WINDOW_WIDTH,
+					   WINDOW_HEIGHT, app->gl.tex_width,
+					   app->gl.tex_height);
+		break;
+	case BACKEND_GPU:
+		sprite_batch_use(&app->sprites, app->sprite_bullets);
+		bullet_gpu_draw(&app->gpu, app->sprites.sh_position,
+				app->sprites.sh_texcoord);
+		break;
+	case BACKEND_ANALYTIC:
+		bullet_analytic_draw(&app->analytic, WINDOW_WIDTH,
+				     WINDOW_HEIGHT, app->gl.tex_width,
+				     app->gl.tex_height);
+		break;
+	}
 }
 
 static void
@@ -436,97 +479,65 @@ redraw(void *data, struct rect *damage)
 {
 	struct app *app = data;
 	struct gl_info *gl = &app->gl;
-	int vsx, vsy, vex, vey, usx, usy, uex, uey;
-	struct enemy_bullet_t *bullets = app->enemy.bullets;
-	int i;
-	int n_bullets = 0;
-
-	enemy_main(&app->enemy, WINDOW_WIDTH, WINDOW_HEIGHT);
-	app->buf.vertex_count = app->buf.p_vertex_buffer
-		= app->buf.p_texcoord_buffer = 0;
-
-	add_rect_vertex(&app->buf, 0, 0, WINDOW_WIDTH, WINDOW_HEIGHT,
-			TEX_BACK_X, TEX_BACK_Y, TEX_BACK_WIDTH,
-			TEX_BACK_HEIGHT);
-	add_rect_vertex(&app->buf, app->player.csx, app->player.csy,
-			app->player.cex, app->player.cey,
-			TEX_PLAYER_X, TEX_PLAYER_Y,
-			TEX_PLAYER_X + TEX_PLAYER_WIDTH,
-			TEX_PLAYER_Y + TEX_PLAYER_HEIGHT);
-	add_rect_vertex(&app->buf, app->enemy.csx, app->enemy.csy,
-			app->enemy.cex, app->enemy.cey,
-			TEX_ENEMY_X, TEX_ENEMY_Y, TEX_ENEMY_X + TEX_ENEMY_WIDTH,
-			TEX_ENEMY_Y + TEX_ENEMY_HEIGHT);
-
-	for (i = 0; i < MAX_BULLETS; i++) {
-		if (!bullets[i].flag)
-			continue;
-		vsx = vsy = vex = vey = usx = usy = uex = uey = 0;
-		switch (bullets[i].type) {
-		case 0:
-			vsx = (int) (bullets[i].x - 4);
-			vsy = (int) (bullets[i].y - 4);
-			vex = (int) (bullets[i].x + 4);
-			vey = (int) (bullets[i].y + 4);
-			usx = TEX_BULLETS_X + bullets[i].color * 8;
-			usy = TEX_BULLETS_Y;
-			uex = usx + 8;
-			uey = 8;
-			break;
-		case 1:
-			vsx = (int) (bullets[i].x - 8);
-			vsy = (int) (bullets[i].y - 8);
-			vex = (int) (bullets[i].x + 8);
-			vey = (int) (bullets[i].y + 8);
-			usx = TEX_BULLETS_X + bullets[i].color * 16;
-			usy = TEX_BULLETS_Y + 8;
-			uex = usx + 16;
-			uey = usy + 16;
-			break;
-		case 2:
-			vsx = (int) (bullets[i].x - 4);
-			vsy = (int) (bullets[i].y - 8);
-			vex = (int) (bullets[i].x + 4);
-			vey = (int) (bullets[i].y + 8);
-			usx = TEX_BULLETS_X + bullets[i].color * 8;
-			usy = TEX_BULLETS_Y + 8 + 16;
-			uex = usx + 8;
-			uey = usy + 16;
-			break;
-		}
-		add_rect_vertex(&app->buf, vsx, vsy, vex, vey, usx, usy, uex,
-				uey);
-		n_bullets++;
+	const struct frame *frame = app->info->sim_front;
+	int n_bullets;
+
+	glViewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
+	glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	sprite_batch_begin(&app->sprites, WINDOW_WIDTH, WINDOW_HEIGHT);
+	sprite_batch_add(&app->sprites, app->sprite_back, 0, 0,
+			 WINDOW_WIDTH, WINDOW_HEIGHT, gl->back.x, gl->back.y,
+			 gl->back.x + TEX_BACK_WIDTH,
+			 gl->back.y + TEX_BACK_HEIGHT);
+	sprite_batch_add(&app->sprites, app->sprite_under, app->player.csx,
+			 app->player.csy, app->player.cex, app->player.cey,
+			 gl->img.x + IMG_PLAYER_X, gl->img.y + IMG_PLAYER_Y,
+			 gl->img.x + IMG_PLAYER_X + TEX_PLAYER_WIDTH,
+			 gl->img.y + IMG_PLAYER_Y + TEX_PLAYER_HEIGHT);
+	sprite_batch_add(&app->sprites, app->sprite_under, app->enemy.csx,
+			 app->enemy.csy, app->enemy.cex, app->enemy.cey,
+			 gl->img.x + IMG_ENEMY_X, gl->img.y + IMG_ENEMY_Y,
+			 gl->img.x + IMG_ENEMY_X + TEX_ENEMY_WIDTH,
+			 gl->img.y + IMG_ENEMY_Y + TEX_ENEMY_HEIGHT);
+
+	switch (app->backend) {
+	case BACKEND_CPU:
+	default:
+		/* simulated by simulate() while the last frame was drawn */
+		if (!app->use_instancing)
+			sprite_batch_add_quads(&app->sprites,
+					       app->sprite_bullets,
+					       frame->quads, frame->count);
+		n_bullets = frame->n_bullets;
+		break;
+	case BACKEND_GPU:
+		enemy_main_gpu(&app->enemy, &app->player, &app->gpu,
+			       WINDOW_WIDTH, WINDOW_HEIGHT);
+		n_bullets = bullet_gpu_live(&app->gpu);
+		break;
+	case BACKEND_ANALYTIC:
+		enemy_main_analytic(&app->enemy, &app->analytic,
+				    WINDOW_WIDTH, WINDOW_HEIGHT);
+		n_bullets = app->analytic.n_live;
+		break;
 	}
 
-	{
-		int n;
-		int keta = 0;
-		while (n_bullets > 0) {
-			n = n_bullets % 10;
-			n_bullets /= 10;
-			add_rect_vertex(&app->buf,
-					WINDOW_WIDTH - 8 * keta - 8,
-					WINDOW_HEIGHT - 32,
-					WINDOW_WIDTH - 8 * keta,
-					WINDOW_HEIGHT - 16,
-					TEX_ASCII_X + 8 + n * 8,
-					TEX_ASCII_Y,
-					TEX_ASCII_X + 8 + n * 8 + 8,
-					TEX_ASCII_Y + 16);
-			keta++;
-		}
+	if (app->backend != BACKEND_CPU || app->use_instancing) {
+		/* their bullets go between the sprites and the HUD */
+		sprite_batch_flush(&app->sprites);
+		draw_bullets(app, frame);
 	}
 
+	text_label_printf(&app->label_bullets, "%d", n_bullets);
+
 	//FPS
 	{
 		static int fps_count = 0;
 		static long long fps_time = 0;
 		static float fps = 0;
 		struct timespec spec;
-		int keta = 0;
-		int disp_fps = (int)fps;
-		int n;
 		long long now;
 
 		clock_gettime( CLOCK_MONOTONIC, &spec );
@@ -543,64 +554,40 @@ redraw(void *data, struct rect *damage)
 			}
 		}
 
-		while (disp_fps > 0) {
-			n = disp_fps % 10;
-			disp_fps /= 10;
-			add_rect_vertex(&app->buf,
-					WINDOW_WIDTH - 8 * keta -
-					8 - 16,
-					WINDOW_HEIGHT - 16,
-					WINDOW_WIDTH - 8 * keta -
-					16,
-					WINDOW_HEIGHT,
-					TEX_ASCII_X + 8 + n * 8,
-					TEX_ASCII_Y,
-					TEX_ASCII_X + 8 + n * 8 + 8,
-					TEX_ASCII_Y + 16);
-			keta++;
-		}
-		add_rect_vertex(&app->buf,
-				WINDOW_WIDTH - 8 - 8,
-				WINDOW_HEIGHT - 16,
-				WINDOW_WIDTH - 8,
-				WINDOW_HEIGHT,
-				TEX_ASCII_X + 8 + 14 * 8,
-				TEX_ASCII_Y,
-				TEX_ASCII_X + 8 + 14 * 8 + 8,
-				TEX_ASCII_Y + 16);
-		n = (int)(fps * 10) % 10;
-		add_rect_vertex(&app->buf,
-				WINDOW_WIDTH - 8,
-				WINDOW_HEIGHT - 16,
-				WINDOW_WIDTH,
-				WINDOW_HEIGHT,
-				TEX_ASCII_X + 8 + n * 8,
-				TEX_ASCII_Y,
-				TEX_ASCII_X + 8 + n * 8 + 8,
-				TEX_ASCII_Y + 16);
+		text_label_printf(&app->label_fps, "%d.%d", (int)fps,
+				  (int)(fps * 10) % 10);
 	}
 
-	glViewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
+	sprite_batch_end(&app->sprites);
+	if (app->backend == BACKEND_CPU && app->use_instancing)
+		bullet_instanced_end_frame(&app->instanced);
+	text_label_draw(&app->label_bullets, &app->sprites, app->sprite_hud);
+	text_label_draw(&app->label_fps, &app->sprites, app->sprite_hud);
+}
 
-	glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
-	glClear(GL_COLOR_BUFFER_BIT);
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, gl->texture);
-	glUniform1i(gl->sh_texture, 0);
-	glUniform2f(gl->sh_screen_size, WINDOW_WIDTH, WINDOW_HEIGHT);
-	glUniform2f(gl->sh_tex_size, TEX_WIDTH, TEX_HEIGHT);
-
-	glVertexAttribPointer(gl->sh_texcoord, 2, GL_SHORT, GL_FALSE, 0,
-			      app->buf.texcoord_buffer);
-	glVertexAttribPointer(gl->sh_position, 3, GL_SHORT, GL_FALSE, 0,
-			      app->buf.vertex_buffer);
-	glDrawArrays(GL_TRIANGLES, 0, app->buf.vertex_count);
+static void
+frame_init(struct frame *frame, const struct bullet_quads *bullet_quads)
+{
+	frame->bullet_quads = bullet_quads;
+	frame->n_bullets = 0;
+	frame->count = 0;
+	frame->quads = malloc(MAX_BULLETS * 4 * sizeof(*frame->quads));
+	frame->instances = malloc(MAX_BULLETS * sizeof(*frame->instances));
+	assert(frame->quads && frame->instances);
+}
+
+static void
+frame_fini(struct frame *frame)
+{
+	free(frame->quads);
+	free(frame->instances);
 }
 
 int
 main(int argc, char **argv)
 {
 	struct app app;
+	int i, ret;
 	struct app_info info = {
 		.name = "gl-bullet",
 		.id = "jp.co.igel.gl-bullet",
@@ -610,15 +597,26 @@ main(int argc, char **argv)
 			.init_gl = init_gl,
 			.deinit_gl = deinit_gl,
 			.redraw = redraw,
+			.simulate = simulate,
 			.user_data = &app,
 		},
+		.sim_state = { &app.frames[0], &app.frames[1] },
 	};
 
 	player_init(&app.player, WINDOW_WIDTH, WINDOW_HEIGHT);
 	enemy_init(&app.enemy, WINDOW_WIDTH, WINDOW_HEIGHT);
+	ret = bullet_grid_init(&app.grid, WINDOW_WIDTH, WINDOW_HEIGHT,
+			       GRID_CELL, MAX_BULLETS);
+	assert(ret == 0);
+	for (i = 0; i < 2; i++)
+		frame_init(&app.frames[i], &app.bullet_quads);
+	app.info = &info;
 
 	app_main(argc, argv, &info);
 
+	for (i = 0; i < 2; i++)
+		frame_fini(&app.frames[i]);
+	bullet_grid_fini(&app.grid);
 	enemy_deinit(&app.enemy);
 
 	return 0;
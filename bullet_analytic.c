@@ -0,0 +1,399 @@
+/*
+ * Copyright © 2022 IGEL Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *    Tomohito Esaki <etom@igel.co.jp>
+ */
+
+#include <math.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <GLES2/gl2.h>
+
+#include "gl_state.h"
+#include "shader.h"
+#include "bullet_analytic.h"
+
+#define NEVER	UINT32_MAX
+
+/* Everything the shader needs, repeated on the six vertices of a quad */
+struct analytic_vertex {
+	float origin[2];
+	float velocity[2];
+	float motion[4];	/* gravity, gravity_until, birth, expire */
+	short corner[2];
+	short texcoord[2];
+};
+
+#define TO_STRING(x)	#x
+static const char *vert_shader_text = TO_STRING(
+	attribute vec2 origin;
+	attribute vec2 velocity;
+	attribute vec4 motion;
+	attribute vec2 corner;
+	attribute vec2 texcoord;
+	varying vec2 texcoordVarying;
+	uniform vec2 screenSize;
+	uniform vec2 texSize;
+	uniform float time;
+	void main()
+	{
+		float n = time - motion.z;
+		float m = min(n, motion.y);
+		vec2 pos = origin + velocity * n;
+		pos.y -= motion.x * (m * (m + 1.0) * 0.5 + (n - m) * motion.y);
+		pos = sign(pos) * floor(abs(pos)) + corner;
+		gl_Position = vec4(pos * 2.0 / screenSize - 1.0, 0.0, 1.0);
+		if (time >= motion.w)
+			gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+		texcoordVarying = texcoord / texSize;
+	});
+
+static const char *frag_shader_text = TO_STRING(
+	precision mediump float;
+	varying vec2 texcoordVarying;
+	uniform sampler2D texture;
+	void main() {
+		gl_FragColor = texture2D(texture, texcoordVarying);
+	});
+
+/* Quad corners in the order of sprite_batch_add(), 1 for the far edge */
+static const struct {
+	short x, y, u, v;
+} quad_corners[6] = {
+	{ 0, 1, 0, 0 },
+	{ 1, 1, 1, 0 },
+	{ 0, 0, 0, 1 },
+	{ 1, 1, 1, 0 },
+	{ 0, 0, 0, 1 },
+	{ 1, 0, 1, 1 },
+};
+
+int
+bullet_analytic_init(struct bullet_analytic *a, int capacity,
+		     const struct bullet_sprite_info *sprites)
+{
+	struct shader_info shader;
+
+	memset(a, 0, sizeof(*a));
+	a->expire = calloc(capacity, sizeof(uint32_t));
+	a->free_slots = calloc(capacity, sizeof(int));
+	a->vertices = calloc(capacity * 6, sizeof(struct analytic_vertex));
+	if (!a->expire || !a->free_slots || !a->vertices) {
+		bullet_analytic_fini(a);
+		return -1;
+	}
+	memcpy(a->sprites, sprites, sizeof(a->sprites));
+	a->capacity = capacity;
+	a->dirty_first = capacity;
+	a->dirty_last = -1;
+
+	memset(&shader, 0x0, sizeof(shader));
+	shader.vertex = vert_shader_text;
+	shader.fragment = frag_shader_text;
+	a->program = shader_build_program(&shader);
+	if (!a->program) {
+		bullet_analytic_fini(a);
+		return -1;
+	}
+
+	a->loc.origin = glGetAttribLocation(a->program, "origin");
+	a->loc.velocity = glGetAttribLocation(a->program, "velocity");
+	a->loc.motion = glGetAttribLocation(a->program, "motion");
+	a->loc.corner = glGetAttribLocation(a->program, "corner");
+	a->loc.texcoord = glGetAttribLocation(a->program, "texcoord");
+	a->loc.texture = glGetUniformLocation(a->program, "texture");
+	a->loc.screen_size = glGetUniformLocation(a->program, "screenSize");
+	a->loc.tex_size = glGetUniformLocation(a->program, "texSize");
+	a->loc.time = glGetUniformLocation(a->program, "time");
+
+	glGenBuffers(1, &a->buffer);
+	gl_state_bind_buffer(GL_ARRAY_BUFFER, a->buffer);
+	glBufferData(GL_ARRAY_BUFFER,
+		     capacity * 6 * sizeof(struct analytic_vertex), NULL,
+		     GL_DYNAMIC_DRAW);
+
+	return 0;
+}
+
+void
+bullet_analytic_fini(struct bullet_analytic *a)
+{
+	if (a->program)
+		gl_state_delete_program(a->program);
+	if (a->buffer)
+		gl_state_delete_buffers(1, &a->buffer);
+	free(a->expire);
+	free(a->free_slots);
+	free(a->vertices);
+	memset(a, 0, sizeof(*a));
+}
+
+static int
+outside(double v, double lo, double hi)
+{
+	return v < lo || v > hi;
+}
+
+/* Centre height n frames after spawn, what the shader computes */
+static double
+height_at(double y, double vy, const struct bullet_motion *motion,
+	  double n)
+{
+	double u = motion->gravity_until;
+	double m = n < u ? n : u;
+
+	return y + n * vy - motion->gravity * (m * (m + 1.0) / 2.0 +
+					       (n - m) * u);
+}
+
+/* First integer n past a + b * n leaving [lo, hi], which it starts in */
+static double
+linear_exit(double a, double b, double lo, double hi)
+{
+	if (b > 0.0)
+		return floor((hi - a) / b) + 1.0;
+	if (b < 0.0)
+		return floor((lo - a) / b) + 1.0;
+	return HUGE_VAL;
+}
+
+/*
+ * First integer n in (s, e] with a + b * n + c * n * n outside [lo, hi],
+ * given that n = s is inside. The first such n follows one of the
+ * crossings of lo or hi, so only those candidates are checked.
+ */
+static double
+quadratic_exit(double a, double b, double c, double lo, double hi,
+	       double s, double e)
+{
+	const double bound[2] = { lo, hi };
+	double best = HUGE_VAL;
+	int i, j;
+
+	if (c == 0.0) {
+		best = linear_exit(a, b, lo, hi);
+		return best <= e ? best : HUGE_VAL;
+	}
+
+	for (i = 0; i < 2; i++) {
+		double d = b * b - 4.0 * c * (a - bound[i]);
+
+		if (d < 0.0)
+			continue;
+		d = sqrt(d);
+		for (j = -1; j <= 1; j += 2) {
+			double n = floor((-b + j * d) / (2.0 * c)) + 1.0;
+
+			if (n > s && n <= e && n < best &&
+			    outside(a + b * n + c * n * n, lo, hi))
+				best = n;
+		}
+	}
+
+	return best;
+}
+
+/*
+ * Frames after spawn until the bullet is retired: the first n > till at
+ * which its centre lies outside the bounds, as with the CPU kernels.
+ */
+static double
+exit_frame(float x, float y, float vx, float vy,
+	   const struct bullet_motion *motion, int w, int h)
+{
+	const double xmin = -BULLET_MARGIN, xmax = w + BULLET_MARGIN;
+	const double ymin = -BULLET_MARGIN, ymax = h + BULLET_MARGIN;
+	double g = motion->gravity, u = motion->gravity_until;
+	double s = motion->till + 1.0;
+	double nx, ny, vb, t;
+
+	if (outside(x + s * vx, xmin, xmax) ||
+	    outside(height_at(y, vy, motion, s), ymin, ymax))
+		return s;
+
+	nx = linear_exit(x, vx, xmin, xmax);
+
+	ny = HUGE_VAL;
+	if (s <= u)
+		ny = quadratic_exit(y, vy - g / 2.0, -g / 2.0, ymin, ymax,
+				    s, u);
+	if (ny == HUGE_VAL) {
+		/* past gravity_until the fall speed stays at vy - g * u */
+		vb = vy - g * u;
+		t = s > u + 1.0 ? s : u + 1.0;
+		if (outside(height_at(y, vy, motion, t), ymin, ymax))
+			ny = t;
+		else
+			ny = linear_exit(height_at(y, vy, motion, u) - u * vb,
+					 vb, ymin, ymax);
+	}
+
+	return nx < ny ? nx : ny;
+}
+
+/* Puts slots that expired back on the free list, lowest on top */
+static void
+retire_expired(struct bullet_analytic *a)
+{
+	int i;
+
+	a->n_free = 0;
+	for (i = a->n_slots - 1; i >= 0; i--) {
+		if (a->expire[i] > a->now)
+			continue;
+		if (a->expire[i]) {
+			a->expire[i] = 0;
+			a->n_live--;
+		}
+		if (i == a->n_slots - 1)
+			a->n_slots--;
+		else
+			a->free_slots[a->n_free++] = i;
+	}
+}
+
+static int
+alloc_slot(struct bullet_analytic *a)
+{
+	if (a->n_free > 0)
+		return a->free_slots[--a->n_free];
+	if (a->n_slots < a->capacity)
+		return a->n_slots++;
+	return -1;
+}
+
+static void
+spawn(struct bullet_analytic *a, const struct bullet_bucket *b, int i,
+      int w, int h)
+{
+	const struct bullet_sprite_info *sp =
+		&a->sprites[BULLET_SPRITE_TYPE(b->sprite[i])];
+	int color = BULLET_SPRITE_COLOR(b->sprite[i]);
+	int su = sp->u + color * sp->w, sv = sp->v;
+	/* the CPU path advances a bullet in the frame it is spawned */
+	uint32_t birth = a->now - 1 - b->count[i];
+	double n = exit_frame(b->x[i], b->y[i], b->vx[i], b->vy[i],
+			      &b->motion, w, h);
+	struct analytic_vertex *v;
+	int slot, k;
+
+	slot = alloc_slot(a);
+	if (slot < 0)
+		return;
+
+	a->expire[slot] = n < (double)(NEVER - birth) ? birth + n : NEVER;
+	a->n_live++;
+
+	v = &a->vertices[slot * 6];
+	for (k = 0; k < 6; k++) {
+		v[k].origin[0] = b->x[i];
+		v[k].origin[1] = b->y[i];
+		v[k].velocity[0] = b->vx[i];
+		v[k].velocity[1] = b->vy[i];
+		v[k].motion[0] = b->motion.gravity;
+		v[k].motion[1] = b->motion.gravity_until;
+		v[k].motion[2] = birth;
+		v[k].motion[3] = a->expire[slot];
+		v[k].corner[0] = quad_corners[k].x ? sp->half_w : -sp->half_w;
+		v[k].corner[1] = quad_corners[k].y ? sp->half_h : -sp->half_h;
+		v[k].texcoord[0] = su + quad_corners[k].u * sp->w;
+		v[k].texcoord[1] = sv + quad_corners[k].v * sp->h;
+	}
+
+	if (a->dirty_first > slot)
+		a->dirty_first = slot;
+	if (a->dirty_last < slot)
+		a->dirty_last = slot;
+}
+
+void
+bullet_analytic_update(struct bullet_analytic *a,
+		       struct bullet_pool *spawns, int w, int h)
+{
+	const size_t quad = 6 * sizeof(struct analytic_vertex);
+	int i, k;
+
+	a->now++;
+	if (a->now % BULLET_ANALYTIC_RETIRE == 0)
+		retire_expired(a);
+
+	for (k = 0; k < spawns->n_buckets; k++) {
+		const struct bullet_bucket *b = &spawns->buckets[k];
+
+		bullet_bucket_for_each(i, b)
+			spawn(a, b, i, w, h);
+	}
+	bullet_pool_clear(spawns);
+
+	/* one upload for the frame, spawns land on the lowest free slots */
+	if (a->dirty_first > a->dirty_last)
+		return;
+	gl_state_bind_buffer(GL_ARRAY_BUFFER, a->buffer);
+	glBufferSubData(GL_ARRAY_BUFFER, a->dirty_first * quad,
+			(a->dirty_last - a->dirty_first + 1) * quad,
+			&a->vertices[a->dirty_first * 6]);
+	a->dirty_first = a->capacity;
+	a->dirty_last = -1;
+}
+
+static void
+set_attrib(GLuint loc, GLint size, GLenum type, size_t offset)
+{
+	glEnableVertexAttribArray(loc);
+	gl_state_vertex_attrib_pointer(loc, size, type, GL_FALSE,
+				       sizeof(struct analytic_vertex),
+				       (const void *)offset);
+}
+
+void
+bullet_analytic_draw(struct bullet_analytic *a, int w, int h,
+		     int tex_w, int tex_h)
+{
+	gl_state_use_program(a->program);
+	glUniform1i(a->loc.texture, 0);
+	glUniform2f(a->loc.screen_size, w, h);
+	glUniform2f(a->loc.tex_size, tex_w, tex_h);
+	glUniform1f(a->loc.time, a->now);
+
+	gl_state_bind_buffer(GL_ARRAY_BUFFER, a->buffer);
+	set_attrib(a->loc.origin, 2, GL_FLOAT,
+		   offsetof(struct analytic_vertex, origin));
+	set_attrib(a->loc.velocity, 2, GL_FLOAT,
+		   offsetof(struct analytic_vertex, velocity));
+	set_attrib(a->loc.motion, 4, GL_FLOAT,
+		   offsetof(struct analytic_vertex, motion));
+	set_attrib(a->loc.corner, 2, GL_SHORT,
+		   offsetof(struct analytic_vertex, corner));
+	set_attrib(a->loc.texcoord, 2, GL_SHORT,
+		   offsetof(struct analytic_vertex, texcoord));
+
+	glDrawArrays(GL_TRIANGLES, 0, a->n_slots * 6);
+
+	glDisableVertexAttribArray(a->loc.origin);
+	glDisableVertexAttribArray(a->loc.velocity);
+	glDisableVertexAttribArray(a->loc.motion);
+	glDisableVertexAttribArray(a->loc.corner);
+	glDisableVertexAttribArray(a->loc.texcoord);
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright © 2022 IGEL Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *    Tomohito Esaki <etom@igel.co.jp>
+ */
+
+#ifndef BULLET_ANALYTIC_H
+#define BULLET_ANALYTIC_H
+
+#include <stdint.h>
+
+#include "bullet_pool.h"
+
+/*
+ * Stateless ballistic bullets.
+ *
+ * A bullet of this path never changes after its spawn: the position
+ * after n frames has a closed form for the motions of the pool (constant
+ * velocity, vy decreased by gravity while the frame count is below
+ * gravity_until), so the vertex shader evaluates it from the spawn data
+ * and a time uniform. The frame at which the bullet would be retired is
+ * solved once at spawn as well; the shader hides the bullet from then on
+ * and the CPU returns expired slots to the free list in batches.
+ *
+ * Each bullet is uploaded once, at spawn, and nothing is touched per
+ * bullet per frame. Bullets are not absorbed by the player.
+ * Include <GLES2/gl2.h> or a later GLES header before this one.
+ */
+
+/* Expired slots are collected every BULLET_ANALYTIC_RETIRE frames */
+#define BULLET_ANALYTIC_RETIRE	16
+
+struct analytic_vertex;
+
+struct bullet_analytic {
+	GLuint program;
+	GLuint buffer;
+	struct {
+		GLuint origin;
+		GLuint velocity;
+		GLuint motion;
+		GLuint corner;
+		GLuint texcoord;
+		GLuint texture;
+		GLuint screen_size;
+		GLuint tex_size;
+		GLuint time;
+	} loc;
+	struct bullet_sprite_info sprites[BULLET_TYPE_COUNT];
+	int capacity;
+	int n_slots;		/* slots below this may be drawn */
+	int n_live;
+	uint32_t now;
+	uint32_t *expire;	/* 0 for a free slot */
+	int *free_slots;	/* lowest on top */
+	int n_free;
+	struct analytic_vertex *vertices;
+	int dirty_first;
+	int dirty_last;
+};
+
+/* sprites has BULLET_TYPE_COUNT entries; needs a current context */
+int bullet_analytic_init(struct bullet_analytic *a, int capacity,
+			 const struct bullet_sprite_info *sprites);
+void bullet_analytic_fini(struct bullet_analytic *a);
+
+/*
+ * Advances the time by one frame, retires expired slots on batch frames
+ * and moves every bullet of spawns to the GPU, clearing the pool. w and
+ * h are the screen size the bullets are retired against.
+ */
+void bullet_analytic_update(struct bullet_analytic *a,
+			    struct bullet_pool *spawns, int w, int h);
+
+/*
+ * Draws every slot with the bullet program, texture unit 0 holding the
+ * sprite texture. Changes the current program and leaves the attribute
+ * arrays of the program disabled.
+ */
+void bullet_analytic_draw(struct bullet_analytic *a, int w, int h,
+			  int tex_w, int tex_h);
+
+#endif
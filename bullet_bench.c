@@ -0,0 +1,689 @@
+/*
+ * Copyright © 2022 IGEL Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *    Tomohito Esaki <etom@igel.co.jp>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bullet_grid.h"
+#include "bullet_pattern.h"
+#include "bullet_pool.h"
+#include "bullet_quads.h"
+#include "thread_pool.h"
+
+#define WIDTH		640
+#define HEIGHT		480
+#define BENCH_MSEC	300
+#define MAX_KERNELS	8
+
+#define ARRAY_LENGTH(a) (sizeof (a) / sizeof (a)[0])
+#define ALIGN_UP(x, a)	(((x) + (a) - 1) / (a) * (a))
+
+static const int bench_sizes[] = { 12000, 100000, 1000000 };
+static const int scale_sizes[] = { 100000, 1000000 };
+
+/* player hitbox used by the collision benchmark */
+#define HIT_X0		302.0f
+#define HIT_Y0		222.0f
+#define HIT_X1		338.0f
+#define HIT_Y1		258.0f
+#define GRID_CELL	32
+/* Most a grid build plus query may take at GRID_BUDGET_BULLETS */
+#define GRID_BUDGET_MSEC	0.5
+#define GRID_BUDGET_BULLETS	100000
+
+#define PATTERN_FRAMES	120
+
+static const int emitter_counts[] = { 16, 64, 256 };
+
+/* about 28 bullets per emitter and frame */
+static const char *storm_pattern =
+	"motion drift gravity 0 until 0 till 0\n"
+	"emitter storm\n"
+	"	sweep every 30 period 90 150 center 270 amp 60\n"
+	"	ring every 6 motion drift sprite small 1 count 64 "
+		"angle sweep speed 2\n"
+	"	spread every 3 motion drift sprite large 2 count 16 "
+		"angle sweep step 6 speed 3\n"
+	"	burst every 2 motion drift sprite needle 3 count 24 "
+		"from 0 to 360 speed 1.5\n"
+	"end\n";
+
+static double
+get_msec(void)
+{
+	struct timespec tm;
+
+	clock_gettime(CLOCK_MONOTONIC, &tm);
+	return tm.tv_sec * 1000.0 + tm.tv_nsec / 1000000.0;
+}
+
+static void
+fill_pool(struct bullet_pool *pool, int n)
+{
+	unsigned int seed = 1;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		float x = rand_r(&seed) % WIDTH;
+		float y = rand_r(&seed) % HEIGHT;
+		float vx = (rand_r(&seed) % 600) / 100.0f - 3.0f;
+		float vy = (rand_r(&seed) % 600) / 100.0f - 3.0f;
+
+		bullet_pool_spawn(pool, 0, BULLET_SPRITE(BULLET_TYPE_SMALL, 0),
+				  x, y, vx, vy);
+	}
+}
+
+static int
+init_static_pool(struct bullet_pool *pool, int n)
+{
+	/* never retired, so the population stays constant */
+	static const struct bullet_motion motion = {
+		.gravity = 0.0f,
+		.gravity_until = 0,
+		.till = UINT16_MAX,
+	};
+
+	if (bullet_pool_init(pool, n, &motion, 1) < 0)
+		return -1;
+	fill_pool(pool, n);
+
+	return 0;
+}
+
+/* Returns bullet updates per millisecond */
+static double
+bench_update(const struct bullet_kernel *kernel, struct thread_pool *threads,
+	     int n)
+{
+	struct bullet_pool pool;
+	double start, elapsed;
+	long frames = 0;
+
+	if (init_static_pool(&pool, n) < 0) {
+		fprintf(stderr, "failed to allocate %d bullets\n", n);
+		exit(1);
+	}
+	pool.kernel = kernel;
+	bullet_pool_set_threads(&pool, threads);
+
+	start = get_msec();
+	do {
+		bullet_pool_update(&pool, WIDTH, HEIGHT);
+		frames++;
+		elapsed = get_msec() - start;
+	} while (elapsed < BENCH_MSEC);
+
+	bullet_pool_fini(&pool);
+
+	return (double)n * frames / elapsed;
+}
+
+/* bullet sprites as laid out in the atlas */
+static const struct bullet_sprite_info quad_sprites[BULLET_TYPE_COUNT] = {
+	[BULLET_TYPE_SMALL] = { 4, 4, 0, 0, 8, 8 },
+	[BULLET_TYPE_LARGE] = { 8, 8, 0, 8, 16, 16 },
+	[BULLET_TYPE_NEEDLE] = { 4, 8, 0, 24, 8, 16 },
+};
+
+/* Returns quads written per millisecond, every bullet on screen */
+static double
+bench_quads(const struct bullet_quad_kernel *kernel, int n)
+{
+	struct bullet_pool pool;
+	struct bullet_quads *q;
+	const struct bullet_bucket *b;
+	int16_t *quads;
+	double start, elapsed;
+	long written = 0;
+	int k, count;
+
+	q = aligned_alloc(64, ALIGN_UP(sizeof(*q), 64));
+	quads = malloc((size_t)n * BULLET_QUAD_SHORTS * sizeof(*quads));
+	if (!q || !quads || init_static_pool(&pool, n) < 0) {
+		fprintf(stderr, "failed to allocate %d bullets\n", n);
+		exit(1);
+	}
+	bullet_quads_init(q, quad_sprites);
+	q->kernel = kernel;
+	b = &pool.buckets[0];
+
+	start = get_msec();
+	do {
+		count = 0;
+		for (k = 0; k < b->used_words; k++)
+			count += bullet_quads_emit(q, quads + count *
+						   BULLET_QUAD_SHORTS,
+						   n - count, b, k, b->live[k]);
+		written += count;
+		elapsed = get_msec() - start;
+	} while (elapsed < BENCH_MSEC);
+
+	bullet_pool_fini(&pool);
+	free(quads);
+	free(q);
+
+	return written / elapsed;
+}
+
+struct quad_output {
+	const struct bullet_quads *q;
+	int16_t *quads;
+	int count;
+	int max;
+};
+
+static void
+append_quads(void *data, const struct bullet_bucket *b, int word,
+	     uint64_t visible)
+{
+	struct quad_output *out = data;
+
+	out->count += bullet_quads_emit(out->q, out->quads + out->count *
+					BULLET_QUAD_SHORTS,
+					out->max - out->count, b, word,
+					visible);
+}
+
+static void
+write_quads(void *data, const struct bullet_bucket *b, int word,
+	    uint64_t visible, int first)
+{
+	struct quad_output *out = data;
+
+	bullet_quads_emit(out->q, out->quads + first * BULLET_QUAD_SHORTS,
+			  out->max - first, b, word, visible);
+}
+
+/*
+ * Emits the quads of a pool with retiring bullets in order on one thread
+ * and at their prefix sum offsets on threads, and compares the output.
+ */
+static int
+check_emit(struct thread_pool *threads)
+{
+	static const struct bullet_motion motions[] = {
+		{ .gravity = 0.04f, .gravity_until = 150, .till = 150 },
+		{ .gravity = 0.03f, .gravity_until = 160, .till = 0 },
+	};
+	const int n = 100000;
+	struct bullet_pool pool[2];
+	struct quad_output out[2];
+	struct bullet_quads *q;
+	int i, j, ret = 0;
+
+	q = aligned_alloc(64, ALIGN_UP(sizeof(*q), 64));
+	if (!q)
+		return -1;
+	bullet_quads_init(q, quad_sprites);
+	for (i = 0; i < 2; i++) {
+		out[i].q = q;
+		out[i].max = n;
+		out[i].quads = malloc((size_t)n * BULLET_QUAD_SHORTS *
+				      sizeof(int16_t));
+		if (!out[i].quads ||
+		    bullet_pool_init(&pool[i], n, motions,
+				     ARRAY_LENGTH(motions)) < 0)
+			return -1;
+	}
+	bullet_pool_set_threads(&pool[1], threads);
+
+	for (j = 0; j < 200 && !ret; j++) {
+		for (i = 0; i < 2; i++)
+			fill_pool(&pool[i], 2000);
+		out[0].count = 0;
+		bullet_pool_update_emit(&pool[0], WIDTH, HEIGHT, append_quads,
+					&out[0]);
+		out[1].count = bullet_pool_update_emit_at(&pool[1], WIDTH,
+							  HEIGHT, write_quads,
+							  &out[1]);
+		if (out[0].count != out[1].count ||
+		    memcmp(out[0].quads, out[1].quads, out[0].count *
+			   BULLET_QUAD_SHORTS * sizeof(int16_t)))
+			ret = -1;
+	}
+
+	for (i = 0; i < 2; i++) {
+		bullet_pool_fini(&pool[i]);
+		free(out[i].quads);
+	}
+	free(q);
+
+	return ret;
+}
+
+/* Returns milliseconds per frame of update + quad emission on threads */
+static double
+bench_emit(struct thread_pool *threads, int n)
+{
+	struct bullet_pool pool;
+	struct quad_output out;
+	struct bullet_quads *q;
+	double start, elapsed;
+	long frames = 0;
+
+	q = aligned_alloc(64, ALIGN_UP(sizeof(*q), 64));
+	out.quads = malloc((size_t)n * BULLET_QUAD_SHORTS * sizeof(int16_t));
+	if (!q || !out.quads || init_static_pool(&pool, n) < 0) {
+		fprintf(stderr, "failed to allocate %d bullets\n", n);
+		exit(1);
+	}
+	bullet_quads_init(q, quad_sprites);
+	out.q = q;
+	out.max = n;
+	bullet_pool_set_threads(&pool, threads);
+
+	start = get_msec();
+	do {
+		bullet_pool_update_emit_at(&pool, WIDTH, HEIGHT, write_quads,
+					   &out);
+		frames++;
+		elapsed = get_msec() - start;
+	} while (elapsed < BENCH_MSEC);
+
+	bullet_pool_fini(&pool);
+	free(out.quads);
+	free(q);
+
+	return elapsed / frames;
+}
+
+/*
+ * Runs a pool with retiring bullets on one thread and on threads, and
+ * compares the resulting slots and occupancy bitmaps.
+ */
+static int
+check_threads(struct thread_pool *threads)
+{
+	static const struct bullet_motion motions[] = {
+		{ .gravity = 0.04f, .gravity_until = 150, .till = 150 },
+		{ .gravity = 0.03f, .gravity_until = 160, .till = 0 },
+	};
+	struct bullet_pool pool[2];
+	int i, j, k, ret = 0;
+
+	for (i = 0; i < 2; i++) {
+		if (bullet_pool_init(&pool[i], 100000, motions,
+				     ARRAY_LENGTH(motions)) < 0)
+			return -1;
+	}
+	bullet_pool_set_threads(&pool[1], threads);
+
+	for (j = 0; j < 200 && !ret; j++) {
+		for (i = 0; i < 2; i++) {
+			fill_pool(&pool[i], 2000);
+			bullet_pool_update(&pool[i], WIDTH, HEIGHT);
+		}
+
+		for (k = 0; k < pool[0].n_buckets; k++) {
+			struct bullet_bucket *a = &pool[0].buckets[k];
+			struct bullet_bucket *b = &pool[1].buckets[k];
+			size_t size = (uint8_t *)a->live - (uint8_t *)a->mem;
+
+			if (a->used_words != b->used_words ||
+			    a->hint != b->hint ||
+			    memcmp(a->mem, b->mem, size) ||
+			    memcmp(a->live, b->live,
+				   a->n_words * sizeof(uint64_t)))
+				ret = -1;
+		}
+		if (pool[0].n_live != pool[1].n_live)
+			ret = -1;
+	}
+
+	for (i = 0; i < 2; i++)
+		bullet_pool_fini(&pool[i]);
+
+	return ret;
+}
+
+static int
+count_naive(const struct bullet_pool *pool, float x0, float y0,
+	    float x1, float y1)
+{
+	const struct bullet_bucket *b = &pool->buckets[0];
+	int i, hits = 0;
+
+	bullet_bucket_for_each(i, b) {
+		if (b->x[i] >= x0 && b->x[i] <= x1 &&
+		    b->y[i] >= y0 && b->y[i] <= y1)
+			hits++;
+	}
+
+	return hits;
+}
+
+/* Compares grid queries against a full scan over a moving pool */
+static int
+check_grid(void)
+{
+	struct bullet_pool pool;
+	struct bullet_grid grid;
+	int i, ret = 0;
+
+	if (init_static_pool(&pool, 100000) < 0)
+		return -1;
+	if (bullet_grid_init(&grid, WIDTH, HEIGHT, GRID_CELL, 100000) < 0) {
+		bullet_pool_fini(&pool);
+		return -1;
+	}
+
+	for (i = 0; i < 100 && !ret; i++) {
+		float x = i * 7 % (WIDTH + 100) - 50;
+		float y = i * 13 % (HEIGHT + 100) - 50;
+
+		bullet_pool_update(&pool, WIDTH, HEIGHT);
+		bullet_grid_build(&grid, &pool);
+		if (bullet_grid_query(&grid, x, y, x + 40, y + 30, NULL,
+				      NULL) !=
+		    count_naive(&pool, x, y, x + 40, y + 30))
+			ret = -1;
+	}
+
+	bullet_grid_fini(&grid);
+	bullet_pool_fini(&pool);
+
+	return ret;
+}
+
+/* Moves every bullet, bouncing off the screen edges */
+static void
+bounce_pool(struct bullet_pool *pool)
+{
+	struct bullet_bucket *b = &pool->buckets[0];
+	int i;
+
+	bullet_bucket_for_each(i, b) {
+		b->x[i] += b->vx[i];
+		b->y[i] += b->vy[i];
+		if (b->x[i] < 0.0f || b->x[i] >= WIDTH)
+			b->vx[i] = -b->vx[i];
+		if (b->y[i] < 0.0f || b->y[i] >= HEIGHT)
+			b->vy[i] = -b->vy[i];
+	}
+}
+
+/*
+ * Returns milliseconds per frame of grid build plus player query, with
+ * the bullets moving between frames
+ */
+static double
+bench_grid(int n, double *naive)
+{
+	struct bullet_pool pool;
+	struct bullet_grid grid;
+	double start, elapsed, ret, timed = 0.0;
+	int frames, hits;
+
+	if (init_static_pool(&pool, n) < 0 ||
+	    bullet_grid_init(&grid, WIDTH, HEIGHT, GRID_CELL, n) < 0) {
+		fprintf(stderr, "failed to allocate %d bullets\n", n);
+		exit(1);
+	}
+
+	/* bounced rather than updated, which would retire them */
+	frames = 0;
+	start = get_msec();
+	do {
+		double t;
+
+		bounce_pool(&pool);
+		t = get_msec();
+		bullet_grid_build(&grid, &pool);
+		hits = bullet_grid_query(&grid, HIT_X0, HIT_Y0, HIT_X1, HIT_Y1,
+					 NULL, NULL);
+		timed += get_msec() - t;
+		frames++;
+		elapsed = get_msec() - start;
+	} while (elapsed < BENCH_MSEC);
+	ret = timed / frames;
+
+	frames = 0;
+	start = get_msec();
+	do {
+		if (count_naive(&pool, HIT_X0, HIT_Y0, HIT_X1, HIT_Y1) != hits)
+			fprintf(stderr, "grid and scan disagree\n");
+		frames++;
+		elapsed = get_msec() - start;
+	} while (elapsed < BENCH_MSEC);
+
+	bullet_grid_fini(&grid);
+	bullet_pool_fini(&pool);
+
+	*naive = elapsed / frames;
+	return ret;
+}
+
+/*
+ * Runs n emitters over PATTERN_FRAMES frames. Returns bullets spawned
+ * per millisecond of emitter time; frame is the mean emit + update time.
+ */
+static double
+bench_pattern(const struct bullet_pattern *pattern, int n, double *frame)
+{
+	const struct bullet_program *program;
+	const struct bullet_motion *motions;
+	struct bullet_emitter *emitters;
+	struct bullet_pool pool;
+	double start, emit = 0.0, update = 0.0;
+	long spawned = 0;
+	int n_motions, i, f;
+
+	program = bullet_pattern_find(pattern, "storm");
+	motions = bullet_pattern_motions(pattern, &n_motions);
+	emitters = calloc(n, sizeof(*emitters));
+	if (!emitters ||
+	    bullet_pool_init(&pool, 1 << 20, motions, n_motions) < 0) {
+		fprintf(stderr, "failed to allocate %d emitters\n", n);
+		exit(1);
+	}
+
+	for (i = 0; i < n; i++)
+		bullet_emitter_init(&emitters[i], program,
+				    (i * 37) % WIDTH, (i * 53) % HEIGHT, i + 1);
+
+	for (f = 0; f < PATTERN_FRAMES; f++) {
+		start = get_msec();
+		for (i = 0; i < n; i++)
+			spawned += bullet_emitter_step(&emitters[i], &pool);
+		emit += get_msec() - start;
+
+		start = get_msec();
+		bullet_pool_update(&pool, WIDTH, HEIGHT);
+		update += get_msec() - start;
+	}
+
+	bullet_pool_fini(&pool);
+	free(emitters);
+
+	*frame = (emit + update) / PATTERN_FRAMES;
+	return spawned / emit;
+}
+
+int
+main(int argc, char **argv)
+{
+	const struct bullet_kernel *kernels[MAX_KERNELS];
+	const struct bullet_quad_kernel *quad_kernels[MAX_KERNELS];
+	struct bullet_pattern *pattern;
+	struct thread_pool *threads;
+	int n_kernels, n_quad_kernels, n_threads, i, j, ret = 0;
+
+	n_threads = argc > 1 ? atoi(argv[1]) : 0;
+	threads = thread_pool_create(n_threads);
+	if (!threads) {
+		fprintf(stderr, "failed to create thread pool\n");
+		return 1;
+	}
+	n_threads = thread_pool_size(threads);
+	thread_pool_destroy(threads);
+
+	n_kernels = bullet_kernel_list(kernels, MAX_KERNELS);
+
+	for (i = 0; i < n_kernels; i++) {
+		int ok = bullet_kernel_check(kernels[i]) == 0;
+
+		printf("check %-8s %s\n", kernels[i]->name,
+		       ok ? "ok" : "FAILED");
+		if (!ok)
+			ret = 1;
+	}
+
+	n_quad_kernels = bullet_quad_kernel_list(quad_kernels, MAX_KERNELS);
+
+	for (i = 0; i < n_quad_kernels; i++) {
+		int ok = bullet_quad_kernel_check(quad_kernels[i]) == 0;
+
+		printf("check quads %-8s %s\n", quad_kernels[i]->name,
+		       ok ? "ok" : "FAILED");
+		if (!ok)
+			ret = 1;
+	}
+
+	threads = thread_pool_create(n_threads);
+	if (check_threads(threads) < 0) {
+		printf("check %d threads FAILED\n", n_threads);
+		ret = 1;
+	} else {
+		printf("check %d threads ok\n", n_threads);
+	}
+	if (check_emit(threads) < 0) {
+		printf("check %d threads emit FAILED\n", n_threads);
+		ret = 1;
+	} else {
+		printf("check %d threads emit ok\n", n_threads);
+	}
+	thread_pool_destroy(threads);
+
+	if (check_grid() < 0) {
+		printf("check grid FAILED\n");
+		ret = 1;
+	} else {
+		printf("check grid ok\n");
+	}
+
+	for (j = 0; j < (int) ARRAY_LENGTH(bench_sizes); j++) {
+		double scalar = 0.0;
+
+		printf("\n%d bullets\n", bench_sizes[j]);
+		for (i = 0; i < n_kernels; i++) {
+			double rate = bench_update(kernels[i], NULL,
+						   bench_sizes[j]);
+
+			if (i == 0)
+				scalar = rate;
+			printf("  %-8s %10.0f updates/ms  %5.2fx\n",
+			       kernels[i]->name, rate, rate / scalar);
+		}
+	}
+
+	for (j = 0; j < (int) ARRAY_LENGTH(bench_sizes); j++) {
+		double scalar = 0.0;
+
+		printf("\n%d bullets, sprite quads\n", bench_sizes[j]);
+		for (i = 0; i < n_quad_kernels; i++) {
+			double rate = bench_quads(quad_kernels[i],
+						  bench_sizes[j]);
+
+			if (i == 0)
+				scalar = rate;
+			printf("  %-8s %10.0f quads/ms    %5.2fx\n",
+			       quad_kernels[i]->name, rate, rate / scalar);
+		}
+	}
+
+	printf("\ncollision, %dpx cells: grid build + player query\n",
+	       GRID_CELL);
+	for (j = 0; j < (int) ARRAY_LENGTH(bench_sizes); j++) {
+		double naive, grid = bench_grid(bench_sizes[j], &naive);
+
+		printf("  %7d bullets %8.3f ms  (full scan %.3f ms)\n",
+		       bench_sizes[j], grid, naive);
+		if (bench_sizes[j] == GRID_BUDGET_BULLETS &&
+		    grid > GRID_BUDGET_MSEC) {
+			printf("  grid over budget, %.3f ms > %.3f ms\n",
+			       grid, GRID_BUDGET_MSEC);
+			ret = 1;
+		}
+	}
+
+	pattern = bullet_pattern_parse(storm_pattern, "storm");
+	if (!pattern)
+		return 1;
+	printf("\npattern emitters, %d frames\n", PATTERN_FRAMES);
+	for (j = 0; j < (int) ARRAY_LENGTH(emitter_counts); j++) {
+		double frame, rate;
+
+		rate = bench_pattern(pattern, emitter_counts[j], &frame);
+		printf("  %4d emitters %10.0f spawns/ms  %.3f ms/frame\n",
+		       emitter_counts[j], rate, frame);
+	}
+	bullet_pattern_destroy(pattern);
+
+	/* thread scaling with the kernel the samples use */
+	for (j = 0; j < (int) ARRAY_LENGTH(scale_sizes); j++) {
+		double single = 0.0;
+
+		printf("\n%d bullets, %s\n", scale_sizes[j],
+		       bullet_kernel_select()->name);
+		for (i = 1; i <= n_threads; i++) {
+			double rate;
+
+			threads = thread_pool_create(i);
+			rate = bench_update(bullet_kernel_select(), threads,
+					    scale_sizes[j]);
+			thread_pool_destroy(threads);
+
+			if (i == 1)
+				single = rate;
+			printf("  %2d threads %10.0f updates/ms  %5.2fx\n",
+			       i, rate, rate / single);
+		}
+	}
+
+	/* the same with the sprite quads of every bullet written out */
+	for (j = 0; j < (int) ARRAY_LENGTH(scale_sizes); j++) {
+		double single = 0.0;
+
+		printf("\n%d bullets, update + quads\n", scale_sizes[j]);
+		for (i = 1; i <= n_threads; i++) {
+			double msec;
+
+			threads = thread_pool_create(i);
+			msec = bench_emit(threads, scale_sizes[j]);
+			thread_pool_destroy(threads);
+
+			if (i == 1)
+				single = msec;
+			printf("  %2d threads %10.3f ms/frame    %5.2fx\n",
+			       i, msec, single / msec);
+		}
+	}
+
+	return ret;
+}
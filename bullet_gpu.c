@@ -0,0 +1,446 @@
+/*
+ * Copyright © 2022 IGEL Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *    Tomohito Esaki <etom@igel.co.jp>
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <GLES3/gl31.h>
+
+#include "gl_state.h"
+#include "shader.h"
+#include "bullet_gpu.h"
+
+#define GROUP_SIZE	64
+
+/*
+ * Layout of the state buffer. draw and count are indexed by the buffer
+ * a frame writes to; dispatch sizes the next survivor pass.
+ */
+struct gpu_state {
+	uint32_t draw[2][4];	/* DrawArraysIndirectCommand */
+	uint32_t dispatch[3];	/* DispatchIndirectCommand */
+	uint32_t count[2];
+};
+
+enum {
+	LOC_SPAWN_COUNT = 0,
+	LOC_CUR,
+	LOC_CAPACITY,
+	LOC_VISIBLE,
+	LOC_BOUNDS,
+	LOC_HITBOX,
+	LOC_MOTIONS,
+	LOC_QUADS = LOC_MOTIONS + BULLET_GPU_MAX_MOTIONS,
+	LOC_UVS = LOC_QUADS + BULLET_TYPE_COUNT,
+};
+
+enum {
+	BINDING_SRC = 0,
+	BINDING_DST,
+	BINDING_SPAWN,
+	BINDING_STATE,
+	BINDING_VERTEX,
+};
+
+#define TO_STRING(x)	#x
+static const char *update_shader_text = "#version 310 es\n" TO_STRING(
+	struct Bullet {
+		vec2 p;
+		vec2 v;
+		uint count;
+		uint sprite;
+		uint motion;
+		uint pad;
+	};
+	layout (std430, binding=0) readonly buffer Src {
+		Bullet src[];
+	};
+	layout (std430, binding=1) writeonly buffer Dst {
+		Bullet dst[];
+	};
+	layout (std430, binding=2) readonly buffer Spawn {
+		Bullet spawn[];
+	};
+	layout (std430, binding=3) buffer State {
+		uint draw[8];
+		uint dispatch[3];
+		uint count[2];
+	};
+	layout (std430, binding=4) writeonly buffer Vertices {
+		uvec2 vtx[];
+	};
+	layout (location=0) uniform uint spawnCount;
+	layout (location=1) uniform uint cur;
+	layout (location=2) uniform uint capacity;
+	layout (location=3) uniform vec4 visible;
+	layout (location=4) uniform vec4 bounds;
+	layout (location=5) uniform vec4 hitbox;
+	layout (location=6) uniform vec4 motions[8];
+	layout (location=14) uniform ivec4 quads[3];
+	layout (location=17) uniform ivec2 uvs[3];
+	layout (local_size_x = 64) in;
+
+	uvec2 pack_vertex(int x, int y, int u, int v)
+	{
+		return uvec2(uint(x & 0xffff) | (uint(y & 0xffff) << 16),
+			     uint(u & 0xffff) | (uint(v & 0xffff) << 16));
+	}
+
+	void emit_quad(uint n, Bullet b)
+	{
+		uint type = b.sprite >> 4;
+		int color = int(b.sprite & 15u);
+		ivec4 q = quads[type];
+		int x = int(b.p.x);
+		int y = int(b.p.y);
+		int sx = x - q.x;
+		int sy = y - q.y;
+		int ex = x + q.x;
+		int ey = y + q.y;
+		int su = uvs[type].x + color * q.z;
+		int sv = uvs[type].y;
+		int eu = su + q.z;
+		int ev = sv + q.w;
+
+		vtx[n] = pack_vertex(sx, ey, su, sv);
+		vtx[n + 1u] = pack_vertex(ex, ey, eu, sv);
+		vtx[n + 2u] = pack_vertex(sx, sy, su, ev);
+		vtx[n + 3u] = pack_vertex(ex, ey, eu, sv);
+		vtx[n + 4u] = pack_vertex(sx, sy, su, ev);
+		vtx[n + 5u] = pack_vertex(ex, sy, eu, ev);
+	}
+
+	void main()
+	{
+		uint i = gl_GlobalInvocationID.x;
+		uint next = cur ^ 1u;
+		Bullet b;
+		vec4 m;
+		bool outside;
+		uint n;
+
+		if (spawnCount > 0u) {
+			if (i >= spawnCount)
+				return;
+			b = spawn[i];
+		} else {
+			if (i >= count[cur])
+				return;
+			b = src[i];
+		}
+
+		m = motions[b.motion];
+		b.v.y -= float(b.count) < m.y ? m.x : 0.0;
+		b.p += b.v;
+		b.count = min(b.count + 1u, 65535u);
+
+		if (all(greaterThanEqual(b.p, visible.xy)) &&
+		    all(lessThanEqual(b.p, visible.zw))) {
+			n = atomicAdd(draw[next * 4u], 6u);
+			if (n < capacity * 6u)
+				emit_quad(n, b);
+		}
+
+		outside = any(lessThan(b.p, bounds.xy)) ||
+			any(greaterThan(b.p, bounds.zw));
+		if (outside && float(b.count) > m.z)
+			return;
+		if (all(greaterThanEqual(b.p, hitbox.xy)) &&
+		    all(lessThanEqual(b.p, hitbox.zw)))
+			return;
+
+		n = atomicAdd(count[next], 1u);
+		if (n < capacity)
+			dst[n] = b;
+	});
+
+/* Clamps what the update pass counted and prepares the next frame */
+static const char *finish_shader_text = "#version 310 es\n" TO_STRING(
+	layout (std430, binding=3) buffer State {
+		uint draw[8];
+		uint dispatch[3];
+		uint count[2];
+	};
+	layout (location=1) uniform uint cur;
+	layout (location=2) uniform uint capacity;
+	layout (local_size_x = 1) in;
+
+	void main()
+	{
+		uint next = cur ^ 1u;
+		uint n = min(count[next], capacity);
+
+		count[next] = n;
+		draw[next * 4u] = min(draw[next * 4u], capacity * 6u);
+		dispatch[0] = (n + 63u) / 64u;
+
+		count[cur] = 0u;
+		draw[cur * 4u] = 0u;
+	});
+
+int
+bullet_gpu_supported(void)
+{
+	return shader_gl_version() >= 31;
+}
+
+static GLuint
+build_compute(const char *text)
+{
+	struct shader_info shader;
+
+	memset(&shader, 0x0, sizeof(shader));
+	shader.compute = text;
+	return shader_build_program(&shader);
+}
+
+static GLuint
+create_buffer(GLenum target, GLsizeiptr size, const void *data,
+	      GLenum usage)
+{
+	GLuint buffer;
+
+	glGenBuffers(1, &buffer);
+	gl_state_bind_buffer(target, buffer);
+	glBufferData(target, size, data, usage);
+
+	return buffer;
+}
+
+int
+bullet_gpu_init(struct bullet_gpu *gpu, int capacity,
+		const struct bullet_motion *motions, int n_motions,
+		const struct bullet_sprite_info *sprites)
+{
+	struct gpu_state state = {
+		.draw = { { 0, 1, 0, 0 }, { 0, 1, 0, 0 } },
+		.dispatch = { 0, 1, 1 },
+	};
+	GLsizeiptr size = capacity * sizeof(struct bullet_gpu_bullet);
+	const uint32_t zero = 0;
+	int i;
+
+	memset(gpu, 0, sizeof(*gpu));
+	if (n_motions > BULLET_GPU_MAX_MOTIONS)
+		return -1;
+
+	gpu->spawns = malloc(size);
+	if (!gpu->spawns)
+		return -1;
+	gpu->capacity = capacity;
+
+	gpu->update = build_compute(update_shader_text);
+	gpu->finish = build_compute(finish_shader_text);
+	if (!gpu->update || !gpu->finish) {
+		bullet_gpu_fini(gpu);
+		return -1;
+	}
+
+	for (i = 0; i < 2; i++)
+		gpu->bullets[i] = create_buffer(GL_SHADER_STORAGE_BUFFER,
+						size, NULL, GL_DYNAMIC_COPY);
+	gpu->spawn = create_buffer(GL_SHADER_STORAGE_BUFFER, size, NULL,
+				   GL_STREAM_DRAW);
+	gpu->state = create_buffer(GL_SHADER_STORAGE_BUFFER, sizeof(state),
+				   &state, GL_DYNAMIC_COPY);
+	/* two GL_SHORT pairs per vertex, six vertices per bullet */
+	gpu->vertex = create_buffer(GL_SHADER_STORAGE_BUFFER,
+				    capacity * 6 * 4 * sizeof(GLshort), NULL,
+				    GL_DYNAMIC_COPY);
+	for (i = 0; i < BULLET_GPU_READBACK; i++)
+		gpu->readback[i] = create_buffer(GL_COPY_WRITE_BUFFER,
+						 sizeof(uint32_t), &zero,
+						 GL_STREAM_READ);
+	glGenVertexArrays(1, &gpu->vao);
+
+	gl_state_use_program(gpu->update);
+	glUniform1ui(LOC_CAPACITY, capacity);
+	for (i = 0; i < n_motions; i++)
+		glUniform4f(LOC_MOTIONS + i, motions[i].gravity,
+			    motions[i].gravity_until, motions[i].till, 0.0f);
+	for (i = 0; i < BULLET_TYPE_COUNT; i++) {
+		glUniform4i(LOC_QUADS + i, sprites[i].half_w,
+			    sprites[i].half_h, sprites[i].w, sprites[i].h);
+		glUniform2i(LOC_UVS + i, sprites[i].u, sprites[i].v);
+	}
+	gl_state_use_program(gpu->finish);
+	glUniform1ui(LOC_CAPACITY, capacity);
+
+	return 0;
+}
+
+void
+bullet_gpu_fini(struct bullet_gpu *gpu)
+{
+	gl_state_delete_program(gpu->update);
+	gl_state_delete_program(gpu->finish);
+	gl_state_delete_buffers(2, gpu->bullets);
+	gl_state_delete_buffers(1, &gpu->spawn);
+	gl_state_delete_buffers(1, &gpu->state);
+	gl_state_delete_buffers(1, &gpu->vertex);
+	gl_state_delete_buffers(BULLET_GPU_READBACK, gpu->readback);
+	gl_state_delete_vertex_arrays(1, &gpu->vao);
+	free(gpu->spawns);
+	memset(gpu, 0, sizeof(*gpu));
+}
+
+/* Packs the bullets of the pool as spawn commands and empties it */
+static int
+collect_spawns(struct bullet_gpu *gpu, struct bullet_pool *pool)
+{
+	int i, k, n = 0;
+
+	for (k = 0; k < pool->n_buckets; k++) {
+		const struct bullet_bucket *b = &pool->buckets[k];
+
+		bullet_bucket_for_each(i, b) {
+			struct bullet_gpu_bullet *s = &gpu->spawns[n];
+
+			if (n == gpu->capacity)
+				break;
+			s->x = b->x[i];
+			s->y = b->y[i];
+			s->vx = b->vx[i];
+			s->vy = b->vy[i];
+			s->count = b->count[i];
+			s->sprite = b->sprite[i];
+			s->motion = k;
+			n++;
+		}
+	}
+	bullet_pool_clear(pool);
+
+	return n;
+}
+
+/*
+ * The live count is copied aside every frame and the copy made
+ * BULLET_GPU_READBACK - 1 frames earlier is mapped, so the map does not
+ * wait for the frame in flight.
+ */
+static void
+read_live(struct bullet_gpu *gpu, int next)
+{
+	int i = gpu->frame % BULLET_GPU_READBACK;
+	uint32_t *p;
+
+	gl_state_bind_buffer(GL_COPY_READ_BUFFER, gpu->state);
+	gl_state_bind_buffer(GL_COPY_WRITE_BUFFER, gpu->readback[i]);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+			    offsetof(struct gpu_state, count[next]), 0,
+			    sizeof(uint32_t));
+
+	i = (i + 1) % BULLET_GPU_READBACK;
+	gl_state_bind_buffer(GL_COPY_WRITE_BUFFER, gpu->readback[i]);
+	p = glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, sizeof(uint32_t),
+			     GL_MAP_READ_BIT);
+	if (p) {
+		gpu->n_live = *p;
+		glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+	}
+	gpu->frame++;
+}
+
+void
+bullet_gpu_update(struct bullet_gpu *gpu, struct bullet_pool *spawns,
+		  int w, int h, float x0, float y0, float x1, float y1)
+{
+	int cur = gpu->cur, next = cur ^ 1;
+	int n = collect_spawns(gpu, spawns);
+
+	gl_state_use_program(gpu->update);
+	gl_state_bind_buffer_base(GL_SHADER_STORAGE_BUFFER, BINDING_SRC,
+				  gpu->bullets[cur]);
+	gl_state_bind_buffer_base(GL_SHADER_STORAGE_BUFFER, BINDING_DST,
+				  gpu->bullets[next]);
+	gl_state_bind_buffer_base(GL_SHADER_STORAGE_BUFFER, BINDING_SPAWN,
+				  gpu->spawn);
+	gl_state_bind_buffer_base(GL_SHADER_STORAGE_BUFFER, BINDING_STATE,
+				  gpu->state);
+	gl_state_bind_buffer_base(GL_SHADER_STORAGE_BUFFER, BINDING_VERTEX,
+				  gpu->vertex);
+
+	glUniform1ui(LOC_CUR, cur);
+	glUniform4f(LOC_VISIBLE, -BULLET_SPRITE_EXTENT, -BULLET_SPRITE_EXTENT,
+		    w + BULLET_SPRITE_EXTENT, h + BULLET_SPRITE_EXTENT);
+	glUniform4f(LOC_BOUNDS, -BULLET_MARGIN, -BULLET_MARGIN,
+		    w + BULLET_MARGIN, h + BULLET_MARGIN);
+	glUniform4f(LOC_HITBOX, x0, y0, x1, y1);
+
+	/* survivors, sized on the GPU by the previous finish pass */
+	glUniform1ui(LOC_SPAWN_COUNT, 0);
+	gl_state_bind_buffer(GL_DISPATCH_INDIRECT_BUFFER, gpu->state);
+	glDispatchComputeIndirect(offsetof(struct gpu_state, dispatch));
+
+	if (n > 0) {
+		/* orphan, the previous frame may still read the old store */
+		gl_state_bind_buffer(GL_SHADER_STORAGE_BUFFER, gpu->spawn);
+		glBufferData(GL_SHADER_STORAGE_BUFFER,
+			     gpu->capacity * sizeof(struct bullet_gpu_bullet),
+			     NULL, GL_STREAM_DRAW);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0,
+				n * sizeof(struct bullet_gpu_bullet),
+				gpu->spawns);
+		glUniform1ui(LOC_SPAWN_COUNT, n);
+		glDispatchCompute((n + GROUP_SIZE - 1) / GROUP_SIZE, 1, 1);
+	}
+
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	gl_state_use_program(gpu->finish);
+	glUniform1ui(LOC_CUR, cur);
+	glDispatchCompute(1, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT |
+			GL_COMMAND_BARRIER_BIT |
+			GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT |
+			GL_BUFFER_UPDATE_BARRIER_BIT);
+
+	read_live(gpu, next);
+	gpu->cur = next;
+}
+
+void
+bullet_gpu_draw(struct bullet_gpu *gpu, GLuint position, GLuint texcoord)
+{
+	const GLsizei stride = 4 * sizeof(GLshort);
+
+	gl_state_bind_vertex_array(gpu->vao);
+	gl_state_bind_buffer(GL_ARRAY_BUFFER, gpu->vertex);
+	glEnableVertexAttribArray(position);
+	glEnableVertexAttribArray(texcoord);
+	gl_state_vertex_attrib_pointer(position, 2, GL_SHORT, GL_FALSE, stride,
+				       (const void *)0);
+	gl_state_vertex_attrib_pointer(texcoord, 2, GL_SHORT, GL_FALSE, stride,
+				       (const void *)(2 * sizeof(GLshort)));
+
+	/* the update flipped cur to the buffer it wrote */
+	gl_state_bind_buffer(GL_DRAW_INDIRECT_BUFFER, gpu->state);
+	glDrawArraysIndirect(GL_TRIANGLES,
+			     (const void *)offsetof(struct gpu_state,
+						    draw[gpu->cur]));
+
+	gl_state_bind_vertex_array(0);
+}
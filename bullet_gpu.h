@@ -0,0 +1,119 @@
+/*
+ * Copyright © 2022 IGEL Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *    Tomohito Esaki <etom@igel.co.jp>
+ */
+
+#ifndef BULLET_GPU_H
+#define BULLET_GPU_H
+
+#include <stdint.h>
+
+#include "bullet_pool.h"
+
+/*
+ * GPU-resident bullets for OpenGL ES 3.1.
+ *
+ * Bullet state lives in two shader storage buffers used in turn. Every
+ * frame a compute pass reads the survivors of the previous frame, plus
+ * the new spawns, advances them with the same motion rules as the CPU
+ * kernels, and appends the ones that stay alive to the other buffer
+ * through an atomic counter. The same pass writes a quad for every
+ * visible bullet and bumps the vertex count of an indirect draw command,
+ * so neither the bullet count nor any geometry goes through the CPU.
+ * The CPU only uploads the spawns of the frame.
+ *
+ * Survivors are compacted in whatever order the invocations run, so the
+ * draw order of overlapping bullets is not stable from frame to frame.
+ * Include <GLES3/gl31.h> before this header.
+ */
+
+/* Must match the motions array of the update shader */
+#define BULLET_GPU_MAX_MOTIONS	8
+
+/* std430 layout of a bullet in the storage buffers */
+struct bullet_gpu_bullet {
+	float x;
+	float y;
+	float vx;
+	float vy;
+	uint32_t count;
+	uint32_t sprite;
+	uint32_t motion;
+	uint32_t pad;
+};
+
+#define BULLET_GPU_READBACK	3
+
+struct bullet_gpu {
+	GLuint update;
+	GLuint finish;
+	GLuint bullets[2];
+	GLuint spawn;
+	GLuint state;
+	GLuint vertex;
+	GLuint vao;
+	GLuint readback[BULLET_GPU_READBACK];
+	int capacity;
+	int cur;
+	unsigned int frame;
+	int n_live;
+	struct bullet_gpu_bullet *spawns;
+};
+
+/* Nonzero if the current context can run the GPU path */
+int bullet_gpu_supported(void);
+
+/* sprites has BULLET_TYPE_COUNT entries; needs a current context */
+int bullet_gpu_init(struct bullet_gpu *gpu, int capacity,
+		    const struct bullet_motion *motions, int n_motions,
+		    const struct bullet_sprite_info *sprites);
+void bullet_gpu_fini(struct bullet_gpu *gpu);
+
+/*
+ * Moves every bullet of spawns to the GPU and clears the pool, then runs
+ * one frame: bullets leaving the w x h screen are retired as on the CPU,
+ * and bullets whose centre lies in [x0, x1] x [y0, y1] are absorbed.
+ * Changes the current program.
+ */
+void bullet_gpu_update(struct bullet_gpu *gpu, struct bullet_pool *spawns,
+		       int w, int h, float x0, float y0, float x1, float y1);
+
+/*
+ * Draws the quads of the last update with the current program; position
+ * and texcoord are its attribute locations, fed with GL_SHORT pairs.
+ */
+void bullet_gpu_draw(struct bullet_gpu *gpu, GLuint position,
+		     GLuint texcoord);
+
+/*
+ * Live bullets as of a few frames ago; read back without waiting for
+ * the GPU.
+ */
+static inline int
+bullet_gpu_live(const struct bullet_gpu *gpu)
+{
+	return gpu->n_live;
+}
+
+#endif
@@ -0,0 +1,315 @@
+/*
+ * Copyright © 2022 IGEL Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *    Tomohito Esaki <etom@igel.co.jp>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bullet_grid.h"
+
+/* Spare refs behind each cell after sizing, besides a quarter more */
+#define GRID_SLACK	32
+
+/* The cell math is most of a build; AVX2 does twice the lanes of SSE2 */
+#if defined(__x86_64__)
+#define GRID_CLONES	__attribute__((target_clones("avx2", "default")))
+#else
+#define GRID_CLONES
+#endif
+
+static inline int
+clamp(int v, int lo, int hi)
+{
+	return v < lo ? lo : v > hi ? hi : v;
+}
+
+static inline int
+cell_x(const struct bullet_grid *grid, float x)
+{
+	return clamp((int)((x + BULLET_MARGIN) / grid->cell_size), 0,
+		     grid->cols - 1);
+}
+
+static inline int
+cell_y(const struct bullet_grid *grid, float y)
+{
+	return clamp((int)((y + BULLET_MARGIN) / grid->cell_size), 0,
+		     grid->rows - 1);
+}
+
+/* Range for n bullets, with room to grow before the cells are resized */
+static inline uint32_t
+cell_room(uint32_t n)
+{
+	return n + n / 4 + GRID_SLACK;
+}
+
+int
+bullet_grid_init(struct bullet_grid *grid, int w, int h, int cell_size,
+		 int capacity)
+{
+	int n_cells;
+
+	memset(grid, 0, sizeof(*grid));
+	grid->cell_size = cell_size;
+	grid->cols = (w + BULLET_MARGIN * 2 + cell_size - 1) / cell_size;
+	grid->rows = (h + BULLET_MARGIN * 2 + cell_size - 1) / cell_size;
+	grid->capacity = capacity;
+	n_cells = grid->cols * grid->rows;
+	if (n_cells > UINT16_MAX)
+		return -1;
+
+	grid->start = calloc(n_cells + 1, sizeof(uint32_t));
+	grid->end = calloc(n_cells * 4, sizeof(uint32_t));
+	/* the ranges, then room for the last one to overflow */
+	grid->refs = malloc((cell_room(capacity) + (n_cells - 1) * GRID_SLACK +
+			     capacity) * sizeof(uint32_t));
+	if (!grid->start || !grid->end || !grid->refs) {
+		bullet_grid_fini(grid);
+		return -1;
+	}
+
+	return 0;
+}
+
+void
+bullet_grid_fini(struct bullet_grid *grid)
+{
+	free(grid->start);
+	free(grid->end);
+	free(grid->refs);
+	memset(grid, 0, sizeof(*grid));
+}
+
+/* Cells of the 64 slots of a word, live or not, so the loop vectorizes */
+static inline void
+word_cells(const struct bullet_grid *grid, const float *x, const float *y,
+	   uint16_t *cells)
+{
+	const float xmax = grid->cols - 1, ymax = grid->rows - 1;
+	const float inv = 1.0f / grid->cell_size;
+	const int cols = grid->cols;
+	int i;
+
+	/* clamped as floats, SSE2 has no 32-bit multiply nor packusdw */
+	for (i = 0; i < 64; i++) {
+		float cx = (x[i] + BULLET_MARGIN) * inv;
+		float cy = (y[i] + BULLET_MARGIN) * inv;
+
+		cx = cx > 0.0f ? cx : 0.0f;
+		cx = cx < xmax ? cx : xmax;
+		cy = cy > 0.0f ? cy : 0.0f;
+		cy = cy < ymax ? cy : ymax;
+		cells[i] = (int)((float)(int)cy * cols + cx);
+	}
+}
+
+/* Sizes the cell ranges for the bullets of pool */
+GRID_CLONES
+static void
+size_cells(struct bullet_grid *grid, const struct bullet_pool *pool)
+{
+	const int n_cells = grid->cols * grid->rows;
+	uint32_t *count = grid->end;
+	uint32_t offset = 0;
+	int k, w, i, c, n = 0;
+
+	/* four histograms, so runs of one cell don't serialize */
+	memset(count, 0, n_cells * 4 * sizeof(uint32_t));
+	for (k = 0; k < pool->n_buckets; k++) {
+		const struct bullet_bucket *b = &pool->buckets[k];
+
+		for (w = 0; w < b->used_words; w++) {
+			uint64_t live = b->live[w];
+			uint16_t cells[64];
+
+			if (!live)
+				continue;
+			/* the same words as fill_cells() leaves out */
+			n += __builtin_popcountll(live);
+			if (n > grid->capacity)
+				goto full;
+
+			word_cells(grid, b->x + (w << 6), b->y + (w << 6),
+				   cells);
+			if (live == ~0ULL) {
+				for (i = 0; i < 64; i += 4) {
+					count[cells[i]]++;
+					count[n_cells + cells[i + 1]]++;
+					count[n_cells * 2 + cells[i + 2]]++;
+					count[n_cells * 3 + cells[i + 3]]++;
+				}
+				continue;
+			}
+			while (live) {
+				count[cells[__builtin_ctzll(live)]]++;
+				live &= live - 1;
+			}
+		}
+	}
+full:
+	for (c = 0; c < n_cells; c++) {
+		grid->start[c] = offset;
+		offset += cell_room(count[c] + count[n_cells + c] +
+				   count[n_cells * 2 + c] +
+				   count[n_cells * 3 + c]);
+	}
+	grid->start[n_cells] = offset;
+}
+
+/*
+ * Fills the cell ranges in one pass, returns -1 if one was too small. An
+ * overflowing cell runs into the next range, or into the spare capacity
+ * behind the last one, and is only detected at the end.
+ */
+GRID_CLONES
+static int
+fill_cells(struct bullet_grid *grid, const struct bullet_pool *pool)
+{
+	const int n_cells = grid->cols * grid->rows;
+	uint32_t *restrict end = grid->end;
+	uint32_t *restrict refs = grid->refs;
+	int k, w, i, c, n = 0;
+
+	memcpy(end, grid->start, n_cells * sizeof(uint32_t));
+	for (k = 0; k < pool->n_buckets; k++) {
+		const struct bullet_bucket *b = &pool->buckets[k];
+
+		for (w = 0; w < b->used_words; w++) {
+			uint32_t base = BULLET_GRID_REF(k, w << 6);
+			uint64_t live = b->live[w];
+			uint16_t cells[64];
+
+			if (!live)
+				continue;
+			n += __builtin_popcountll(live);
+			if (n > grid->capacity)
+				goto full;
+
+			word_cells(grid, b->x + (w << 6), b->y + (w << 6),
+				   cells);
+			if (live == ~0ULL) {
+				for (i = 0; i < 64; i++)
+					refs[end[cells[i]]++] = base + i;
+				continue;
+			}
+			while (live) {
+				i = __builtin_ctzll(live);
+				live &= live - 1;
+				refs[end[cells[i]]++] = base + i;
+			}
+		}
+	}
+full:
+	for (c = 0; c < n_cells; c++) {
+		if (end[c] > grid->start[c + 1])
+			return -1;
+	}
+
+	return 0;
+}
+
+void
+bullet_grid_build(struct bullet_grid *grid, const struct bullet_pool *pool)
+{
+	if (grid->pool != pool || fill_cells(grid, pool) < 0) {
+		size_cells(grid, pool);
+		fill_cells(grid, pool);
+		grid->pool = pool;
+	}
+}
+
+int
+bullet_grid_query(const struct bullet_grid *grid,
+		  float x0, float y0, float x1, float y1,
+		  bullet_grid_func func, void *data)
+{
+	const struct bullet_pool *pool = grid->pool;
+	int cx0, cy0, cx1, cy1, cx, cy;
+	int hits = 0;
+	uint32_t r;
+
+	if (!pool)
+		return 0;
+
+	cx0 = cell_x(grid, x0);
+	cy0 = cell_y(grid, y0);
+	cx1 = cell_x(grid, x1);
+	cy1 = cell_y(grid, y1);
+
+	for (cy = cy0; cy <= cy1; cy++) {
+		const int row = cy * grid->cols;
+
+		for (cx = cx0; cx <= cx1; cx++) {
+			for (r = grid->start[row + cx];
+			     r < grid->end[row + cx]; r++) {
+				const struct bullet_bucket *b;
+				uint32_t ref = grid->refs[r];
+				int k = BULLET_GRID_BUCKET(ref);
+				int i = BULLET_GRID_SLOT(ref);
+
+				b = &pool->buckets[k];
+
+				if (b->x[i] < x0 || b->x[i] > x1 ||
+				    b->y[i] < y0 || b->y[i] > y1)
+					continue;
+				if (!func || func(data, b, k, i))
+					hits++;
+			}
+		}
+	}
+
+	return hits;
+}
+
+struct circle_query {
+	float x, y, r2;
+	bullet_grid_func func;
+	void *data;
+};
+
+static int
+circle_hit(void *data, const struct bullet_bucket *b, int bucket, int slot)
+{
+	const struct circle_query *q = data;
+	float dx = b->x[slot] - q->x;
+	float dy = b->y[slot] - q->y;
+
+	if (dx * dx + dy * dy > q->r2)
+		return 0;
+
+	return !q->func || q->func(q->data, b, bucket, slot);
+}
+
+int
+bullet_grid_query_circle(const struct bullet_grid *grid,
+			 float x, float y, float r,
+			 bullet_grid_func func, void *data)
+{
+	struct circle_query q = { x, y, r * r, func, data };
+
+	return bullet_grid_query(grid, x - r, y - r, x + r, y + r,
+				 circle_hit, &q);
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright © 2022 IGEL Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *    Tomohito Esaki <etom@igel.co.jp>
+ */
+
+#ifndef BULLET_GRID_H
+#define BULLET_GRID_H
+
+#include <stdint.h>
+
+#include "bullet_pool.h"
+
+/*
+ * Uniform grid over the screen plus BULLET_MARGIN, refilled every frame
+ * from the live bullets of a pool. Bullets beyond the margin land in the
+ * border cells. Queries visit only the cells overlapping their bounding
+ * box.
+ *
+ * Each cell owns a range of refs sized by a counting sort, with room to
+ * grow. Bullets move little between frames, so a build keeps the ranges
+ * and fills them in a single pass over the pool; only when a cell has
+ * outgrown its range does it count the bullets again and resize them.
+ */
+struct bullet_grid {
+	const struct bullet_pool *pool;
+	int cell_size;
+	int cols;
+	int rows;
+	int capacity;
+	uint32_t *start;	/* cols * rows + 1 offsets of the cell ranges */
+	uint32_t *end;		/* end of each cell's refs, then histograms */
+	uint32_t *refs;		/* bucket << 24 | slot, grouped by cell */
+};
+
+#define BULLET_GRID_REF(bucket, slot)	((uint32_t)(bucket) << 24 | (slot))
+#define BULLET_GRID_BUCKET(ref)		((ref) >> 24)
+#define BULLET_GRID_SLOT(ref)		((ref) & 0xffffff)
+
+/* capacity is the most live bullets the grid can hold */
+int bullet_grid_init(struct bullet_grid *grid, int w, int h, int cell_size,
+		     int capacity);
+void bullet_grid_fini(struct bullet_grid *grid);
+
+void bullet_grid_build(struct bullet_grid *grid,
+		       const struct bullet_pool *pool);
+
+/*
+ * Narrowphase test for a bullet whose centre is inside the query box.
+ * Returns nonzero if it counts as a hit.
+ */
+typedef int (*bullet_grid_func)(void *data, const struct bullet_bucket *b,
+				int bucket, int slot);
+
+/*
+ * Visits every bullet whose centre lies in [x0, x1] x [y0, y1] and
+ * returns the number of hits. A NULL func counts every such bullet, so
+ * arbitrary shapes are queried by their bounding box plus a func.
+ */
+int bullet_grid_query(const struct bullet_grid *grid,
+		      float x0, float y0, float x1, float y1,
+		      bullet_grid_func func, void *data);
+
+/* Bullets whose centre is within r of (x, y) */
+int bullet_grid_query_circle(const struct bullet_grid *grid,
+			     float x, float y, float r,
+			     bullet_grid_func func, void *data);
+
+#endif
@@ -0,0 +1,228 @@
+/*
+ * Copyright © 2022 IGEL Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *    Tomohito Esaki <etom@igel.co.jp>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <GLES3/gl3.h>
+
+#include "gl_state.h"
+#include "shader.h"
+#include "bullet_instanced.h"
+
+#define SPRITE_BINDING	0
+
+enum {
+	LOC_CORNER = 0,
+	LOC_CENTER,
+	LOC_SPRITE,
+};
+
+/* std140 layout of the Sprites block */
+struct sprite_block {
+	GLint quad[BULLET_TYPE_COUNT][4];	/* half_w, half_h, w, h */
+	GLint origin[BULLET_TYPE_COUNT][4];	/* u, v */
+};
+
+#define TO_STRING(x)	#x
+static const char *vert_shader_text = "#version 300 es\n" TO_STRING(
+	layout (location=0) in vec2 corner;
+	layout (location=1) in ivec2 center;
+	layout (location=2) in uvec2 sprite;
+	layout (std140) uniform Sprites {
+		ivec4 quad[3];
+		ivec4 origin[3];
+	};
+	uniform vec2 screenSize;
+	uniform vec2 texSize;
+	out vec2 texcoordVarying;
+	void main()
+	{
+		ivec4 q = quad[sprite.x];
+		ivec2 c = ivec2(corner);
+		vec2 pos = vec2(center + (c * 2 - 1) * q.xy);
+		ivec2 tex = origin[sprite.x].xy + ivec2(c.x, 1 - c.y) * q.zw;
+
+		tex.x += int(sprite.y) * q.z;
+		gl_Position = vec4(pos * 2.0 / screenSize - 1.0, 0.0, 1.0);
+		texcoordVarying = vec2(tex) / texSize;
+	});
+
+static const char *frag_shader_text = "#version 300 es\n" TO_STRING(
+	precision mediump float;
+	in vec2 texcoordVarying;
+	uniform sampler2D spriteTexture;
+	out vec4 fragColor;
+	void main()
+	{
+		fragColor = texture(spriteTexture, texcoordVarying);
+	});
+
+/* Strip order; y = 1 is the top edge, drawn with the first texel row */
+static const GLubyte unit_quad[] = {
+	0, 0,
+	1, 0,
+	0, 1,
+	1, 1,
+};
+
+int
+bullet_instanced_init(struct bullet_instanced *bi, int capacity,
+		      const struct bullet_sprite_info *sprites)
+{
+	const GLsizei stride = sizeof(struct bullet_instance);
+	struct sprite_block block;
+	struct shader_info shader;
+	int i;
+
+	memset(bi, 0, sizeof(*bi));
+	bi->data = calloc(capacity, sizeof(struct bullet_instance));
+	if (!bi->data)
+		return -1;
+	bi->capacity = capacity;
+
+	memset(&shader, 0x0, sizeof(shader));
+	shader.vertex = vert_shader_text;
+	shader.fragment = frag_shader_text;
+	bi->program = shader_build_program(&shader);
+	if (!bi->program) {
+		bullet_instanced_fini(bi);
+		return -1;
+	}
+	bi->loc.texture = glGetUniformLocation(bi->program, "spriteTexture");
+	bi->loc.screen_size = glGetUniformLocation(bi->program, "screenSize");
+	bi->loc.tex_size = glGetUniformLocation(bi->program, "texSize");
+	glUniformBlockBinding(bi->program,
+			      glGetUniformBlockIndex(bi->program, "Sprites"),
+			      SPRITE_BINDING);
+
+	memset(&block, 0, sizeof(block));
+	for (i = 0; i < BULLET_TYPE_COUNT; i++) {
+		block.quad[i][0] = sprites[i].half_w;
+		block.quad[i][1] = sprites[i].half_h;
+		block.quad[i][2] = sprites[i].w;
+		block.quad[i][3] = sprites[i].h;
+		block.origin[i][0] = sprites[i].u;
+		block.origin[i][1] = sprites[i].v;
+	}
+	glGenBuffers(1, &bi->sprites);
+	gl_state_bind_buffer(GL_UNIFORM_BUFFER, bi->sprites);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(block), &block,
+		     GL_STATIC_DRAW);
+
+	glGenVertexArrays(1, &bi->vao);
+	gl_state_bind_vertex_array(bi->vao);
+
+	glGenBuffers(1, &bi->quad);
+	gl_state_bind_buffer(GL_ARRAY_BUFFER, bi->quad);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(unit_quad), unit_quad,
+		     GL_STATIC_DRAW);
+	glEnableVertexAttribArray(LOC_CORNER);
+	gl_state_vertex_attrib_pointer(LOC_CORNER, 2, GL_UNSIGNED_BYTE,
+				       GL_FALSE, 0, 0);
+
+	/* pointed into the stream by each draw */
+	glEnableVertexAttribArray(LOC_CENTER);
+	glVertexAttribDivisor(LOC_CENTER, 1);
+	glEnableVertexAttribArray(LOC_SPRITE);
+	glVertexAttribDivisor(LOC_SPRITE, 1);
+
+	gl_state_bind_vertex_array(0);
+
+	/* a frame of capacity instances fits behind the ones in flight */
+	if (stream_buffer_init(&bi->stream, (GLsizeiptr)capacity * stride *
+			       (STREAM_BUFFER_FRAMES + 1)) < 0) {
+		bullet_instanced_fini(bi);
+		return -1;
+	}
+
+	return 0;
+}
+
+void
+bullet_instanced_fini(struct bullet_instanced *bi)
+{
+	if (bi->program)
+		gl_state_delete_program(bi->program);
+	if (bi->vao) {
+		gl_state_delete_vertex_arrays(1, &bi->vao);
+		gl_state_delete_buffers(1, &bi->quad);
+		gl_state_delete_buffers(1, &bi->sprites);
+	}
+	if (bi->stream.buffer)
+		stream_buffer_fini(&bi->stream);
+	free(bi->data);
+	memset(bi, 0, sizeof(*bi));
+}
+
+void
+bullet_instanced_draw(struct bullet_instanced *bi, int w, int h,
+		      int tex_w, int tex_h)
+{
+	bullet_instanced_draw_data(bi, bi->data, bi->count, w, h, tex_w,
+				   tex_h);
+	bi->count = 0;
+}
+
+void
+bullet_instanced_draw_data(struct bullet_instanced *bi,
+			   const struct bullet_instance *data, int count,
+			   int w, int h, int tex_w, int tex_h)
+{
+	const GLsizei stride = sizeof(struct bullet_instance);
+	GLintptr offset;
+
+	if (!count)
+		return;
+	assert(count <= bi->capacity);
+
+	offset = stream_buffer_upload(&bi->stream, data, count * stride);
+	assert(offset >= 0);
+
+	gl_state_use_program(bi->program);
+	glUniform1i(bi->loc.texture, 0);
+	glUniform2f(bi->loc.screen_size, w, h);
+	glUniform2f(bi->loc.tex_size, tex_w, tex_h);
+	gl_state_bind_buffer_base(GL_UNIFORM_BUFFER, SPRITE_BINDING,
+				  bi->sprites);
+
+	gl_state_bind_vertex_array(bi->vao);
+	gl_state_bind_buffer(GL_ARRAY_BUFFER, bi->stream.buffer);
+	gl_state_vertex_attrib_ipointer(LOC_CENTER, 2, GL_SHORT, stride,
+					(const void *)offset);
+	gl_state_vertex_attrib_ipointer(LOC_SPRITE, 2, GL_UNSIGNED_BYTE,
+					stride, (const void *)
+					(offset + 2 * sizeof(int16_t)));
+	glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, count);
+	gl_state_bind_vertex_array(0);
+}
+
+void
+bullet_instanced_end_frame(struct bullet_instanced *bi)
+{
+	stream_buffer_end_frame(&bi->stream);
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright © 2022 IGEL Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *    Tomohito Esaki <etom@igel.co.jp>
+ */
+
+#ifndef BULLET_INSTANCED_H
+#define BULLET_INSTANCED_H
+
+#include <stdint.h>
+
+#include "bullet_pool.h"
+#include "stream_buffer.h"
+
+/*
+ * Instanced bullet sprites for OpenGL ES 3.0.
+ *
+ * Every visible bullet becomes one 8-byte instance instead of six
+ * vertices of five shorts. The vertex shader expands a static unit quad
+ * around the instance and looks up the sprite rectangles in a uniform
+ * block filled once at init. Instances are streamed through their own
+ * stream_buffer; several draws may share a frame, which the caller closes
+ * with bullet_instanced_end_frame(). Include <GLES3/gl3.h> or later
+ * before this header.
+ */
+
+struct bullet_instance {
+	int16_t x;
+	int16_t y;
+	uint8_t type;
+	uint8_t color;
+	uint8_t pad[2];
+};
+
+struct bullet_instanced {
+	GLuint program;
+	GLuint quad;
+	GLuint sprites;
+	GLuint vao;
+	struct {
+		GLuint texture;
+		GLuint screen_size;
+		GLuint tex_size;
+	} loc;
+	int capacity;
+	int count;
+	struct bullet_instance *data;
+	struct stream_buffer stream;
+};
+
+/* sprites has BULLET_TYPE_COUNT entries; needs a current context */
+int bullet_instanced_init(struct bullet_instanced *bi, int capacity,
+			  const struct bullet_sprite_info *sprites);
+void bullet_instanced_fini(struct bullet_instanced *bi);
+
+/* Instance of slot i of b */
+static inline void
+bullet_instance_set(struct bullet_instance *p, const struct bullet_bucket *b,
+		    int i)
+{
+	p->x = b->x[i];
+	p->y = b->y[i];
+	p->type = BULLET_SPRITE_TYPE(b->sprite[i]);
+	p->color = BULLET_SPRITE_COLOR(b->sprite[i]);
+}
+
+/* Queues slot i of b for the next bullet_instanced_draw() */
+static inline void
+bullet_instanced_add(struct bullet_instanced *bi,
+		     const struct bullet_bucket *b, int i)
+{
+	if (bi->count == bi->capacity)
+		return;
+
+	bullet_instance_set(&bi->data[bi->count++], b, i);
+}
+
+/*
+ * Uploads and draws the queued instances, texture unit 0 holding the
+ * sprite texture, and empties the queue. Changes the current program.
+ */
+void bullet_instanced_draw(struct bullet_instanced *bi, int w, int h,
+			   int tex_w, int tex_h);
+
+/* The same for count instances built elsewhere, at most the capacity */
+void bullet_instanced_draw_data(struct bullet_instanced *bi,
+				const struct bullet_instance *data, int count,
+				int w, int h, int tex_w, int tex_h);
+
+/* Fences the frame's instances; call once per frame after its last draw */
+void bullet_instanced_end_frame(struct bullet_instanced *bi);
+
+#endif
@@ -0,0 +1,391 @@
+/*
+ * Copyright © 2022 IGEL Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *    Tomohito Esaki <etom@igel.co.jp>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#define HAVE_NEON_KERNEL
+#endif
+
+#include "bullet_kernel.h"
+
+#define ARRAY_LENGTH(a) (sizeof (a) / sizeof (a)[0])
+#define ALIGN_UP(x, a)	(((x) + (a) - 1) / (a) * (a))
+
+static uint64_t
+step_scalar(const struct bullet_step *s, float *x, float *y,
+	    const float *vx, float *vy, uint16_t *count)
+{
+	uint64_t retire = 0;
+	int i;
+
+	for (i = 0; i < 64; i++) {
+		uint16_t c = count[i];
+		int out;
+
+		vy[i] -= c < s->gravity_until ? s->gravity : 0.0f;
+		x[i] += vx[i];
+		y[i] += vy[i];
+		c += c != UINT16_MAX;
+		count[i] = c;
+
+		out = (x[i] < s->xmin) | (x[i] > s->xmax) |
+		      (y[i] < s->ymin) | (y[i] > s->ymax);
+		retire |= (uint64_t)(out & (s->till < c)) << i;
+	}
+
+	return retire;
+}
+
+#ifdef HAVE_X86_KERNELS
+/*
+ * SSE2 has no unsigned 16 bit compare: flipping the sign bit of both
+ * operands turns it into a signed one.
+ */
+__attribute__((target("sse2")))
+static uint64_t
+step_sse2(const struct bullet_step *s, float *x, float *y,
+	  const float *vx, float *vy, uint16_t *count)
+{
+	const __m128i bias = _mm_set1_epi16((short)0x8000);
+	const __m128i until = _mm_xor_si128(_mm_set1_epi16(s->gravity_until),
+					    bias);
+	const __m128i till = _mm_xor_si128(_mm_set1_epi16(s->till), bias);
+	const __m128i one = _mm_set1_epi16(1);
+	const __m128 gravity = _mm_set1_ps(s->gravity);
+	const __m128 xmin = _mm_set1_ps(s->xmin), xmax = _mm_set1_ps(s->xmax);
+	const __m128 ymin = _mm_set1_ps(s->ymin), ymax = _mm_set1_ps(s->ymax);
+	uint64_t retire = 0;
+	int i, j;
+
+	for (i = 0; i < 64; i += 8) {
+		__m128i c, grav, keep, gmask[2], tmask[2];
+
+		c = _mm_load_si128((const __m128i *)(count + i));
+		grav = _mm_cmplt_epi16(_mm_xor_si128(c, bias), until);
+		c = _mm_adds_epu16(c, one);
+		_mm_store_si128((__m128i *)(count + i), c);
+		keep = _mm_cmpgt_epi16(_mm_xor_si128(c, bias), till);
+
+		gmask[0] = _mm_unpacklo_epi16(grav, grav);
+		gmask[1] = _mm_unpackhi_epi16(grav, grav);
+		tmask[0] = _mm_unpacklo_epi16(keep, keep);
+		tmask[1] = _mm_unpackhi_epi16(keep, keep);
+
+		for (j = 0; j < 2; j++) {
+			int k = i + j * 4;
+			__m128 px = _mm_load_ps(x + k);
+			__m128 py = _mm_load_ps(y + k);
+			__m128 pvx = _mm_load_ps(vx + k);
+			__m128 pvy = _mm_load_ps(vy + k);
+			__m128 out;
+
+			pvy = _mm_sub_ps(pvy, _mm_and_ps(
+					_mm_castsi128_ps(gmask[j]), gravity));
+			px = _mm_add_ps(px, pvx);
+			py = _mm_add_ps(py, pvy);
+			_mm_store_ps(x + k, px);
+			_mm_store_ps(y + k, py);
+			_mm_store_ps(vy + k, pvy);
+
+			out = _mm_or_ps(_mm_or_ps(_mm_cmplt_ps(px, xmin),
+						  _mm_cmpgt_ps(px, xmax)),
+					_mm_or_ps(_mm_cmplt_ps(py, ymin),
+						  _mm_cmpgt_ps(py, ymax)));
+			out = _mm_and_ps(out, _mm_castsi128_ps(tmask[j]));
+			retire |= (uint64_t)_mm_movemask_ps(out) << k;
+		}
+	}
+
+	return retire;
+}
+
+__attribute__((target("avx2")))
+static uint64_t
+step_avx2(const struct bullet_step *s, float *x, float *y,
+	  const float *vx, float *vy, uint16_t *count)
+{
+	const __m128i bias = _mm_set1_epi16((short)0x8000);
+	const __m128i until = _mm_xor_si128(_mm_set1_epi16(s->gravity_until),
+					    bias);
+	const __m128i till = _mm_xor_si128(_mm_set1_epi16(s->till), bias);
+	const __m128i one = _mm_set1_epi16(1);
+	const __m256 gravity = _mm256_set1_ps(s->gravity);
+	const __m256 xmin = _mm256_set1_ps(s->xmin);
+	const __m256 xmax = _mm256_set1_ps(s->xmax);
+	const __m256 ymin = _mm256_set1_ps(s->ymin);
+	const __m256 ymax = _mm256_set1_ps(s->ymax);
+	uint64_t retire = 0;
+	int i;
+
+	for (i = 0; i < 64; i += 8) {
+		__m128i c, grav, keep;
+		__m256 px, py, pvx, pvy, gmask, tmask, out;
+
+		c = _mm_load_si128((const __m128i *)(count + i));
+		grav = _mm_cmplt_epi16(_mm_xor_si128(c, bias), until);
+		c = _mm_adds_epu16(c, one);
+		_mm_store_si128((__m128i *)(count + i), c);
+		keep = _mm_cmpgt_epi16(_mm_xor_si128(c, bias), till);
+
+		/* sign extension widens the 16 bit masks to 32 bit lanes */
+		gmask = _mm256_castsi256_ps(_mm256_cvtepi16_epi32(grav));
+		tmask = _mm256_castsi256_ps(_mm256_cvtepi16_epi32(keep));
+
+		px = _mm256_load_ps(x + i);
+		py = _mm256_load_ps(y + i);
+		pvx = _mm256_load_ps(vx + i);
+		pvy = _mm256_load_ps(vy + i);
+
+		pvy = _mm256_sub_ps(pvy, _mm256_and_ps(gmask, gravity));
+		px = _mm256_add_ps(px, pvx);
+		py = _mm256_add_ps(py, pvy);
+		_mm256_store_ps(x + i, px);
+		_mm256_store_ps(y + i, py);
+		_mm256_store_ps(vy + i, pvy);
+
+		out = _mm256_or_ps(
+			_mm256_or_ps(_mm256_cmp_ps(px, xmin, _CMP_LT_OQ),
+				     _mm256_cmp_ps(px, xmax, _CMP_GT_OQ)),
+			_mm256_or_ps(_mm256_cmp_ps(py, ymin, _CMP_LT_OQ),
+				     _mm256_cmp_ps(py, ymax, _CMP_GT_OQ)));
+		out = _mm256_and_ps(out, tmask);
+		retire |= (uint64_t)_mm256_movemask_ps(out) << i;
+	}
+
+	return retire;
+}
+
+static int
+supports_sse2(void)
+{
+	return __builtin_cpu_supports("sse2");
+}
+
+static int
+supports_avx2(void)
+{
+	return __builtin_cpu_supports("avx2");
+}
+#endif
+
+#ifdef HAVE_NEON_KERNEL
+static uint64_t
+step_neon(const struct bullet_step *s, float *x, float *y,
+	  const float *vx, float *vy, uint16_t *count)
+{
+	static const uint32_t bit[4] = { 1, 2, 4, 8 };
+	const uint32x4_t weight = vld1q_u32(bit);
+	const uint16x8_t until = vdupq_n_u16(s->gravity_until);
+	const uint16x8_t till = vdupq_n_u16(s->till);
+	const uint16x8_t one = vdupq_n_u16(1);
+	const uint32x4_t gravity =
+		vreinterpretq_u32_f32(vdupq_n_f32(s->gravity));
+	const float32x4_t xmin = vdupq_n_f32(s->xmin);
+	const float32x4_t xmax = vdupq_n_f32(s->xmax);
+	const float32x4_t ymin = vdupq_n_f32(s->ymin);
+	const float32x4_t ymax = vdupq_n_f32(s->ymax);
+	uint64_t retire = 0;
+	int i, j;
+
+	for (i = 0; i < 64; i += 8) {
+		uint16x8_t c, grav, keep;
+		uint32x4_t gmask[2], tmask[2];
+
+		c = vld1q_u16(count + i);
+		grav = vcltq_u16(c, until);
+		c = vqaddq_u16(c, one);
+		vst1q_u16(count + i, c);
+		keep = vcgtq_u16(c, till);
+
+		/* sign extension widens the 16 bit masks to 32 bit lanes */
+		gmask[0] = vreinterpretq_u32_s32(vmovl_s16(
+				vreinterpret_s16_u16(vget_low_u16(grav))));
+		gmask[1] = vreinterpretq_u32_s32(vmovl_s16(
+				vreinterpret_s16_u16(vget_high_u16(grav))));
+		tmask[0] = vreinterpretq_u32_s32(vmovl_s16(
+				vreinterpret_s16_u16(vget_low_u16(keep))));
+		tmask[1] = vreinterpretq_u32_s32(vmovl_s16(
+				vreinterpret_s16_u16(vget_high_u16(keep))));
+
+		for (j = 0; j < 2; j++) {
+			int k = i + j * 4;
+			float32x4_t px = vld1q_f32(x + k);
+			float32x4_t py = vld1q_f32(y + k);
+			float32x4_t pvx = vld1q_f32(vx + k);
+			float32x4_t pvy = vld1q_f32(vy + k);
+			uint32x4_t out;
+
+			pvy = vsubq_f32(pvy, vreinterpretq_f32_u32(
+					vandq_u32(gmask[j], gravity)));
+			px = vaddq_f32(px, pvx);
+			py = vaddq_f32(py, pvy);
+			vst1q_f32(x + k, px);
+			vst1q_f32(y + k, py);
+			vst1q_f32(vy + k, pvy);
+
+			out = vorrq_u32(vorrq_u32(vcltq_f32(px, xmin),
+						  vcgtq_f32(px, xmax)),
+					vorrq_u32(vcltq_f32(py, ymin),
+						  vcgtq_f32(py, ymax)));
+			out = vandq_u32(out, tmask[j]);
+			retire |= (uint64_t)vaddvq_u32(vandq_u32(out, weight))
+				<< k;
+		}
+	}
+
+	return retire;
+}
+
+static int
+supports_neon(void)
+{
+	return !!(getauxval(AT_HWCAP) & HWCAP_ASIMD);
+}
+#endif
+
+static const struct {
+	struct bullet_kernel kernel;
+	int (*supported)(void);
+} kernels[] = {
+	/* slowest first */
+	{ { "scalar", step_scalar }, NULL },
+#ifdef HAVE_X86_KERNELS
+	{ { "sse2", step_sse2 }, supports_sse2 },
+	{ { "avx2", step_avx2 }, supports_avx2 },
+#endif
+#ifdef HAVE_NEON_KERNEL
+	{ { "neon", step_neon }, supports_neon },
+#endif
+};
+
+int
+bullet_kernel_list(const struct bullet_kernel **list, int max)
+{
+	int i, n = 0;
+
+	for (i = 0; i < (int) ARRAY_LENGTH(kernels) && n < max; i++) {
+		if (!kernels[i].supported || kernels[i].supported())
+			list[n++] = &kernels[i].kernel;
+	}
+
+	return n;
+}
+
+const struct bullet_kernel *
+bullet_kernel_select(void)
+{
+	static const struct bullet_kernel *selected;
+	const struct bullet_kernel *list[ARRAY_LENGTH(kernels)];
+
+	int n;
+
+	if (!selected) {
+		n = bullet_kernel_list(list, ARRAY_LENGTH(list));
+		selected = list[n - 1];
+	}
+
+	return selected;
+}
+
+#define CHECK_WORDS	64
+#define CHECK_STEPS	300
+
+struct check_lanes {
+	float x[CHECK_WORDS * 64];
+	float y[CHECK_WORDS * 64];
+	float vx[CHECK_WORDS * 64];
+	float vy[CHECK_WORDS * 64];
+	uint16_t count[CHECK_WORDS * 64];
+	uint64_t retire[CHECK_WORDS];
+};
+
+int
+bullet_kernel_check(const struct bullet_kernel *kernel)
+{
+	/* counts around the thresholds, including saturation */
+	static const uint16_t counts[] = {
+		0, 1, 148, 149, 150, 151, 159, 160, 161, UINT16_MAX - 2,
+		UINT16_MAX - 1, UINT16_MAX,
+	};
+	const struct bullet_step step = {
+		.gravity = 0.04f,
+		.gravity_until = 150,
+		.till = 150,
+		.xmin = -40.0f,
+		.xmax = 680.0f,
+		.ymin = -40.0f,
+		.ymax = 520.0f,
+	};
+	struct check_lanes *ref, *test;
+	unsigned int seed = 1;
+	int i, n, ret = 0;
+
+	ref = aligned_alloc(64, ALIGN_UP(sizeof(*ref), 64));
+	test = aligned_alloc(64, ALIGN_UP(sizeof(*test), 64));
+	if (!ref || !test) {
+		free(ref);
+		free(test);
+		return -1;
+	}
+
+	for (i = 0; i < CHECK_WORDS * 64; i++) {
+		ref->x[i] = (rand_r(&seed) % 8000) / 10.0f - 60.0f;
+		ref->y[i] = (rand_r(&seed) % 6000) / 10.0f - 60.0f;
+		ref->vx[i] = (rand_r(&seed) % 600) / 100.0f - 3.0f;
+		ref->vy[i] = (rand_r(&seed) % 600) / 100.0f - 3.0f;
+		ref->count[i] = counts[rand_r(&seed) % ARRAY_LENGTH(counts)];
+	}
+	memcpy(test, ref, sizeof(*ref));
+
+	for (n = 0; n < CHECK_STEPS && !ret; n++) {
+		for (i = 0; i < CHECK_WORDS; i++) {
+			int k = i * 64;
+
+			ref->retire[i] = step_scalar(&step, ref->x + k,
+						     ref->y + k, ref->vx + k,
+						     ref->vy + k,
+						     ref->count + k);
+			test->retire[i] = kernel->step(&step, test->x + k,
+						       test->y + k,
+						       test->vx + k,
+						       test->vy + k,
+						       test->count + k);
+		}
+		ret = memcmp(ref, test, sizeof(*ref)) ? -1 : 0;
+	}
+
+	free(ref);
+	free(test);
+
+	return ret;
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright © 2022 IGEL Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *    Tomohito Esaki <etom@igel.co.jp>
+ */
+
+#ifndef BULLET_KERNEL_H
+#define BULLET_KERNEL_H
+
+#include <stdint.h>
+
+/* Per-bucket constants of one simulation step */
+struct bullet_step {
+	float gravity;
+	uint16_t gravity_until;
+	uint16_t till;
+	float xmin, xmax;
+	float ymin, ymax;
+};
+
+/*
+ * Advances the 64 slots of one occupancy word: applies gravity while
+ * count < gravity_until, moves by (vx, vy) and increments count. Returns
+ * a bit for every slot that is outside the bounds with count > till.
+ * All arrays are 64 byte aligned.
+ */
+typedef uint64_t (*bullet_kernel_func)(const struct bullet_step *step,
+				       float *x, float *y,
+				       const float *vx, float *vy,
+				       uint16_t *count);
+
+struct bullet_kernel {
+	const char *name;
+	bullet_kernel_func step;
+};
+
+/* The fastest kernel the running CPU supports */
+const struct bullet_kernel *bullet_kernel_select(void);
+
+/*
+ * Fills list with the kernels the running CPU supports, the scalar
+ * reference first. Returns the number of entries.
+ */
+int bullet_kernel_list(const struct bullet_kernel **list, int max);
+
+/* Compares a kernel against the scalar reference, returns 0 if equal */
+int bullet_kernel_check(const struct bullet_kernel *kernel);
+
+#endif
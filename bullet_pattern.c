@@ -0,0 +1,642 @@
+/*
+ * Copyright © 2022 IGEL Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *    Tomohito Esaki <etom@igel.co.jp>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bullet_pattern.h"
+#include "fast_math.h"
+
+#define NAME_MAX_LEN	32
+#define MAX_MOTIONS	16
+#define MAX_TOKENS	64
+#define EMIT_BATCH	256
+#define DEG		(FAST_PI / 180.0f)
+
+enum op_code {
+	OP_SWEEP = 0,
+	OP_SPREAD,
+	OP_RING,
+	OP_BURST,
+};
+
+struct bullet_op {
+	uint8_t code;
+	uint8_t motion;
+	uint8_t sprite;
+	uint8_t aim_sweep;
+	int every;
+	int start;
+	int count;
+	int period_min;
+	int period_max;
+	float angle;		/* sweep: center */
+	float step;		/* sweep: amp */
+	float from;
+	float to;
+	float sx;
+	float sy;
+};
+
+struct bullet_program {
+	char name[NAME_MAX_LEN];
+	struct bullet_op *ops;
+	int n_ops;
+};
+
+struct bullet_pattern {
+	struct bullet_motion motions[MAX_MOTIONS];
+	char motion_names[MAX_MOTIONS][NAME_MAX_LEN];
+	int n_motions;
+	struct bullet_program *programs;
+	int n_programs;
+};
+
+struct parser {
+	const char *name;
+	int line;
+	char *tokens[MAX_TOKENS];
+	int n_tokens;
+	int pos;
+	struct bullet_pattern *pattern;
+	struct bullet_program *program;
+};
+
+static const char *sprite_names[] = {
+	[BULLET_TYPE_SMALL] = "small",
+	[BULLET_TYPE_LARGE] = "large",
+	[BULLET_TYPE_NEEDLE] = "needle",
+};
+
+static int
+parse_error(struct parser *p, const char *msg, const char *token)
+{
+	fprintf(stderr, "%s:%d: %s%s%s\n", p->name, p->line, msg,
+		token ? ": " : "", token ? token : "");
+	return -1;
+}
+
+static char *
+next_token(struct parser *p)
+{
+	return p->pos < p->n_tokens ? p->tokens[p->pos++] : NULL;
+}
+
+/* Consumes the next token only if it is a number */
+static int
+accept_float(struct parser *p, float *value)
+{
+	char *end;
+	float v;
+
+	if (p->pos == p->n_tokens)
+		return 0;
+	v = strtof(p->tokens[p->pos], &end);
+	if (*end)
+		return 0;
+	*value = v;
+	p->pos++;
+
+	return 1;
+}
+
+static int
+parse_int(struct parser *p, int *value)
+{
+	char *token = next_token(p), *end;
+
+	if (!token)
+		return parse_error(p, "missing number", NULL);
+	*value = strtol(token, &end, 10);
+	if (*end)
+		return parse_error(p, "not an integer", token);
+
+	return 0;
+}
+
+static int
+parse_float(struct parser *p, float *value)
+{
+	char *token = next_token(p), *end;
+
+	if (!token)
+		return parse_error(p, "missing number", NULL);
+	*value = strtof(token, &end);
+	if (*end)
+		return parse_error(p, "not a number", token);
+
+	return 0;
+}
+
+static int
+parse_motion(struct parser *p)
+{
+	struct bullet_pattern *pattern = p->pattern;
+	struct bullet_motion *m;
+	char *name = next_token(p), *key;
+	int value;
+
+	if (!name || strlen(name) >= NAME_MAX_LEN)
+		return parse_error(p, "bad motion name", name);
+	if (pattern->n_motions == MAX_MOTIONS)
+		return parse_error(p, "too many motions", name);
+
+	m = &pattern->motions[pattern->n_motions];
+	memset(m, 0, sizeof(*m));
+	while ((key = next_token(p))) {
+		if (!strcmp(key, "gravity")) {
+			if (parse_float(p, &m->gravity) < 0)
+				return -1;
+			continue;
+		}
+		if (parse_int(p, &value) < 0)
+			return -1;
+		if (value < 0 || value > UINT16_MAX)
+			return parse_error(p, "frame count out of range",
+					   key);
+		if (!strcmp(key, "until"))
+			m->gravity_until = value;
+		else if (!strcmp(key, "till"))
+			m->till = value;
+		else
+			return parse_error(p, "unknown motion key", key);
+	}
+
+	strcpy(pattern->motion_names[pattern->n_motions++], name);
+
+	return 0;
+}
+
+static int
+parse_sweep(struct parser *p, struct bullet_op *op)
+{
+	char *key;
+
+	while ((key = next_token(p))) {
+		int ret;
+
+		if (!strcmp(key, "every"))
+			ret = parse_int(p, &op->every);
+		else if (!strcmp(key, "start"))
+			ret = parse_int(p, &op->start);
+		else if (!strcmp(key, "period"))
+			ret = parse_int(p, &op->period_min) < 0 ? -1 :
+			      parse_int(p, &op->period_max);
+		else if (!strcmp(key, "center"))
+			ret = parse_float(p, &op->angle);
+		else if (!strcmp(key, "amp"))
+			ret = parse_float(p, &op->step);
+		else
+			return parse_error(p, "unknown sweep key", key);
+		if (ret < 0)
+			return -1;
+	}
+
+	if (op->period_min < 1 || op->period_max < op->period_min)
+		return parse_error(p, "bad sweep period", NULL);
+
+	return 0;
+}
+
+static int
+lookup_motion(struct parser *p, struct bullet_op *op)
+{
+	char *name = next_token(p);
+	int i;
+
+	for (i = 0; name && i < p->pattern->n_motions; i++) {
+		if (!strcmp(p->pattern->motion_names[i], name)) {
+			op->motion = i;
+			return 0;
+		}
+	}
+
+	return parse_error(p, "unknown motion", name);
+}
+
+static int
+lookup_sprite(struct parser *p, struct bullet_op *op)
+{
+	char *name = next_token(p);
+	int i, color;
+
+	for (i = 0; name && i < (int)(sizeof(sprite_names) /
+				      sizeof(sprite_names[0])); i++) {
+		if (!strcmp(sprite_names[i], name))
+			break;
+	}
+	if (!name || i == sizeof(sprite_names) / sizeof(sprite_names[0]))
+		return parse_error(p, "unknown sprite", name);
+	if (parse_int(p, &color) < 0)
+		return -1;
+	if (color < 0 || color > 15)
+		return parse_error(p, "sprite color out of range", NULL);
+	op->sprite = BULLET_SPRITE(i, color);
+
+	return 0;
+}
+
+static int
+parse_shot(struct parser *p, struct bullet_op *op)
+{
+	int has_motion = 0;
+	char *key;
+
+	op->count = 1;
+	op->sx = op->sy = 1.0f;
+	op->to = 360.0f;
+
+	while ((key = next_token(p))) {
+		int ret = 0;
+
+		if (!strcmp(key, "every")) {
+			ret = parse_int(p, &op->every);
+		} else if (!strcmp(key, "start")) {
+			ret = parse_int(p, &op->start);
+		} else if (!strcmp(key, "motion")) {
+			ret = lookup_motion(p, op);
+			has_motion = 1;
+		} else if (!strcmp(key, "sprite")) {
+			ret = lookup_sprite(p, op);
+		} else if (!strcmp(key, "count")) {
+			ret = parse_int(p, &op->count);
+		} else if (!strcmp(key, "speed")) {
+			ret = parse_float(p, &op->sx);
+			op->sy = op->sx;
+			accept_float(p, &op->sy);
+		} else if (!strcmp(key, "angle")) {
+			if (p->pos < p->n_tokens &&
+			    !strcmp(p->tokens[p->pos], "sweep")) {
+				op->aim_sweep = 1;
+				p->pos++;
+			} else {
+				ret = parse_float(p, &op->angle);
+			}
+		} else if (!strcmp(key, "step")) {
+			ret = parse_float(p, &op->step);
+		} else if (!strcmp(key, "from")) {
+			ret = parse_float(p, &op->from);
+		} else if (!strcmp(key, "to")) {
+			ret = parse_float(p, &op->to);
+		} else {
+			return parse_error(p, "unknown shot key", key);
+		}
+		if (ret < 0)
+			return -1;
+	}
+
+	if (!has_motion)
+		return parse_error(p, "shot without motion", NULL);
+	if (op->count < 1)
+		return parse_error(p, "bad count", NULL);
+
+	return 0;
+}
+
+static int
+parse_op(struct parser *p, const char *word)
+{
+	struct bullet_program *prog = p->program;
+	struct bullet_op *op, *ops;
+
+	ops = realloc(prog->ops, (prog->n_ops + 1) * sizeof(*ops));
+	if (!ops)
+		return parse_error(p, "out of memory", NULL);
+	prog->ops = ops;
+	op = &ops[prog->n_ops];
+	memset(op, 0, sizeof(*op));
+	op->every = 1;
+
+	if (!strcmp(word, "sweep")) {
+		op->code = OP_SWEEP;
+		if (parse_sweep(p, op) < 0)
+			return -1;
+	} else {
+		if (!strcmp(word, "spread"))
+			op->code = OP_SPREAD;
+		else if (!strcmp(word, "ring"))
+			op->code = OP_RING;
+		else if (!strcmp(word, "burst"))
+			op->code = OP_BURST;
+		else
+			return parse_error(p, "unknown op", word);
+		if (parse_shot(p, op) < 0)
+			return -1;
+	}
+
+	if (op->every < 1 || op->start < 0)
+		return parse_error(p, "bad timing", word);
+	prog->n_ops++;
+
+	return 0;
+}
+
+static int
+parse_emitter(struct parser *p)
+{
+	struct bullet_pattern *pattern = p->pattern;
+	struct bullet_program *programs;
+	char *name = next_token(p);
+
+	if (!name || strlen(name) >= NAME_MAX_LEN)
+		return parse_error(p, "bad emitter name", name);
+	if (bullet_pattern_find(pattern, name))
+		return parse_error(p, "duplicate emitter", name);
+
+	programs = realloc(pattern->programs,
+			   (pattern->n_programs + 1) * sizeof(*programs));
+	if (!programs)
+		return parse_error(p, "out of memory", NULL);
+	pattern->programs = programs;
+	p->program = &programs[pattern->n_programs++];
+	memset(p->program, 0, sizeof(*p->program));
+	strcpy(p->program->name, name);
+
+	return 0;
+}
+
+static int
+parse_line(struct parser *p, char *line)
+{
+	char *word, *comment, *save;
+
+	comment = strchr(line, '#');
+	if (comment)
+		*comment = '\0';
+
+	p->n_tokens = p->pos = 0;
+	for (word = strtok_r(line, " \t\r", &save); word;
+	     word = strtok_r(NULL, " \t\r", &save)) {
+		if (p->n_tokens == MAX_TOKENS)
+			return parse_error(p, "line too long", NULL);
+		p->tokens[p->n_tokens++] = word;
+	}
+
+	word = next_token(p);
+	if (!word)
+		return 0;
+
+	if (p->program) {
+		if (!strcmp(word, "end")) {
+			p->program = NULL;
+			return 0;
+		}
+		return parse_op(p, word);
+	}
+
+	if (!strcmp(word, "motion"))
+		return parse_motion(p);
+	if (!strcmp(word, "emitter"))
+		return parse_emitter(p);
+
+	return parse_error(p, "unknown statement", word);
+}
+
+struct bullet_pattern *
+bullet_pattern_parse(const char *text, const char *name)
+{
+	struct parser p = { .name = name };
+	char *buf, *line, *next;
+	int ret = 0;
+
+	p.pattern = calloc(1, sizeof(struct bullet_pattern));
+	buf = strdup(text);
+	if (!p.pattern || !buf) {
+		free(p.pattern);
+		free(buf);
+		return NULL;
+	}
+
+	for (line = buf; line && ret == 0; line = next) {
+		next = strchr(line, '\n');
+		if (next)
+			*next++ = '\0';
+		p.line++;
+		ret = parse_line(&p, line);
+	}
+	if (ret == 0 && p.program)
+		ret = parse_error(&p, "missing end of emitter",
+				  p.program->name);
+	free(buf);
+
+	if (ret < 0) {
+		bullet_pattern_destroy(p.pattern);
+		return NULL;
+	}
+
+	return p.pattern;
+}
+
+struct bullet_pattern *
+bullet_pattern_load(const char *path)
+{
+	struct bullet_pattern *pattern = NULL;
+	FILE *fp;
+	char *text;
+	long size;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		fprintf(stderr, "failed to open %s\n", path);
+		return NULL;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	text = malloc(size + 1);
+	if (text && fread(text, 1, size, fp) == (size_t)size) {
+		text[size] = '\0';
+		pattern = bullet_pattern_parse(text, path);
+	}
+
+	free(text);
+	fclose(fp);
+
+	return pattern;
+}
+
+void
+bullet_pattern_destroy(struct bullet_pattern *pattern)
+{
+	int i;
+
+	if (!pattern)
+		return;
+
+	for (i = 0; i < pattern->n_programs; i++)
+		free(pattern->programs[i].ops);
+	free(pattern->programs);
+	free(pattern);
+}
+
+const struct bullet_motion *
+bullet_pattern_motions(const struct bullet_pattern *pattern, int *n_motions)
+{
+	*n_motions = pattern->n_motions;
+	return pattern->motions;
+}
+
+const struct bullet_program *
+bullet_pattern_find(const struct bullet_pattern *pattern, const char *name)
+{
+	int i;
+
+	for (i = 0; i < pattern->n_programs; i++) {
+		if (!strcmp(pattern->programs[i].name, name))
+			return &pattern->programs[i];
+	}
+
+	return NULL;
+}
+
+void
+bullet_emitter_init(struct bullet_emitter *emitter,
+		    const struct bullet_program *program,
+		    float x, float y, uint32_t seed)
+{
+	memset(emitter, 0, sizeof(*emitter));
+	emitter->program = program;
+	emitter->x = x;
+	emitter->y = y;
+	emitter->rng = seed ? seed : 1;
+}
+
+/* xorshift32, so emitters are reproducible and independent of rand() */
+static inline uint32_t
+emitter_rand(struct bullet_emitter *e)
+{
+	uint32_t x = e->rng;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	e->rng = x;
+
+	return x;
+}
+
+static float
+emitter_aim(const struct bullet_emitter *e, const struct bullet_op *op)
+{
+	if (!op->aim_sweep)
+		return op->angle;
+	if (!e->period)
+		return e->center;
+
+	return e->center + e->amp * fast_sinf(2.0f * FAST_PI *
+					      (e->frame % e->period) /
+					      e->period);
+}
+
+static int
+emit_shot(struct bullet_emitter *e, const struct bullet_op *op,
+	  struct bullet_pool *pool)
+{
+	struct bullet_bucket *b = &pool->buckets[op->motion];
+	const float base = emitter_aim(e, op);
+	const float center = (op->count - 1) * 0.5f;
+	const float ring_step = 360.0f / op->count;
+	const float range = op->to - op->from;
+	int slots[EMIT_BATCH];
+	float angle[EMIT_BATCH], s[EMIT_BATCH], c[EMIT_BATCH];
+	int done = 0, n, i;
+
+	while (done < op->count) {
+		n = op->count - done;
+		if (n > EMIT_BATCH)
+			n = EMIT_BATCH;
+		n = bullet_pool_alloc(pool, op->motion, n, slots);
+		if (!n)
+			break;
+
+		switch (op->code) {
+		case OP_SPREAD:
+			for (i = 0; i < n; i++)
+				angle[i] = base + (done + i - center) *
+					   op->step;
+			break;
+		case OP_RING:
+			for (i = 0; i < n; i++)
+				angle[i] = base + (done + i) * ring_step;
+			break;
+		case OP_BURST:
+			for (i = 0; i < n; i++)
+				angle[i] = op->from + range *
+					   (emitter_rand(e) >> 8) *
+					   (1.0f / (1 << 24));
+			break;
+		}
+
+		/* one vectorizable pass for the whole batch */
+		for (i = 0; i < n; i++)
+			fast_sincosf(angle[i] * DEG, &s[i], &c[i]);
+
+		for (i = 0; i < n; i++) {
+			int k = slots[i];
+
+			b->x[k] = e->x;
+			b->y[k] = e->y;
+			b->vx[k] = c[i] * op->sx;
+			b->vy[k] = -s[i] * op->sy;
+			b->count[k] = 0;
+			b->sprite[k] = op->sprite;
+		}
+		done += n;
+	}
+
+	return done;
+}
+
+int
+bullet_emitter_step(struct bullet_emitter *emitter, struct bullet_pool *pool)
+{
+	const struct bullet_program *prog = emitter->program;
+	int i, n = 0;
+
+	for (i = 0; i < prog->n_ops; i++) {
+		const struct bullet_op *op = &prog->ops[i];
+
+		if (emitter->frame < (uint32_t)op->start ||
+		    (emitter->frame - op->start) % op->every)
+			continue;
+
+		if (op->code == OP_SWEEP) {
+			emitter->period = op->period_min +
+				emitter_rand(emitter) %
+				(op->period_max - op->period_min + 1);
+			emitter->center = op->angle;
+			emitter->amp = op->step;
+		} else {
+			n += emit_shot(emitter, op, pool);
+		}
+	}
+	emitter->frame++;
+
+	return n;
+}
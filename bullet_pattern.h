@@ -0,0 +1,82 @@
+/*
+ * Copyright © 2022 IGEL Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *    Tomohito Esaki <etom@igel.co.jp>
+ */
+
+#ifndef BULLET_PATTERN_H
+#define BULLET_PATTERN_H
+
+#include <stdint.h>
+
+#include "bullet_pool.h"
+
+/*
+ * Data-driven bullet patterns.
+ *
+ * A pattern file declares the motion classes of the pool and a set of
+ * named emitters; see patterns/keroame.pat for the syntax. Each emitter
+ * compiles to a short list of ops that bullet_emitter_step() runs once
+ * per frame. A shot reserves its slots from the pool in one bulk
+ * allocation and fills them in batches, so any number of emitters can
+ * share a pool without one allocation call per bullet.
+ */
+
+struct bullet_pattern;
+struct bullet_program;
+
+struct bullet_emitter {
+	const struct bullet_program *program;
+	float x;
+	float y;
+	uint32_t frame;
+	uint32_t rng;
+	/* sweep state */
+	int period;
+	float center;
+	float amp;
+};
+
+struct bullet_pattern *bullet_pattern_load(const char *path);
+/* name is only used in error messages */
+struct bullet_pattern *bullet_pattern_parse(const char *text,
+					    const char *name);
+void bullet_pattern_destroy(struct bullet_pattern *pattern);
+
+/* Motion classes in declaration order, for bullet_pool_init() */
+const struct bullet_motion *
+bullet_pattern_motions(const struct bullet_pattern *pattern, int *n_motions);
+
+/* Returns NULL if the pattern has no emitter of that name */
+const struct bullet_program *
+bullet_pattern_find(const struct bullet_pattern *pattern, const char *name);
+
+void bullet_emitter_init(struct bullet_emitter *emitter,
+			 const struct bullet_program *program,
+			 float x, float y, uint32_t seed);
+
+/* Runs one frame of the emitter, returns the number of bullets spawned */
+int bullet_emitter_step(struct bullet_emitter *emitter,
+			struct bullet_pool *pool);
+
+#endif
@@ -0,0 +1,467 @@
+/*
+ * Copyright © 2022 IGEL Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *    Tomohito Esaki <etom@igel.co.jp>
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bullet_pool.h"
+#include "thread_pool.h"
+
+#define POOL_ALIGN	64
+#define ALIGN_UP(x, a)	(((x) + (a) - 1) / (a) * (a))
+
+/*
+ * Update work is split into runs of 64 words, so every task owns whole
+ * words of nonfull and never shares a cache line of live with another.
+ */
+#define BULLET_TASK_WORDS	64
+
+struct bullet_task {
+	int bucket;
+	int word;
+	int n_live;
+	int hint;
+	int n_visible;
+	int first;	/* visible bullets of the tasks before */
+};
+
+struct update_job {
+	struct bullet_pool *pool;
+	int w;
+	int h;
+	bullet_emit_func emit;
+	bullet_emit_at_func emit_at;
+	void *data;
+};
+
+static int
+bucket_init(struct bullet_bucket *b, const struct bullet_motion *motion,
+	    int capacity)
+{
+	size_t fsize, csize, bsize, lsize, nsize, total;
+	uint8_t *p;
+	int i;
+
+	capacity = ALIGN_UP(capacity, POOL_ALIGN);
+	fsize = ALIGN_UP(capacity * sizeof(float), POOL_ALIGN);
+	csize = ALIGN_UP(capacity * sizeof(uint16_t), POOL_ALIGN);
+	bsize = ALIGN_UP(capacity * sizeof(uint8_t), POOL_ALIGN);
+	lsize = ALIGN_UP(capacity / 64 * sizeof(uint64_t), POOL_ALIGN);
+	nsize = ALIGN_UP(ALIGN_UP(capacity / 64, 64) / 64 * sizeof(uint64_t),
+			 POOL_ALIGN);
+	total = fsize * 4 + csize + bsize + lsize * 2 + nsize;
+
+	/* one block per bucket, every array starting on a cache line */
+	p = aligned_alloc(POOL_ALIGN, total);
+	if (!p)
+		return -1;
+	memset(p, 0, total);
+
+	b->motion = *motion;
+	b->capacity = capacity;
+	b->n_words = capacity / 64;
+	b->used_words = 0;
+	b->hint = 0;
+	b->mem = p;
+	b->x = (float *)p;
+	b->y = (float *)(p + fsize);
+	b->vx = (float *)(p + fsize * 2);
+	b->vy = (float *)(p + fsize * 3);
+	b->count = (uint16_t *)(p + fsize * 4);
+	b->sprite = p + fsize * 4 + csize;
+	b->live = (uint64_t *)(p + fsize * 4 + csize + bsize);
+	b->visible = (uint64_t *)(p + fsize * 4 + csize + bsize + lsize);
+	b->nonfull = (uint64_t *)(p + fsize * 4 + csize + bsize + lsize * 2);
+
+	/* every word starts empty */
+	for (i = 0; i < b->n_words; i++)
+		b->nonfull[i >> 6] |= 1ULL << (i & 63);
+
+	return 0;
+}
+
+int
+bullet_pool_init(struct bullet_pool *pool, int capacity,
+		 const struct bullet_motion *motions, int n_motions)
+{
+	int i, n_tasks = 0;
+
+	memset(pool, 0, sizeof(*pool));
+	pool->buckets = calloc(n_motions, sizeof(struct bullet_bucket));
+	if (!pool->buckets)
+		return -1;
+	pool->n_buckets = n_motions;
+	pool->capacity = capacity;
+	pool->kernel = bullet_kernel_select();
+#ifdef DEBUG
+	fprintf(stderr, "bullet kernel: %s\n", pool->kernel->name);
+	assert(bullet_kernel_check(pool->kernel) == 0);
+#endif
+
+	for (i = 0; i < n_motions; i++) {
+		if (bucket_init(&pool->buckets[i], &motions[i], capacity) < 0) {
+			bullet_pool_fini(pool);
+			return -1;
+		}
+		n_tasks += ALIGN_UP(pool->buckets[i].n_words,
+				    BULLET_TASK_WORDS) / BULLET_TASK_WORDS;
+	}
+
+	pool->tasks = calloc(n_tasks, sizeof(struct bullet_task));
+	if (!pool->tasks) {
+		bullet_pool_fini(pool);
+		return -1;
+	}
+
+	return 0;
+}
+
+void
+bullet_pool_fini(struct bullet_pool *pool)
+{
+	int i;
+
+	for (i = 0; i < pool->n_buckets; i++)
+		free(pool->buckets[i].mem);
+	free(pool->buckets);
+	free(pool->tasks);
+	memset(pool, 0, sizeof(*pool));
+}
+
+static int
+bucket_alloc(struct bullet_bucket *b, int n, int *slots)
+{
+	int n_summary = ALIGN_UP(b->n_words, 64) / 64;
+	int s = b->hint >> 6;
+	int done = 0;
+
+	while (done < n) {
+		uint64_t free_bits;
+		int w;
+
+		/* no word below hint has a free slot */
+		while (s < n_summary && !b->nonfull[s])
+			s++;
+		if (s == n_summary)
+			break;
+
+		w = (s << 6) + __builtin_ctzll(b->nonfull[s]);
+		free_bits = ~b->live[w];
+		while (free_bits && done < n) {
+			slots[done++] = (w << 6) + __builtin_ctzll(free_bits);
+			free_bits &= free_bits - 1;
+		}
+
+		b->live[w] = ~free_bits;
+		if (!free_bits)
+			b->nonfull[s] &= ~(1ULL << (w & 63));
+		if (b->used_words <= w)
+			b->used_words = w + 1;
+	}
+	b->hint = s << 6;
+
+	return done;
+}
+
+int
+bullet_pool_alloc(struct bullet_pool *pool, int bucket, int n, int *slots)
+{
+	if (n > pool->capacity - pool->n_live)
+		n = pool->capacity - pool->n_live;
+	if (n <= 0)
+		return 0;
+
+	n = bucket_alloc(&pool->buckets[bucket], n, slots);
+	pool->n_live += n;
+
+	return n;
+}
+
+int
+bullet_pool_spawn(struct bullet_pool *pool, int bucket, uint8_t sprite,
+		  float x, float y, float vx, float vy)
+{
+	struct bullet_bucket *b = &pool->buckets[bucket];
+	int i;
+
+	if (!bullet_pool_alloc(pool, bucket, 1, &i))
+		return -1;
+
+	b->x[i] = x;
+	b->y[i] = y;
+	b->vx[i] = vx;
+	b->vy[i] = vy;
+	b->count[i] = 0;
+	b->sprite[i] = sprite;
+
+	return i;
+}
+
+void
+bullet_pool_free(struct bullet_pool *pool, int bucket, int slot)
+{
+	struct bullet_bucket *b = &pool->buckets[bucket];
+	int k = slot >> 6;
+	uint64_t bit = 1ULL << (slot & 63);
+
+	if (!(b->live[k] & bit))
+		return;
+
+	b->live[k] &= ~bit;
+	b->nonfull[k >> 6] |= 1ULL << (k & 63);
+	if (b->hint > k)
+		b->hint = k;
+	pool->n_live--;
+
+	while (b->used_words > 0 && !b->live[b->used_words - 1])
+		b->used_words--;
+}
+
+void
+bullet_pool_clear(struct bullet_pool *pool)
+{
+	int i, k;
+
+	for (i = 0; i < pool->n_buckets; i++) {
+		struct bullet_bucket *b = &pool->buckets[i];
+
+		for (k = 0; k < b->used_words; k++) {
+			b->live[k] = 0;
+			b->nonfull[k >> 6] |= 1ULL << (k & 63);
+		}
+		b->used_words = 0;
+		b->hint = 0;
+	}
+	pool->n_live = 0;
+}
+
+/* Live slots of word k whose sprite overlaps the w x h screen */
+static uint64_t
+word_visible(const struct bullet_bucket *b, int k, int w, int h)
+{
+	const float xmin = -BULLET_SPRITE_EXTENT;
+	const float xmax = w + BULLET_SPRITE_EXTENT;
+	const float ymin = -BULLET_SPRITE_EXTENT;
+	const float ymax = h + BULLET_SPRITE_EXTENT;
+	uint64_t live = b->live[k], visible = 0;
+
+	while (live) {
+		int bit = __builtin_ctzll(live);
+		int i = (k << 6) + bit;
+
+		live &= live - 1;
+		if (b->x[i] >= xmin && b->x[i] <= xmax &&
+		    b->y[i] >= ymin && b->y[i] <= ymax)
+			visible |= 1ULL << bit;
+	}
+
+	return visible;
+}
+
+/* Advances the words of one task, see BULLET_TASK_WORDS */
+static void
+update_task(void *data, int index, int worker)
+{
+	const struct update_job *job = data;
+	struct bullet_task *task = &job->pool->tasks[index];
+	struct bullet_bucket *b = &job->pool->buckets[task->bucket];
+	const struct bullet_kernel *kernel = job->pool->kernel;
+	const struct bullet_step step = {
+		.gravity = b->motion.gravity,
+		.gravity_until = b->motion.gravity_until,
+		.till = b->motion.till,
+		.xmin = -BULLET_MARGIN,
+		.xmax = job->w + BULLET_MARGIN,
+		.ymin = -BULLET_MARGIN,
+		.ymax = job->h + BULLET_MARGIN,
+	};
+	int last = task->word + BULLET_TASK_WORDS;
+	int k, n_live = 0;
+
+	(void)worker;
+	if (last > b->used_words)
+		last = b->used_words;
+
+	task->hint = b->n_words;
+	task->n_visible = 0;
+
+	/*
+	 * Free slots of a used word are advanced too: their contents are
+	 * overwritten on spawn, and skipping them would need a branch.
+	 * Words without any live bullet are skipped.
+	 */
+	for (k = task->word; k < last; k++) {
+		int i = k << 6;
+		uint64_t retire;
+
+		if (!b->live[k]) {
+			if (job->emit_at)
+				b->visible[k] = 0;
+			continue;
+		}
+
+		retire = kernel->step(&step, b->x + i, b->y + i, b->vx + i,
+				      b->vy + i, b->count + i);
+
+		retire &= b->live[k];
+		if (retire) {
+			b->live[k] &= ~retire;
+			b->nonfull[k >> 6] |= 1ULL << (k & 63);
+			if (task->hint > k)
+				task->hint = k;
+		}
+		n_live += __builtin_popcountll(b->live[k]);
+
+		/* emit while the word is still in cache */
+		if (job->emit) {
+			uint64_t visible = word_visible(b, k, job->w, job->h);
+
+			if (visible)
+				job->emit(job->data, b, k, visible);
+		}
+
+		/* emit_at gets the words once every offset is known */
+		if (job->emit_at) {
+			b->visible[k] = word_visible(b, k, job->w, job->h);
+			task->n_visible += __builtin_popcountll(b->visible[k]);
+		}
+	}
+
+	task->n_live = n_live;
+}
+
+/* Hands the visible words of one task to emit_at */
+static void
+emit_task(void *data, int index, int worker)
+{
+	const struct update_job *job = data;
+	const struct bullet_task *task = &job->pool->tasks[index];
+	const struct bullet_bucket *b = &job->pool->buckets[task->bucket];
+	int last = task->word + BULLET_TASK_WORDS;
+	int k, first = task->first;
+
+	(void)worker;
+	if (last > b->used_words)
+		last = b->used_words;
+
+	for (k = task->word; k < last; k++) {
+		if (!b->visible[k])
+			continue;
+		job->emit_at(job->data, b, k, b->visible[k], first);
+		first += __builtin_popcountll(b->visible[k]);
+	}
+}
+
+/* Returns the number of visible bullets when job->emit_at is set */
+static int
+pool_update(struct bullet_pool *pool, struct update_job *job)
+{
+	int i, k, n_tasks = 0, n_live = 0, n_visible = 0;
+
+	for (i = 0; i < pool->n_buckets; i++) {
+		for (k = 0; k < pool->buckets[i].used_words;
+		     k += BULLET_TASK_WORDS) {
+			pool->tasks[n_tasks].bucket = i;
+			pool->tasks[n_tasks].word = k;
+			n_tasks++;
+		}
+	}
+
+	/* emission is ordered by slot, so it stays on this thread */
+	if (pool->threads && n_tasks > 1 && !job->emit) {
+		thread_pool_run(pool->threads, update_task, job, n_tasks);
+	} else {
+		for (i = 0; i < n_tasks; i++)
+			update_task(job, i, 0);
+	}
+
+	/* merge in task order so the result never depends on scheduling */
+	for (i = 0; i < n_tasks; i++) {
+		struct bullet_task *task = &pool->tasks[i];
+		struct bullet_bucket *b = &pool->buckets[task->bucket];
+
+		if (b->hint > task->hint)
+			b->hint = task->hint;
+		n_live += task->n_live;
+		task->first = n_visible;
+		n_visible += task->n_visible;
+	}
+
+	for (i = 0; i < pool->n_buckets; i++) {
+		struct bullet_bucket *b = &pool->buckets[i];
+
+		while (b->used_words > 0 && !b->live[b->used_words - 1])
+			b->used_words--;
+	}
+
+	pool->n_live = n_live;
+
+	if (!job->emit_at || !n_visible)
+		return 0;
+	if (pool->threads && n_tasks > 1) {
+		thread_pool_run(pool->threads, emit_task, job, n_tasks);
+	} else {
+		for (i = 0; i < n_tasks; i++)
+			emit_task(job, i, 0);
+	}
+
+	return n_visible;
+}
+
+void
+bullet_pool_update(struct bullet_pool *pool, int w, int h)
+{
+	struct update_job job = { pool, w, h, NULL, NULL, NULL };
+
+	pool_update(pool, &job);
+}
+
+void
+bullet_pool_update_emit(struct bullet_pool *pool, int w, int h,
+			bullet_emit_func emit, void *data)
+{
+	struct update_job job = { pool, w, h, emit, NULL, data };
+
+	pool_update(pool, &job);
+}
+
+int
+bullet_pool_update_emit_at(struct bullet_pool *pool, int w, int h,
+			   bullet_emit_at_func emit, void *data)
+{
+	struct update_job job = { pool, w, h, NULL, emit, data };
+
+	return pool_update(pool, &job);
+}
+
+void
+bullet_pool_set_threads(struct bullet_pool *pool,
+			struct thread_pool *threads)
+{
+	pool->threads = threads;
+}
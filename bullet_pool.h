@@ -0,0 +1,205 @@
+/*
+ * Copyright © 2022 IGEL Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *    Tomohito Esaki <etom@igel.co.jp>
+ */
+
+#ifndef BULLET_POOL_H
+#define BULLET_POOL_H
+
+#include <stdint.h>
+
+#include "bullet_kernel.h"
+
+/* Sprite shapes, see the bullet strip in images/img.png */
+enum bullet_type {
+	BULLET_TYPE_SMALL = 0,	/*  8x8  */
+	BULLET_TYPE_LARGE,	/* 16x16 */
+	BULLET_TYPE_NEEDLE,	/*  8x16 */
+	BULLET_TYPE_COUNT,
+};
+
+#define BULLET_SPRITE(type, color)	((uint8_t)(((type) << 4) | (color)))
+#define BULLET_SPRITE_TYPE(sprite)	((sprite) >> 4)
+#define BULLET_SPRITE_COLOR(sprite)	((sprite) & 0xf)
+
+/* Where a sprite type is drawn, sizes in pixels and texels */
+struct bullet_sprite_info {
+	int half_w;
+	int half_h;
+	int u;		/* texel origin of color 0, colors follow along u */
+	int v;
+	int w;
+	int h;
+};
+
+/* Off-screen margin before a bullet may be retired */
+#define BULLET_MARGIN		40
+/* Half size of the largest sprite */
+#define BULLET_SPRITE_EXTENT	8
+
+/*
+ * Motion shared by all bullets of a bucket: vy is decreased by gravity
+ * while count < gravity_until, and a bullet outside the screen is retired
+ * only once count > till.
+ */
+struct bullet_motion {
+	float gravity;
+	uint16_t gravity_until;
+	uint16_t till;
+};
+
+/*
+ * Structure of arrays for one motion class. Slot occupancy is kept in a
+ * bitmap of 64-slot words; nonfull has one bit per live word that still
+ * has a free slot, so allocation never looks at full words. Words at or
+ * above used_words hold no live bullet. visible is scratch for
+ * bullet_pool_update_emit_at().
+ *
+ * The bitmap stands in for a compact list of live slots: the SIMD kernels
+ * advance whole words in place, which a list would scatter. The cost is
+ * that a sparse bucket still visits every word below used_words, empty or
+ * not, to find its bullets.
+ */
+struct bullet_bucket {
+	struct bullet_motion motion;
+	int capacity;
+	int n_words;
+	int used_words;
+	int hint;
+	float *x;
+	float *y;
+	float *vx;
+	float *vy;
+	uint16_t *count;
+	uint8_t *sprite;
+	uint64_t *live;
+	uint64_t *visible;
+	uint64_t *nonfull;
+	void *mem;
+};
+
+struct thread_pool;
+struct bullet_task;
+
+struct bullet_pool {
+	struct bullet_bucket *buckets;
+	int n_buckets;
+	int capacity;
+	int n_live;
+	const struct bullet_kernel *kernel;
+	struct thread_pool *threads;
+	struct bullet_task *tasks;
+};
+
+int bullet_pool_init(struct bullet_pool *pool, int capacity,
+		     const struct bullet_motion *motions, int n_motions);
+void bullet_pool_fini(struct bullet_pool *pool);
+
+/*
+ * Reserves up to n free slots of a bucket, lowest first, and writes their
+ * indices to slots. The caller must fill every returned slot. Returns the
+ * number of slots reserved.
+ */
+int bullet_pool_alloc(struct bullet_pool *pool, int bucket, int n,
+		      int *slots);
+
+/* Returns the slot of the new bullet in the bucket, or -1 if full */
+int bullet_pool_spawn(struct bullet_pool *pool, int bucket, uint8_t sprite,
+		      float x, float y, float vx, float vy);
+
+/* Retires a bullet ahead of its motion, e.g. on a hit */
+void bullet_pool_free(struct bullet_pool *pool, int bucket, int slot);
+
+/* Retires every bullet at once */
+void bullet_pool_clear(struct bullet_pool *pool);
+
+/* Returns the first live slot at or after i, or -1 */
+static inline int
+bullet_bucket_next(const struct bullet_bucket *b, int i)
+{
+	int w = i >> 6;
+	uint64_t bits;
+
+	if (w >= b->used_words)
+		return -1;
+
+	bits = b->live[w] & (~0ULL << (i & 63));
+	while (!bits) {
+		if (++w >= b->used_words)
+			return -1;
+		bits = b->live[w];
+	}
+
+	return (w << 6) + __builtin_ctzll(bits);
+}
+
+#define bullet_bucket_for_each(i, b)				\
+	for (i = bullet_bucket_next(b, 0); i >= 0;		\
+	     i = bullet_bucket_next(b, i + 1))
+
+/*
+ * Advances every live bullet by one frame and retires the ones left out.
+ * The result is the same whether or not the work is split across threads.
+ */
+void bullet_pool_update(struct bullet_pool *pool, int w, int h);
+
+/*
+ * Called once per 64-slot word with a bit for every live bullet whose
+ * sprite overlaps the screen; slot i of the word is (word << 6) + i.
+ */
+typedef void (*bullet_emit_func)(void *data, const struct bullet_bucket *b,
+				 int word, uint64_t visible);
+
+/*
+ * Same as bullet_pool_update(), and hands the on-screen survivors of each
+ * word to emit right after the word is advanced, in slot order. Always
+ * runs on the calling thread.
+ */
+void bullet_pool_update_emit(struct bullet_pool *pool, int w, int h,
+			     bullet_emit_func emit, void *data);
+
+/*
+ * Like bullet_emit_func, with first the number of visible bullets in the
+ * slots before the word, over all buckets in order. May be called from
+ * any thread.
+ */
+typedef void (*bullet_emit_at_func)(void *data,
+				    const struct bullet_bucket *b, int word,
+				    uint64_t visible, int first);
+
+/*
+ * Same as bullet_pool_update(), then hands every word with on-screen
+ * survivors to emit, split across the threads of the pool. Each word
+ * gets its own range of outputs, [first, first + visible bullets), so
+ * writers never overlap and the output is in slot order whatever the
+ * scheduling. Returns the number of visible bullets.
+ */
+int bullet_pool_update_emit_at(struct bullet_pool *pool, int w, int h,
+			       bullet_emit_at_func emit, void *data);
+
+/* Splits bullet_pool_update() across threads, NULL runs it inline */
+void bullet_pool_set_threads(struct bullet_pool *pool,
+			     struct thread_pool *threads);
+
+#endif
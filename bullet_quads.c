@@ -0,0 +1,366 @@
+/*
+ * Copyright © 2022 IGEL Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *    Tomohito Esaki <etom@igel.co.jp>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#define HAVE_NEON_KERNEL
+#endif
+
+#include "bullet_quads.h"
+
+#define ARRAY_LENGTH(a) (sizeof (a) / sizeof (a)[0])
+#define ALIGN_UP(x, a)	(((x) + (a) - 1) / (a) * (a))
+
+static void
+set_vertex(int16_t *v, int x, int y, int u, int tv)
+{
+	v[0] = x;
+	v[1] = y;
+	v[2] = u;
+	v[3] = tv;
+}
+
+/* Corners in sprite_quad() order: top left, top right, bottom left, ... */
+static void
+set_quad(int16_t *v, int x0, int y0, int x1, int y1, int u0, int v0, int u1,
+	 int v1)
+{
+	set_vertex(v + 0, x0, y1, u0, v0);
+	set_vertex(v + 4, x1, y1, u1, v0);
+	set_vertex(v + 8, x0, y0, u0, v1);
+	set_vertex(v + 12, x1, y0, u1, v1);
+}
+
+void
+bullet_quads_init(struct bullet_quads *q,
+		  const struct bullet_sprite_info *sprites)
+{
+	const struct bullet_sprite_info *s;
+	int i, u;
+
+	memset(q->corner, 0, sizeof(q->corner));
+	for (i = 0; i < 256; i++) {
+		if (BULLET_SPRITE_TYPE(i) >= BULLET_TYPE_COUNT)
+			continue;
+		s = &sprites[BULLET_SPRITE_TYPE(i)];
+		u = s->u + BULLET_SPRITE_COLOR(i) * s->w;
+		set_quad(q->corner[i], -s->half_w, -s->half_h, s->half_w,
+			 s->half_h, u, s->v, u + s->w, s->v + s->h);
+	}
+	q->sprites = sprites;
+	q->kernel = bullet_quad_kernel_select();
+}
+
+/* One bullet at a time from the sprite table, as sprite_quad() callers do */
+static int
+emit_scalar(const struct bullet_quads *q, int16_t *quads, int max,
+	    const float *x, const float *y, const uint8_t *sprite,
+	    uint64_t visible)
+{
+	const struct bullet_sprite_info *s;
+	int i, n = 0, bx, by, u;
+
+	while (visible && n < max) {
+		i = __builtin_ctzll(visible);
+		visible &= visible - 1;
+
+		s = &q->sprites[BULLET_SPRITE_TYPE(sprite[i])];
+		bx = x[i];
+		by = y[i];
+		u = s->u + BULLET_SPRITE_COLOR(sprite[i]) * s->w;
+		set_quad(quads + n++ * BULLET_QUAD_SHORTS, bx - s->half_w,
+			 by - s->half_h, bx + s->half_w, by + s->half_h, u,
+			 s->v, u + s->w, s->v + s->h);
+	}
+
+	return n;
+}
+
+/*
+ * The SIMD kernels convert 4 slots at a time to packed 16 bit (x, y)
+ * pairs, truncating like the scalar conversion, and add the pair of each
+ * visible slot to the x, y lanes of its precomputed corners.
+ */
+#ifdef HAVE_X86_KERNELS
+__attribute__((target("sse2")))
+static int
+emit_sse2(const struct bullet_quads *q, int16_t *quads, int max,
+	  const float *x, const float *y, const uint8_t *sprite,
+	  uint64_t visible)
+{
+	const __m128i low = _mm_set1_epi32(0xffff);
+	const __m128i xy_lanes = _mm_set_epi32(0, -1, 0, -1);
+	int32_t xy[4] __attribute__((aligned(16)));
+	int i, k, n = 0;
+
+	for (k = 0; k < 64 && visible >> k && n < max; k += 4) {
+		uint64_t bits = visible >> k & 0xf;
+		__m128i xi, yi;
+
+		if (!bits)
+			continue;
+		xi = _mm_cvttps_epi32(_mm_load_ps(x + k));
+		yi = _mm_cvttps_epi32(_mm_load_ps(y + k));
+		_mm_store_si128((__m128i *)xy,
+				_mm_or_si128(_mm_and_si128(xi, low),
+					     _mm_slli_epi32(yi, 16)));
+
+		while (bits && n < max) {
+			const __m128i *c;
+			__m128i *out, pos;
+
+			i = __builtin_ctzll(bits);
+			bits &= bits - 1;
+			c = (const __m128i *)q->corner[sprite[k + i]];
+			out = (__m128i *)(quads + n++ * BULLET_QUAD_SHORTS);
+			pos = _mm_and_si128(_mm_set1_epi32(xy[i]), xy_lanes);
+			_mm_storeu_si128(out, _mm_add_epi16(
+						_mm_load_si128(c), pos));
+			_mm_storeu_si128(out + 1, _mm_add_epi16(
+						_mm_load_si128(c + 1), pos));
+		}
+	}
+
+	return n;
+}
+
+__attribute__((target("avx2")))
+static int
+emit_avx2(const struct bullet_quads *q, int16_t *quads, int max,
+	  const float *x, const float *y, const uint8_t *sprite,
+	  uint64_t visible)
+{
+	const __m128i low = _mm_set1_epi32(0xffff);
+	const __m256i xy_lanes = _mm256_set_epi32(0, -1, 0, -1, 0, -1, 0, -1);
+	int32_t xy[4] __attribute__((aligned(16)));
+	int i, k, n = 0;
+
+	for (k = 0; k < 64 && visible >> k && n < max; k += 4) {
+		uint64_t bits = visible >> k & 0xf;
+		__m128i xi, yi;
+
+		if (!bits)
+			continue;
+		xi = _mm_cvttps_epi32(_mm_load_ps(x + k));
+		yi = _mm_cvttps_epi32(_mm_load_ps(y + k));
+		_mm_store_si128((__m128i *)xy,
+				_mm_or_si128(_mm_and_si128(xi, low),
+					     _mm_slli_epi32(yi, 16)));
+
+		while (bits && n < max) {
+			__m256i pos, c;
+
+			i = __builtin_ctzll(bits);
+			bits &= bits - 1;
+			c = _mm256_load_si256(
+				(const __m256i *)q->corner[sprite[k + i]]);
+			pos = _mm256_and_si256(_mm256_set1_epi32(xy[i]),
+					       xy_lanes);
+			_mm256_storeu_si256(
+				(__m256i *)(quads + n++ * BULLET_QUAD_SHORTS),
+				_mm256_add_epi16(c, pos));
+		}
+	}
+
+	return n;
+}
+
+static int
+supports_sse2(void)
+{
+	return __builtin_cpu_supports("sse2");
+}
+
+static int
+supports_avx2(void)
+{
+	return __builtin_cpu_supports("avx2");
+}
+#endif
+
+#ifdef HAVE_NEON_KERNEL
+static int
+emit_neon(const struct bullet_quads *q, int16_t *quads, int max,
+	  const float *x, const float *y, const uint8_t *sprite,
+	  uint64_t visible)
+{
+	static const uint32_t lanes[4] = { ~0u, 0, ~0u, 0 };
+	const uint32x4_t xy_lanes = vld1q_u32(lanes);
+	const uint32x4_t low = vdupq_n_u32(0xffff);
+	uint32_t xy[4];
+	int i, k, n = 0;
+
+	for (k = 0; k < 64 && visible >> k && n < max; k += 4) {
+		uint64_t bits = visible >> k & 0xf;
+		uint32x4_t xi, yi;
+
+		if (!bits)
+			continue;
+		xi = vreinterpretq_u32_s32(vcvtq_s32_f32(vld1q_f32(x + k)));
+		yi = vreinterpretq_u32_s32(vcvtq_s32_f32(vld1q_f32(y + k)));
+		vst1q_u32(xy, vorrq_u32(vandq_u32(xi, low),
+					vshlq_n_u32(yi, 16)));
+
+		while (bits && n < max) {
+			const int16_t *c;
+			int16_t *out;
+			int16x8_t pos;
+
+			i = __builtin_ctzll(bits);
+			bits &= bits - 1;
+			c = q->corner[sprite[k + i]];
+			out = quads + n++ * BULLET_QUAD_SHORTS;
+			pos = vreinterpretq_s16_u32(
+				vandq_u32(vdupq_n_u32(xy[i]), xy_lanes));
+			vst1q_s16(out, vaddq_s16(vld1q_s16(c), pos));
+			vst1q_s16(out + 8, vaddq_s16(vld1q_s16(c + 8), pos));
+		}
+	}
+
+	return n;
+}
+
+static int
+supports_neon(void)
+{
+	return !!(getauxval(AT_HWCAP) & HWCAP_ASIMD);
+}
+#endif
+
+static const struct {
+	struct bullet_quad_kernel kernel;
+	int (*supported)(void);
+} kernels[] = {
+	/* slowest first */
+	{ { "scalar", emit_scalar }, NULL },
+#ifdef HAVE_X86_KERNELS
+	{ { "sse2", emit_sse2 }, supports_sse2 },
+	{ { "avx2", emit_avx2 }, supports_avx2 },
+#endif
+#ifdef HAVE_NEON_KERNEL
+	{ { "neon", emit_neon }, supports_neon },
+#endif
+};
+
+int
+bullet_quad_kernel_list(const struct bullet_quad_kernel **list, int max)
+{
+	int i, n = 0;
+
+	for (i = 0; i < (int) ARRAY_LENGTH(kernels) && n < max; i++) {
+		if (!kernels[i].supported || kernels[i].supported())
+			list[n++] = &kernels[i].kernel;
+	}
+
+	return n;
+}
+
+const struct bullet_quad_kernel *
+bullet_quad_kernel_select(void)
+{
+	static const struct bullet_quad_kernel *selected;
+	const struct bullet_quad_kernel *list[ARRAY_LENGTH(kernels)];
+	int n;
+
+	if (!selected) {
+		n = bullet_quad_kernel_list(list, ARRAY_LENGTH(list));
+		selected = list[n - 1];
+	}
+
+	return selected;
+}
+
+#define CHECK_WORDS	64
+
+struct check_words {
+	float x[CHECK_WORDS * 64];
+	float y[CHECK_WORDS * 64];
+	uint8_t sprite[CHECK_WORDS * 64];
+	uint64_t visible[CHECK_WORDS];
+	int16_t ref[64 * BULLET_QUAD_SHORTS];
+	int16_t test[64 * BULLET_QUAD_SHORTS];
+};
+
+int
+bullet_quad_kernel_check(const struct bullet_quad_kernel *kernel)
+{
+	static const struct bullet_sprite_info sprites[BULLET_TYPE_COUNT] = {
+		[BULLET_TYPE_SMALL] = { 4, 4, 0, 0, 8, 8 },
+		[BULLET_TYPE_LARGE] = { 8, 8, 0, 8, 16, 16 },
+		[BULLET_TYPE_NEEDLE] = { 4, 8, 0, 24, 8, 16 },
+	};
+	struct bullet_quads *q;
+	struct check_words *c;
+	unsigned int seed = 1;
+	int i, k, max, n, ret = 0;
+
+	q = aligned_alloc(64, ALIGN_UP(sizeof(*q), 64));
+	c = aligned_alloc(64, ALIGN_UP(sizeof(*c), 64));
+	if (!q || !c) {
+		free(q);
+		free(c);
+		return -1;
+	}
+	bullet_quads_init(q, sprites);
+
+	/* visible range, negative positions truncate toward zero */
+	for (i = 0; i < CHECK_WORDS * 64; i++) {
+		c->x[i] = (rand_r(&seed) % 13120) / 10.0f - 16.0f;
+		c->y[i] = (rand_r(&seed) % 9920) / 10.0f - 16.0f;
+		c->sprite[i] = BULLET_SPRITE(rand_r(&seed) % BULLET_TYPE_COUNT,
+					     rand_r(&seed) % 16);
+	}
+	for (k = 0; k < CHECK_WORDS; k++)
+		c->visible[k] = (uint64_t)rand_r(&seed) << 40 ^
+				(uint64_t)rand_r(&seed) << 20 ^ rand_r(&seed);
+	c->visible[0] = ~0ULL;
+	c->visible[1] = 1ULL << 63;
+
+	for (k = 0; k < CHECK_WORDS && !ret; k++) {
+		i = k * 64;
+		max = k & 1 ? 64 : rand_r(&seed) % 65;
+		memset(c->ref, 0, sizeof(c->ref));
+		memset(c->test, 0, sizeof(c->test));
+		n = emit_scalar(q, c->ref, max, c->x + i, c->y + i,
+				c->sprite + i, c->visible[k]);
+		if (kernel->emit(q, c->test, max, c->x + i, c->y + i,
+				 c->sprite + i, c->visible[k]) != n ||
+		    memcmp(c->ref, c->test, sizeof(c->ref)))
+			ret = -1;
+	}
+
+	free(q);
+	free(c);
+
+	return ret;
+}
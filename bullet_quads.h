@@ -0,0 +1,93 @@
+/*
+ * Copyright © 2022 IGEL Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *    Tomohito Esaki <etom@igel.co.jp>
+ */
+
+#ifndef BULLET_QUADS_H
+#define BULLET_QUADS_H
+
+#include <stdint.h>
+
+#include "bullet_pool.h"
+
+/*
+ * Sprite quads of visible bullets.
+ *
+ * A quad is 4 interleaved vertices of 4 shorts each, x, y, u, v, in the
+ * layout of struct sprite_vertex and the corner order of sprite_quad().
+ * The quad of every sprite byte is precomputed relative to the bullet
+ * position, so a kernel only converts positions and adds them to the
+ * corners; the SIMD kernels write a whole quad with one or two stores.
+ */
+
+#define BULLET_QUAD_SHORTS	16
+
+struct bullet_quads {
+	int16_t corner[256][BULLET_QUAD_SHORTS] __attribute__((aligned(32)));
+	const struct bullet_sprite_info *sprites;
+	const struct bullet_quad_kernel *kernel;
+};
+
+/*
+ * Writes the quads of the visible slots of the 64-slot word at x, y and
+ * sprite to quads, in slot order, stopping after max. Returns the number
+ * of quads written.
+ */
+typedef int (*bullet_quad_func)(const struct bullet_quads *q, int16_t *quads,
+				int max, const float *x, const float *y,
+				const uint8_t *sprite, uint64_t visible);
+
+struct bullet_quad_kernel {
+	const char *name;
+	bullet_quad_func emit;
+};
+
+/* sprites is indexed by sprite type and must outlive q */
+void bullet_quads_init(struct bullet_quads *q,
+		       const struct bullet_sprite_info *sprites);
+
+/* Emits the word of a bucket with the selected kernel */
+static inline int
+bullet_quads_emit(const struct bullet_quads *q, int16_t *quads, int max,
+		  const struct bullet_bucket *b, int word, uint64_t visible)
+{
+	int k = word << 6;
+
+	return q->kernel->emit(q, quads, max, b->x + k, b->y + k,
+			       b->sprite + k, visible);
+}
+
+/* The fastest kernel the running CPU supports */
+const struct bullet_quad_kernel *bullet_quad_kernel_select(void);
+
+/*
+ * Fills list with the kernels the running CPU supports, the scalar
+ * reference first. Returns the number of entries.
+ */
+int bullet_quad_kernel_list(const struct bullet_quad_kernel **list, int max);
+
+/* Compares a kernel against the scalar reference, returns 0 if equal */
+int bullet_quad_kernel_check(const struct bullet_quad_kernel *kernel);
+
+#endif
@@ -54,6 +54,8 @@
 
 #include "platform.h"
 #include "common.h"
+#include "gl_state.h"
+#include "sim_pipeline.h"
 
 #define MIN(x,y) (((x) < (y)) ? (x) : (y))
 #define ARRAY_LENGTH(a) (sizeof (a) / sizeof (a)[0])
@@ -110,6 +112,8 @@ struct window {
 	struct wl_list window_output_list; /* struct window_output::link */
 
 	struct app_info *app;
+	struct sim_pipeline sim;
+	bool simulating;
 };
 
 struct output {
@@ -323,7 +327,19 @@ init_gl(struct window *window)
 	if (!window->frame_sync)
 		eglSwapInterval(window->display->egl.dpy, 0);
 
+	window->app->buffer_width = window->buffer_size.width;
+	window->app->buffer_height = window->buffer_size.height;
 	window->app->cb.init_gl(window->app->cb.user_data);
+
+	if (window->app->cb.simulate) {
+		window->simulating =
+			sim_pipeline_start(&window->sim,
+					   window->app->cb.simulate,
+					   window->app->cb.user_data,
+					   window->app->sim_state[0],
+					   window->app->sim_state[1]) == 0;
+		assert(window->simulating);
+	}
 }
 
 static void
@@ -518,8 +534,15 @@ redraw(struct window *window)
 
 	if (window->needs_buffer_geometry_update)
 		update_buffer_geometry(window);
+	window->app->buffer_width = window->buffer_size.width;
+	window->app->buffer_height = window->buffer_size.height;
 
+	if (window->simulating)
+		window->app->sim_front = sim_pipeline_acquire(&window->sim);
 	window->app->cb.redraw(window->app->cb.user_data, &damage);
+	if (window->simulating)
+		sim_pipeline_release(&window->sim);
+	gl_state_end_frame();
 
 	if (display->swap_buffers_with_damage)
 		eglQuerySurface(display->egl.dpy, window->egl_surface,
@@ -538,8 +561,8 @@ redraw(struct window *window)
 		damage.width > 0 && damage.height > 0) {
 		rect[0] = damage.x;
 		rect[1] = damage.y;
-		rect[2] = damage.x + damage.width - 1;
-		rect[3] = damage.y + damage.height -1;
+		rect[2] = damage.width;
+		rect[3] = damage.height;
 		display->swap_buffers_with_damage(display->egl.dpy,
 						  window->egl_surface,
 						  rect, 1);
@@ -1010,6 +1033,8 @@ app_main(int argc, char **argv, struct app_info *app)
 
 	fprintf(stderr, "%s exiting\n", app->name);
 
+	if (window.simulating)
+		sim_pipeline_stop(&window.sim);
 	window.app->cb.deinit_gl(window.app->cb.user_data);
 
 	destroy_surface(&window);
@@ -27,6 +27,7 @@
 #ifndef COMMON_H
 #define COMMON_H
 
+/* In buffer pixels from the bottom left, as EGL damage rects */
 struct rect {
 	int x;
 	int y;
@@ -43,8 +44,20 @@ struct app_info {
 		void (*init_gl)(void *data);
 		void (*deinit_gl)(void *data);
 		void (*redraw)(void *data, struct rect *damage);
+		/*
+		 * Optional. Called on a worker thread to write the next frame
+		 * into state, one of sim_state[], while redraw() draws the
+		 * previous one from sim_front. It runs between init_gl() and
+		 * deinit_gl() and must not call GL.
+		 */
+		void (*simulate)(void *data, void *state);
 		void *user_data;
 	} cb;
+	void *sim_state[2];
+	const void *sim_front;
+	/* Size of the window buffer, current in init_gl() and redraw() */
+	int buffer_width;
+	int buffer_height;
 };
 
 void app_main(int argc, char **argv, struct app_info *app);
@@ -30,12 +30,16 @@
 #include <math.h>
 #include <assert.h>
 #include <time.h>
-#include <cairo.h>
 
 #include <GLES3/gl31.h>
 
 #include "common.h"
 #include "shader.h"
+#include "gl_state.h"
+#include "render_target.h"
+#include "render_graph.h"
+#include "sprite_batch.h"
+#include "text.h"
 
 #define WINDOW_WIDTH		1920
 #define WINDOW_HEIGHT		1080
@@ -43,7 +47,6 @@
 struct gl_info {
 	struct {
 		GLuint render_fbo;
-		GLuint render_screen;
 		GLuint compute;
 	} program;
 	struct {
@@ -52,20 +55,15 @@ struct gl_info {
 			GLuint color;
 			GLuint ball;
 		} fbo;
-		struct {
-			GLuint vertex;
-			GLuint texcoord;
-			GLuint index;
-		} screen;
-		struct {
-			GLuint vertex;
-			GLuint texcoord;
-		} frame;
 	} buffer;
-	GLuint texture;
-	GLuint fbo;
-	GLuint rb;
-	GLuint tex_frame;
+	struct render_target_pool targets;
+	struct render_graph graph;
+	int frame;
+	struct sprite_batch sprites;
+	int sprite_text;
+	struct text_font font;
+	struct text_label frame_count;
+	const struct app_info *info;
 };
 
 #define N_BALL		1000000
@@ -79,9 +77,6 @@ struct ball {
 enum {
 	GL_SH_LOC_FBO_POSITION = 0,
 	GL_SH_LOC_FBO_COLOR,
-	GL_SH_LOC_SC_POSITION,
-	GL_SH_LOC_SC_TEXCOORD,
-	GL_SH_LOC_SC_SRC_TEX,
 };
 
 enum {
@@ -114,25 +109,6 @@ static const char *fbo_fshader_code = "#version 310 es\n" TO_STRING(
 		fragColor = vColor * n.z;
 	});
 
-static const char *vshader_code = "#version 310 es\n" TO_STRING(
-	layout (location=2) in vec2 position;
-	layout (location=3) in vec2 texcoord;
-	out vec2 vTexcoord;
-	void main()
-	{
-		gl_Position = vec4(position.xy, 0.0, 1.0);
-		vTexcoord = texcoord;
-	});
-
-static const char *fshader_code = "#version 310 es\n" TO_STRING(
-	out mediump vec4 fragColor;
-	in mediump vec2 vTexcoord;
-	layout (location=4) uniform sampler2D srcTex;
-	void main()
-	{
-		fragColor = texture(srcTex, vTexcoord);
-	});
-
 static const char *cshader_code = "#version 310 es\n" TO_STRING(
 	struct BallObj {
 		vec2 p;
@@ -169,34 +145,6 @@ static const char *cshader_code = "#version 310 es\n" TO_STRING(
                 pos[i] = vec4(b[i].p.xy, 0.0, 1.0);
 	});
 
-static void
-init_texture(struct gl_info *gl)
-{
-	GLuint texture;
-
-	glGenTextures(1, &texture);
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, texture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, WINDOW_WIDTH, WINDOW_HEIGHT, 0,
-		     GL_RGBA, GL_UNSIGNED_BYTE, 0);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	gl->texture = texture;
-
-	glGenTextures(1, &texture);
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, texture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, WINDOW_WIDTH, WINDOW_HEIGHT, 0,
-		     GL_RGBA, GL_UNSIGNED_BYTE, 0);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	gl->tex_frame = texture;
-}
-
 static void
 init_shader(struct gl_info *gl)
 {
@@ -210,13 +158,6 @@ init_shader(struct gl_info *gl)
 	assert(program);
 	gl->program.render_fbo = program;
 
-	memset(&shader, 0x0, sizeof(shader));
-	shader.vertex = vshader_code;
-	shader.fragment = fshader_code;
-	program = shader_build_program(&shader);
-	assert(program);
-	gl->program.render_screen = program;
-
 	memset(&shader, 0x0, sizeof(shader));
 	shader.compute = cshader_code;
 	program = shader_build_program(&shader);
@@ -225,45 +166,11 @@ init_shader(struct gl_info *gl)
 
 	glEnableVertexAttribArray(GL_SH_LOC_FBO_POSITION);
 	glEnableVertexAttribArray(GL_SH_LOC_FBO_COLOR);
-	glEnableVertexAttribArray(GL_SH_LOC_SC_POSITION);
-	glEnableVertexAttribArray(GL_SH_LOC_SC_TEXCOORD);
-}
-
-static void
-init_fbo(struct gl_info *gl)
-{
-	glGenFramebuffers(1, &gl->fbo);
-	glBindFramebuffer(GL_FRAMEBUFFER, gl->fbo);
-	glGenRenderbuffers(1, &gl->rb);
-	glBindRenderbuffer(GL_RENDERBUFFER, gl->rb);
-	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24,
-			      WINDOW_WIDTH, WINDOW_HEIGHT);
-	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
-				  GL_RENDERBUFFER, gl->rb);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-			       GL_TEXTURE_2D, gl->texture, 0);
-	glBindRenderbuffer(GL_RENDERBUFFER, 0);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
 static void
 init_buffer(struct gl_info *gl)
 {
-	GLfloat vertex[] = {
-		-1, -1,
-		-1, 1,
-		1, 1,
-		1, -1,
-	};
-	GLfloat texcoord[] = {
-		0, 0,
-		0, 1,
-		1, 1,
-		1, 0,
-	};
-	GLushort index[] = {
-		0, 1, 2, 0, 2, 3
-	};
 	float *color;
 	struct ball *b;
 	float sp, ang;
@@ -333,157 +240,155 @@ init_buffer(struct gl_info *gl)
 		     GL_STATIC_DRAW);
 	glVertexAttribPointer(GL_SH_LOC_FBO_COLOR, 4, GL_FLOAT, GL_FALSE, 0, 0);
 
-	glGenBuffers(1, &gl->buffer.screen.vertex);
-	glBindBuffer(GL_ARRAY_BUFFER, gl->buffer.screen.vertex);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertex), vertex, GL_STATIC_DRAW);
-	glVertexAttribPointer(GL_SH_LOC_SC_POSITION, 2, GL_FLOAT, GL_FALSE, 0,
-			      0);
-	glGenBuffers(1, &gl->buffer.screen.texcoord);
-	glBindBuffer(GL_ARRAY_BUFFER, gl->buffer.screen.texcoord);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(texcoord), texcoord,
-		     GL_STATIC_DRAW);
-	glVertexAttribPointer(GL_SH_LOC_SC_TEXCOORD, 2, GL_FLOAT, GL_FALSE, 0,
-			      0);
-	glGenBuffers(1, &gl->buffer.screen.index);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gl->buffer.screen.index);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(index), index,
-		     GL_STATIC_DRAW);
 	free(b);
 	free(color);
+}
 
-	glGenBuffers(1, &gl->buffer.frame.vertex);
-	glGenBuffers(1, &gl->buffer.frame.texcoord);
+/* The frame counter is rasterized once and only its changed digits move */
+static void
+init_text(struct gl_info *gl)
+{
+	struct sprite_state state = {
+		.blend = SPRITE_BLEND_ALPHA,
+	};
+	int ret;
+
+	ret = text_font_rasterize(&gl->font, "sans-serif", 30.0,
+				  "0123456789");
+	assert(ret == 0);
+	ret = sprite_batch_init(&gl->sprites, TEXT_LABEL_MAX);
+	assert(ret == 0);
+	state.texture = gl->font.texture;
+	state.tex_width = gl->font.tex_width;
+	state.tex_height = gl->font.tex_height;
+	gl->sprite_text = sprite_batch_add_state(&gl->sprites, &state);
+	assert(gl->sprite_text >= 0);
+
+	text_label_init(&gl->frame_count, &gl->font, WINDOW_WIDTH * 9 / 10,
+			WINDOW_HEIGHT - gl->font.cell_height,
+			TEXT_ALIGN_LEFT);
 }
 
 static void
-init_gl(void *data)
+simulate(void *data, struct render_graph *graph)
 {
 	struct gl_info *gl = data;
 
-	init_texture(gl);
-	init_shader(gl);
-	init_fbo(gl);
-	init_buffer(gl);
+	gl_state_use_program(gl->program.compute);
+	glDispatchCompute(N_BALL / 32, 1, 1);
 }
 
 static void
-deinit_gl(void *data)
+draw_points(void *data, struct render_graph *graph)
 {
 	struct gl_info *gl = data;
 
-	glDeleteFramebuffers(1, &gl->fbo);
-	glDeleteRenderbuffers(1, &gl->rb);
-	glDeleteBuffers(1, &gl->buffer.fbo.vertex);
-	glDeleteBuffers(1, &gl->buffer.fbo.ball);
-	glDeleteBuffers(1, &gl->buffer.fbo.color);
-	glDeleteBuffers(1, &gl->buffer.screen.vertex);
-	glDeleteBuffers(1, &gl->buffer.screen.texcoord);
-	glDeleteBuffers(1, &gl->buffer.screen.index);
-	glDeleteBuffers(1, &gl->buffer.frame.vertex);
-	glDeleteBuffers(1, &gl->buffer.frame.texcoord);
-	glDeleteTextures(1, &gl->texture);
-	glDeleteTextures(1, &gl->tex_frame);
-	glDeleteProgram(gl->program.render_fbo);
-	glDeleteProgram(gl->program.render_screen);
-	glDeleteProgram(gl->program.compute);
+	gl_state_use_program(gl->program.render_fbo);
+	gl_state_enable(GL_BLEND);
+	gl_state_blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glClearColor(0.0f, 0.0f, 0.0f, 0.5f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	/* the text sprites may have taken these attributes */
+	gl_state_bind_buffer(GL_ARRAY_BUFFER, gl->buffer.fbo.vertex);
+	gl_state_vertex_attrib_pointer(GL_SH_LOC_FBO_POSITION, 4, GL_FLOAT,
+				       GL_FALSE, 0, 0);
+	gl_state_bind_buffer(GL_ARRAY_BUFFER, gl->buffer.fbo.color);
+	gl_state_vertex_attrib_pointer(GL_SH_LOC_FBO_COLOR, 4, GL_FLOAT,
+				       GL_FALSE, 0, 0);
+	glDrawArrays(GL_POINTS, 0, N_BALL);
 }
 
 static void
-draw_frame_count(struct gl_info *gl, int frame)
+draw_frame_count(void *data, struct render_graph *graph)
 {
-	cairo_surface_t *surface;
-	cairo_t *cr;
-	cairo_text_extents_t ext;
-	char str[16];
-	uint8_t *data;
-
-	snprintf(str, sizeof(str), "%d", frame);
-
-	surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 64, 64);
-	cr = cairo_create(surface);
-	cairo_set_source_rgb(cr, 0.0, 0.0, 0.0);
-	cairo_rectangle(cr, 0, 0, 64, 64);
-        cairo_fill(cr);
-	cairo_set_font_size(cr, 30.0);
-	cairo_text_extents(cr, str, &ext);
-	cairo_set_source_rgb(cr, 1.0, 1.0, 1.0);
-	cairo_move_to(cr, 0, ext.height);
-	cairo_show_text(cr, str);
-	data = cairo_image_surface_get_data(surface);
-
-	glBindTexture(GL_TEXTURE_2D, gl->tex_frame);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 64, 64, 0, GL_RGBA,
-		     GL_UNSIGNED_BYTE, data);
-
-	cairo_destroy(cr);
-	cairo_surface_destroy(surface);
-
-	GLfloat vertex[] = {
-		0.8, 1,
-		1, 1,
-		1, 0.8,
-		0.8, 0.8,
-		0.8, 1,
-	};
-	GLfloat texcoord[] = {
-		0, 0,
-		1, 0,
-		1, 1,
-		0, 1,
-		0, 0,
-	};
+	struct gl_info *gl = data;
 
-	glUniform1i(GL_SH_LOC_SC_SRC_TEX, 1);
-	glBindBuffer(GL_ARRAY_BUFFER, gl->buffer.frame.vertex);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertex), vertex, GL_STATIC_DRAW);
-	glVertexAttribPointer(GL_SH_LOC_SC_POSITION, 2, GL_FLOAT, GL_FALSE, 0,
-			      0);
-	glBindBuffer(GL_ARRAY_BUFFER, gl->buffer.frame.texcoord);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(texcoord), texcoord,
-		     GL_STATIC_DRAW);
-	glVertexAttribPointer(GL_SH_LOC_SC_TEXCOORD, 2, GL_FLOAT, GL_FALSE, 0,
-			      0);
-	glDrawArrays(GL_TRIANGLE_STRIP, 0, 5);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	text_label_printf(&gl->frame_count, "%d", gl->frame);
+	sprite_batch_begin(&gl->sprites, WINDOW_WIDTH, WINDOW_HEIGHT);
+	text_label_draw(&gl->frame_count, &gl->sprites, gl->sprite_text);
+	sprite_batch_end(&gl->sprites);
 }
 
+/*
+ * The points are drawn off screen and copied to the window. The copy is
+ * merged away when the graph is compiled, the scene target stays
+ * declared so the copy comes back as a blit if anything else reads it.
+ */
 static void
-redraw(void *data, struct rect *damage)
+init_graph(struct gl_info *gl)
+{
+	struct render_graph *graph = &gl->graph;
+	int ball, vertex, scene, back, pass;
+
+	render_graph_init(graph, &gl->targets);
+	ball = render_graph_add_buffer(graph, "ball");
+	vertex = render_graph_add_buffer(graph, "vertex");
+	scene = render_graph_add_target(graph, "scene", GL_RGBA8, 1, 1);
+	back = render_graph_add_backbuffer(graph);
+
+	pass = render_graph_add_pass(graph, RENDER_PASS_COMPUTE, "simulate",
+				     simulate, gl);
+	render_graph_read(graph, pass, ball, RENDER_ACCESS_STORAGE);
+	render_graph_write(graph, pass, ball, RENDER_ACCESS_STORAGE);
+	render_graph_write(graph, pass, vertex, RENDER_ACCESS_STORAGE);
+
+	pass = render_graph_add_pass(graph, RENDER_PASS_DRAW, "points",
+				     draw_points, gl);
+	render_graph_read(graph, pass, vertex, RENDER_ACCESS_VERTEX);
+	render_graph_write(graph, pass, scene, RENDER_ACCESS_COLOR);
+
+	pass = render_graph_add_pass(graph, RENDER_PASS_COPY, "composite",
+				     NULL, NULL);
+	render_graph_read(graph, pass, scene, RENDER_ACCESS_TEXTURE);
+	render_graph_write(graph, pass, back, RENDER_ACCESS_COLOR);
+
+	pass = render_graph_add_pass(graph, RENDER_PASS_DRAW, "text",
+				     draw_frame_count, gl);
+	render_graph_write(graph, pass, back, RENDER_ACCESS_COLOR);
+
+	render_graph_compile(graph);
+}
+
+static void
+init_gl(void *data)
 {
 	struct gl_info *gl = data;
-	static int frame = 0;
 
-	glUseProgram(gl->program.compute);
-	glDispatchCompute(N_BALL / 32, 1, 1);
+	init_shader(gl);
+	render_target_pool_init(&gl->targets);
+	init_buffer(gl);
+	init_text(gl);
+	init_graph(gl);
+	gl->frame = 0;
 
-	glViewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
+	/* everything above used raw GL */
+	gl_state_invalidate();
+}
 
-	//draw to FBO
-	glUseProgram(gl->program.render_fbo);
-	glBindFramebuffer(GL_FRAMEBUFFER, gl->fbo);
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	glClearColor(0.0f, 0.0f, 0.0f, 0.5f);
-	glClear(GL_COLOR_BUFFER_BIT);
-	glDrawArrays(GL_POINTS, 0, N_BALL);
+static void
+deinit_gl(void *data)
+{
+	struct gl_info *gl = data;
 
-	//draw to Screen
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	glUseProgram(gl->program.render_screen);
-	glDisable(GL_BLEND);
-	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	render_target_pool_fini(&gl->targets);
+	gl_state_delete_buffers(1, &gl->buffer.fbo.vertex);
+	gl_state_delete_buffers(1, &gl->buffer.fbo.ball);
+	gl_state_delete_buffers(1, &gl->buffer.fbo.color);
+	text_label_fini(&gl->frame_count);
+	sprite_batch_fini(&gl->sprites);
+	gl_state_delete_textures(1, &gl->font.texture);
+	glDeleteProgram(gl->program.render_fbo);
+	glDeleteProgram(gl->program.compute);
+}
 
-	glUniform1i(GL_SH_LOC_SC_SRC_TEX, 0);
-	glBindBuffer(GL_ARRAY_BUFFER, gl->buffer.screen.vertex);
-	glVertexAttribPointer(GL_SH_LOC_SC_POSITION, 2, GL_FLOAT, GL_FALSE, 0, 0);
-	glBindBuffer(GL_ARRAY_BUFFER, gl->buffer.screen.texcoord);
-	glVertexAttribPointer(GL_SH_LOC_SC_TEXCOORD, 2, GL_FLOAT, GL_FALSE, 0, 0);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gl->buffer.screen.index);
-	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+static void
+redraw(void *data, struct rect *damage)
+{
+	struct gl_info *gl = data;
 
-	frame++;
-	draw_frame_count(gl, frame);
+	gl->frame++;
+	render_graph_execute(&gl->graph, gl->info->buffer_width,
+			     gl->info->buffer_height);
 }
 
 int
@@ -503,6 +408,7 @@ main(int argc, char **argv)
 		},
 	};
 
+	gl.info = &app;
 	app_main(argc, argv, &app);
 
 	return 0;
@@ -32,6 +32,8 @@
 
 #include "common.h"
 #include "shader.h"
+#include "gl_state.h"
+#include "damage.h"
 
 #define WINDOW_WIDTH	500
 #define WINDOW_HEIGHT	500
@@ -43,6 +45,7 @@ struct gl_info {
 	GLuint model;
 	GLuint buffers[3];
 	GLuint program;
+	struct damage damage;
 };
 
 #define TO_STRING(x)	#x
@@ -182,6 +185,7 @@ init_gl(void *data)
 	glCullFace(GL_BACK);
 
 	init_gl_buffer(gl);
+	damage_init(&gl->damage);
 }
 
 static void
@@ -189,7 +193,7 @@ deinit_gl(void *data)
 {
 	struct gl_info *gl = data;
 
-	glDeleteBuffers(3, gl->buffers);
+	gl_state_delete_buffers(3, gl->buffers);
 	glDeleteProgram(gl->program);
 }
 
@@ -308,6 +312,10 @@ redraw(void *data, struct rect *damage)
 	};
 	static GLfloat rot_x = 0;
 	static GLfloat rot_y = 0;
+	static const GLfloat cube_min[3] = { -0.5, -0.5, -0.5 };
+	static const GLfloat cube_max[3] = { 0.5, 0.5, 0.5 };
+	GLfloat mvp[4][4];
+	struct rect rect;
 
 	rot_x += 0.5;
 	rot_y += 0.3;
@@ -325,20 +333,20 @@ redraw(void *data, struct rect *damage)
 	glClearColor(0.0, 0.0, 0.0, 0.5);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-	glBindBuffer(GL_ARRAY_BUFFER, gl->buffers[0]);
-	glVertexAttribPointer(gl->pos, 3, GL_FLOAT, GL_FALSE, 0, 0);
+	gl_state_bind_buffer(GL_ARRAY_BUFFER, gl->buffers[0]);
+	gl_state_vertex_attrib_pointer(gl->pos, 3, GL_FLOAT, GL_FALSE, 0, 0);
 
-	glBindBuffer(GL_ARRAY_BUFFER, gl->buffers[1]);
-	glVertexAttribPointer(gl->col, 4, GL_FLOAT, GL_FALSE, 0, 0);
+	gl_state_bind_buffer(GL_ARRAY_BUFFER, gl->buffers[1]);
+	gl_state_vertex_attrib_pointer(gl->col, 4, GL_FLOAT, GL_FALSE, 0, 0);
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gl->buffers[2]);
+	gl_state_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, gl->buffers[2]);
 	glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_SHORT, 0);
 
-	/* return damage region */
-	damage->x = WINDOW_WIDTH / 4;
-	damage->y = WINDOW_HEIGHT / 4;
-	damage->width = WINDOW_WIDTH / 2;
-	damage->height = WINDOW_WIDTH / 2;
+	/* return damage region, where the cube is and was */
+	mult_matrix(projection, model, mvp);
+	damage_project_box(mvp, cube_min, cube_max, WINDOW_WIDTH,
+			   WINDOW_HEIGHT, &rect);
+	damage_update(&gl->damage, &rect, WINDOW_WIDTH, WINDOW_HEIGHT, damage);
 }
 
 int
@@ -0,0 +1,116 @@
+/*
+ * Copyright © 2022 IGEL Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *    Tomohito Esaki <etom@igel.co.jp>
+ */
+
+#include <string.h>
+#include <math.h>
+
+#include "damage.h"
+
+#define MIN(x,y) (((x) < (y)) ? (x) : (y))
+#define MAX(x,y) (((x) > (y)) ? (x) : (y))
+
+/* Clip space w below which a corner counts as behind the eye */
+#define MIN_W		1e-5f
+
+void
+damage_init(struct damage *d)
+{
+	memset(d, 0, sizeof(*d));
+}
+
+static void
+rect_union(struct rect *a, const struct rect *b)
+{
+	int x1, y1;
+
+	if (b->width <= 0 || b->height <= 0)
+		return;
+	if (a->width <= 0 || a->height <= 0) {
+		*a = *b;
+		return;
+	}
+
+	x1 = MAX(a->x + a->width, b->x + b->width);
+	y1 = MAX(a->y + a->height, b->y + b->height);
+	a->x = MIN(a->x, b->x);
+	a->y = MIN(a->y, b->y);
+	a->width = x1 - a->x;
+	a->height = y1 - a->y;
+}
+
+void
+damage_project_box(const float m[4][4], const float min[3],
+		   const float max[3], int width, int height,
+		   struct rect *rect)
+{
+	float lo[2] = { 1, 1 }, hi[2] = { -1, -1 };
+	float p[3], clip[4];
+	int corner, i, j, x0, y0, x1, y1;
+
+	for (corner = 0; corner < 8; corner++) {
+		for (i = 0; i < 3; i++)
+			p[i] = corner & (1 << i) ? max[i] : min[i];
+		for (i = 0; i < 4; i++) {
+			clip[i] = m[3][i];
+			for (j = 0; j < 3; j++)
+				clip[i] += m[j][i] * p[j];
+		}
+		if (clip[3] < MIN_W) {
+			/* the projection wraps around, stay safe */
+			*rect = (struct rect){ 0, 0, width, height };
+			return;
+		}
+		for (i = 0; i < 2; i++) {
+			lo[i] = fminf(lo[i], clip[i] / clip[3]);
+			hi[i] = fmaxf(hi[i], clip[i] / clip[3]);
+		}
+	}
+
+	/* pixels whose center may be covered, clamped to the viewport */
+	x0 = floorf((fmaxf(lo[0], -1) + 1) * 0.5f * width);
+	y0 = floorf((fmaxf(lo[1], -1) + 1) * 0.5f * height);
+	x1 = ceilf((fminf(hi[0], 1) + 1) * 0.5f * width);
+	y1 = ceilf((fminf(hi[1], 1) + 1) * 0.5f * height);
+	*rect = (struct rect){ x0, y0, x1 - x0, y1 - y0 };
+	if (x1 <= x0 || y1 <= y0)
+		rect->width = rect->height = 0;
+}
+
+void
+damage_update(struct damage *d, const struct rect *rect, int width,
+	      int height, struct rect *damage)
+{
+	if (width != d->width || height != d->height) {
+		*damage = (struct rect){ 0, 0, width, height };
+	} else {
+		*damage = *rect;
+		rect_union(damage, &d->last);
+	}
+
+	d->last = *rect;
+	d->width = width;
+	d->height = height;
+}
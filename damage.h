@@ -0,0 +1,64 @@
+/*
+ * Copyright © 2022 IGEL Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *    Tomohito Esaki <etom@igel.co.jp>
+ */
+
+#ifndef DAMAGE_H
+#define DAMAGE_H
+
+#include "common.h"
+
+/*
+ * Damage of a sample drawing one moving object over a constant
+ * background.
+ *
+ * damage_project_box() bounds the pixels an object box covers after a
+ * transform; damage_update() adds where the object was the frame before,
+ * which the new frame redraws as background. The first frame and the
+ * first one after a resize damage the whole viewport.
+ *
+ * Rects are in viewport pixels from the bottom left, as EGL damage is.
+ */
+
+struct damage {
+	struct rect last;
+	int width, height;	/* of the viewport last drawn, 0 if none */
+};
+
+void damage_init(struct damage *d);
+
+/*
+ * Rect covering the box from min to max transformed by the column-major
+ * matrix m into clip space, in a width x height viewport. A box reaching
+ * behind the eye covers the viewport.
+ */
+void damage_project_box(const float m[4][4], const float min[3],
+			const float max[3], int width, int height,
+			struct rect *rect);
+
+/* Sets damage to rect and the last rect, then remembers rect */
+void damage_update(struct damage *d, const struct rect *rect, int width,
+		   int height, struct rect *damage);
+
+#endif
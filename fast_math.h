@@ -0,0 +1,129 @@
+/*
+ * Copyright © 2022 IGEL Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *    Tomohito Esaki <etom@igel.co.jp>
+ */
+
+#ifndef FAST_MATH_H
+#define FAST_MATH_H
+
+#include <stdint.h>
+
+/*
+ * Branch-free float approximations of sin, cos and atan2 for spawn-time
+ * math. They are inline so loops over them vectorize. Absolute error is
+ * below 1e-7 for sin/cos with |x| < 8192 and below 4e-6 rad for atan2.
+ */
+
+#define FAST_PI		3.14159265358979323846f
+#define FAST_PI_2	1.57079632679489661923f
+
+/* r = x - q * pi/2 in three parts, q the nearest quadrant */
+static inline float
+fast_reduce(float x, int *q)
+{
+	int n = (int)(x * 0.63661977236758134f + (x < 0.0f ? -0.5f : 0.5f));
+	float r;
+
+	r = x - n * 1.5703125f;
+	r = r - n * 4.837512969970703125e-4f;
+	r = r - n * 7.54978995489188216e-8f;
+	*q = n;
+
+	return r;
+}
+
+/* minimax polynomials on [-pi/4, pi/4] */
+static inline float
+fast_sin_poly(float r)
+{
+	float r2 = r * r;
+
+	return r + r * r2 * (-1.6666654611e-1f + r2 *
+		(8.3321608736e-3f - r2 * 1.9515295891e-4f));
+}
+
+static inline float
+fast_cos_poly(float r)
+{
+	float r2 = r * r;
+
+	return 1.0f - 0.5f * r2 + r2 * r2 * (4.166664568298827e-2f + r2 *
+		(-1.388731625493765e-3f + r2 * 2.443315711809948e-5f));
+}
+
+static inline void
+fast_sincosf(float x, float *s, float *c)
+{
+	int q;
+	float r = fast_reduce(x, &q);
+	float ps = fast_sin_poly(r), pc = fast_cos_poly(r);
+	float sv = q & 1 ? pc : ps;
+	float cv = q & 1 ? ps : pc;
+
+	*s = q & 2 ? -sv : sv;
+	*c = (q + 1) & 2 ? -cv : cv;
+}
+
+static inline float
+fast_sinf(float x)
+{
+	float s, c;
+
+	fast_sincosf(x, &s, &c);
+	return s;
+}
+
+static inline float
+fast_cosf(float x)
+{
+	float s, c;
+
+	fast_sincosf(x, &s, &c);
+	return c;
+}
+
+static inline float
+fast_atan2f(float y, float x)
+{
+	float ax = x < 0.0f ? -x : x;
+	float ay = y < 0.0f ? -y : y;
+	float mx = ax > ay ? ax : ay;
+	float mn = ax > ay ? ay : ax;
+	float a = mx > 0.0f ? mn / mx : 0.0f;
+	float s = a * a;
+	float r;
+
+	r = -0.013480470f;
+	r = r * s + 0.057477314f;
+	r = r * s - 0.121239071f;
+	r = r * s + 0.195635925f;
+	r = r * s - 0.332994597f;
+	r = (r * s + 0.999995630f) * a;
+	r = ay > ax ? FAST_PI_2 - r : r;
+	r = x < 0.0f ? FAST_PI - r : r;
+
+	return y < 0.0f ? -r : r;
+}
+
+#endif
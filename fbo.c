@@ -28,29 +28,33 @@
 #include <string.h>
 #include <math.h>
 #include <assert.h>
-#include <cairo.h>
 #include <sys/time.h>
 
 #include <GLES3/gl3.h>
 
 #include "common.h"
 #include "shader.h"
+#include "atlas.h"
+#include "bullet_pattern.h"
+#include "bullet_pool.h"
+#include "bullet_quads.h"
+#include "thread_pool.h"
+#include "gl_state.h"
+#include "render_target.h"
+#include "render_graph.h"
+#include "post_chain.h"
+#include "damage.h"
+#include "sprite_batch.h"
 
 #define WINDOW_WIDTH		640
 #define WINDOW_HEIGHT		480
 
-#define TEX_WIDTH               512
-#define TEX_HEIGHT              512
-#define TEX_BACK_X              0
-#define TEX_BACK_Y              0
-#define TEX_BULLETS_X           256
-#define TEX_BULLETS_Y           0
-#define TEX_ASCII_X             0
-#define TEX_ASCII_Y             256
-#define TEX_PLAYER_X            TEX_BULLETS_X + 16
-#define TEX_PLAYER_Y            TEX_BULLETS_Y + 40
-#define TEX_ENEMY_X             TEX_BULLETS_X
-#define TEX_ENEMY_Y             TEX_BULLETS_Y + 72
+#define ATLAS_FILE		"images/atlas.bin"
+/* Sprites inside images/img.png */
+#define IMG_PLAYER_X            16
+#define IMG_PLAYER_Y            40
+#define IMG_ENEMY_X             0
+#define IMG_ENEMY_Y             72
 #define TEX_BACK_WIDTH          255
 #define TEX_BACK_HEIGHT         255
 #define TEX_PLAYER_WIDTH        31
@@ -59,7 +63,8 @@
 #define TEX_ENEMY_HEIGHT        63
 
 #define MAX_BULLETS     6000
-#define MAX_BUFFER      (MAX_BULLETS + 2) * 18	/* dim=3 x points=6 */
+#define MAX_SPRITES     (MAX_BULLETS + 2)
+#define PATTERN_FILE	"patterns/keroame.pat"
 
 struct player_t {
 	int x, y;
@@ -67,49 +72,30 @@ struct player_t {
 	int csx, csy, cex, cey;
 };
 
-struct enemy_bullet_t {
-	int type;
-	int flag;
-	int count;
-	int color;
-	int state;
-	int till;
-	double x, y, vx, vy;
-	double angle, speed, base_ang, rem_sp;
-};
-
 struct enemy_t {
 	int x, y;
 	int cw, ch;
 	int csx, csy, cex, cey;
-	struct enemy_bullet_t *bullets;
+	struct bullet_pool bullets;
+	struct thread_pool *threads;
+	struct bullet_pattern *pattern;
+	struct bullet_emitter emitter;
 };
 
 struct gl_info {
 	struct {
-		GLuint render_fbo;
 		GLuint render_screen;
 	} program;
 	struct {
-		struct {
-			GLuint position;
-			GLuint texcoord;
-			GLuint texture;
-			GLuint screen_size;
-			GLuint tex_size;
-		} fbo;
 		struct {
 			GLuint position;
 			GLuint texcoord;
 			GLuint texture;
 			GLuint rotation;
+			GLuint tex_scale;
 		} screen;
 	} sh_loc;
 	struct {
-		struct {
-			GLuint vertex;
-			GLuint texcoord;
-		} fbo;
 		struct {
 			GLuint vertex;
 			GLuint texcoord;
@@ -118,66 +104,51 @@ struct gl_info {
 	} buffer;
 	struct {
 		GLuint src;
-		GLuint fbo;
 	} texture;
-	GLuint fbo;
-	GLuint rb;
-};
-
-struct gl_buffer {
-	short *vertex_buffer;
-	short *texcoord_buffer;
-	int p_vertex_buffer;
-	int p_texcoord_buffer;
-	int vertex_count;
+	int tex_width, tex_height;
+	/* where images/back.png and img.png are in the atlas */
+	struct atlas_entry back, img;
+	struct render_target_pool targets;
+	struct render_graph graph;
+	struct post_chain post;
+	int post_output;
+	/* of the screen quad, position * rotation in the shader */
+	GLfloat rotation[4][4];
+	struct damage damage;
 };
 
 struct app {
 	struct player_t player;
 	struct enemy_t enemy;
 	struct gl_info gl;
-	struct gl_buffer buf;
+	struct sprite_batch sprites;
+	int sprite_back;
+	int sprite_state;
+	struct bullet_sprite_info bullet_sprites[BULLET_TYPE_COUNT];
+	struct bullet_quads bullet_quads;
+	struct sprite_vertex *quads;	/* 4 per bullet */
+	int n_quads;
+	const struct app_info *info;
 };
 
-#define TO_STRING(x)	#x
-static const char *fbo_vshader_code = TO_STRING(
-	attribute vec4 position;
-	attribute vec2 texcoord;
-	varying vec2 texcoordVarying;
-	uniform vec2 screenSize;
-	uniform vec2 texSize;
-	void main()
-	{
-		vec4 pos = position;
-		pos.x = pos.x / screenSize.x - (screenSize.x - pos.x) /
-			screenSize.x;
-		pos.y = pos.y / screenSize.y - (screenSize.y - pos.y) /
-			screenSize.y;
-		gl_Position = pos;
-		vec2 tex = texcoord;
-		tex.x = tex.x / texSize.x;
-		tex.y = tex.y / texSize.y;
-		texcoordVarying = tex;
-	});
-
-static const char *fbo_fshader_code = TO_STRING(
-	precision mediump float;
-	varying vec2 texcoordVarying;
-	uniform sampler2D texture;
-	void main()
-	{
-		gl_FragColor = texture2D(texture, texcoordVarying).bgra;
-	});
+/* Bullet sprites in images/img.png, one color after another along u */
+static const struct bullet_sprite_info img_bullets[BULLET_TYPE_COUNT] = {
+	[BULLET_TYPE_SMALL] = { 4, 4, 0, 0, 8, 8 },
+	[BULLET_TYPE_LARGE] = { 8, 8, 0, 8, 16, 16 },
+	[BULLET_TYPE_NEEDLE] = { 4, 8, 0, 24, 8, 16 },
+};
 
+#define TO_STRING(x)	#x
 static const char *vshader_code = TO_STRING(
 	attribute vec4 position;
 	attribute vec2 texcoord;
 	varying vec2 texcoordVarying;
 	uniform mat4 rotation;
+	uniform vec2 texScale;
 	void main()
 	{
 		gl_Position = position * rotation;
-		texcoordVarying = texcoord;
+		texcoordVarying = texcoord * texScale;
 	});
 
 static const char *fshader_code = TO_STRING(
@@ -192,58 +163,21 @@ static const char *fshader_code = TO_STRING(
 static void
 init_texture(struct gl_info *gl)
 {
-	cairo_surface_t *bg, *bullet, *ascii;
-	cairo_surface_t *img;
-	cairo_t *cr;
-	unsigned char *data;
-	GLuint texture;
-
-	bg = cairo_image_surface_create_from_png("images/back.png");
-	bullet = cairo_image_surface_create_from_png("images/img.png");
-	ascii = cairo_image_surface_create_from_png("images/ascii_num.png");
-
-	img = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
-					 TEX_WIDTH, TEX_HEIGHT);
-	cr = cairo_create(img);
-
-	cairo_set_source_surface(cr, bg, TEX_BACK_X, TEX_BACK_Y);
-	cairo_paint(cr);
-	cairo_set_source_surface(cr, bullet, TEX_BULLETS_X, TEX_BULLETS_Y);
-	cairo_paint(cr);
-	cairo_set_source_surface(cr, ascii, TEX_ASCII_X, TEX_ASCII_Y);
-	cairo_paint(cr);
-	cairo_surface_flush(img);
-	cairo_destroy(cr);
-
-	data = cairo_image_surface_get_data(img);
-	glGenTextures(1, &texture);
-	glBindTexture(GL_TEXTURE_2D, texture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, TEX_WIDTH, TEX_HEIGHT, 0,
-		     GL_RGBA, GL_UNSIGNED_BYTE, data);
-
-	cairo_surface_destroy(bg);
-	cairo_surface_destroy(bullet);
-	cairo_surface_destroy(ascii);
-	cairo_surface_destroy(img);
-
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
-	gl->texture.src = texture;
-
-	glGenTextures(1, &texture);
-	glBindTexture(GL_TEXTURE_2D, texture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, WINDOW_WIDTH, WINDOW_HEIGHT, 0,
-		     GL_RGBA, GL_UNSIGNED_BYTE, 0);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glBindTexture(GL_TEXTURE_2D, 0);
-
-	gl->texture.fbo = texture;
+	const struct atlas_entry *back, *img;
+	struct atlas atlas;
+	int ret;
+
+	ret = atlas_open_best(&atlas, ATLAS_FILE);
+	assert(ret == 0);
+	back = atlas_find(&atlas, "back");
+	img = atlas_find(&atlas, "img");
+	assert(back && img);
+	gl->back = *back;
+	gl->img = *img;
+	gl->tex_width = atlas.header->width;
+	gl->tex_height = atlas.header->height;
+	gl->texture.src = atlas_create_texture(&atlas);
+	atlas_close(&atlas);
 }
 
 static void
@@ -252,13 +186,6 @@ init_shader(struct gl_info *gl)
 	struct shader_info shader;
 	GLuint program;
 
-	memset(&shader, 0x0, sizeof(shader));
-	shader.vertex = fbo_vshader_code;
-	shader.fragment = fbo_fshader_code;
-	program = shader_build_program(&shader);
-	assert(program);
-	gl->program.render_fbo = program;
-
 	memset(&shader, 0x0, sizeof(shader));
 	shader.vertex = vshader_code;
 	shader.fragment = fshader_code;
@@ -266,19 +193,6 @@ init_shader(struct gl_info *gl)
 	assert(program);
 	gl->program.render_screen = program;
 
-	gl->sh_loc.fbo.position = glGetAttribLocation(gl->program.render_fbo,
-						      "position");
-	gl->sh_loc.fbo.texcoord = glGetAttribLocation(gl->program.render_fbo,
-						      "texcoord");
-	gl->sh_loc.fbo.texture = glGetUniformLocation(gl->program.render_fbo,
-						      "texture");
-	gl->sh_loc.fbo.screen_size
-		= glGetUniformLocation(gl->program.render_fbo, "screenSize");
-	gl->sh_loc.fbo.tex_size = glGetUniformLocation(gl->program.render_fbo,
-						       "texSize");
-	glEnableVertexAttribArray(gl->sh_loc.fbo.position);
-	glEnableVertexAttribArray(gl->sh_loc.fbo.texcoord);
-
 	gl->sh_loc.screen.position
 		= glGetAttribLocation(gl->program.render_screen, "position");
 	gl->sh_loc.screen.texcoord
@@ -287,27 +201,12 @@ init_shader(struct gl_info *gl)
 		= glGetUniformLocation(gl->program.render_screen, "texture");
 	gl->sh_loc.screen.rotation
 		= glGetUniformLocation(gl->program.render_screen, "rotation");
+	gl->sh_loc.screen.tex_scale
+		= glGetUniformLocation(gl->program.render_screen, "texScale");
 	glEnableVertexAttribArray(gl->sh_loc.screen.position);
 	glEnableVertexAttribArray(gl->sh_loc.screen.texcoord);
 }
 
-static void
-init_fbo(struct gl_info *gl)
-{
-	glGenFramebuffers(1, &gl->fbo);
-	glBindFramebuffer(GL_FRAMEBUFFER, gl->fbo);
-	glGenRenderbuffers(1, &gl->rb);
-	glBindRenderbuffer(GL_RENDERBUFFER, gl->rb);
-	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24,
-			      WINDOW_WIDTH, WINDOW_HEIGHT);
-	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
-				  GL_RENDERBUFFER, gl->rb);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-			       GL_TEXTURE_2D, gl->texture.fbo, 0);
-	glBindRenderbuffer(GL_RENDERBUFFER, 0);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-}
-
 static void
 init_buffer(struct gl_info *gl)
 {
@@ -327,8 +226,6 @@ init_buffer(struct gl_info *gl)
 		0, 1, 2, 0, 2, 3
 	};
 
-	glGenBuffers(1, &gl->buffer.fbo.vertex);
-	glGenBuffers(1, &gl->buffer.fbo.texcoord);
 
 	glGenBuffers(1, &gl->buffer.screen.vertex);
 	glBindBuffer(GL_ARRAY_BUFFER, gl->buffer.screen.vertex);
@@ -344,53 +241,33 @@ init_buffer(struct gl_info *gl)
 }
 
 static void
-init_gl_buffer(struct gl_buffer *buf)
+init_sprites(struct app *app)
 {
-	buf->vertex_buffer = malloc(MAX_BUFFER * sizeof(short));
-	assert(buf->vertex_buffer);
-	buf->texcoord_buffer = malloc(MAX_BUFFER * sizeof(short));
-	assert(buf->texcoord_buffer);
-}
-
-static void
-init_gl(void *data)
-{
-	struct app *app = data;
-	struct gl_info *gl = &app->gl;
-
-	init_texture(gl);
-	init_shader(gl);
-	init_fbo(gl);
-	init_buffer(gl);
-	init_gl_buffer(&app->buf);
-}
-
-static void
-deinit_gl_buffer(struct gl_buffer *buf)
-{
-	free(buf->vertex_buffer);
-	free(buf->texcoord_buffer);
-}
-
-static void
-deinit_gl(void *data)
-{
-	struct app *app = data;
-	struct gl_info *gl = &app->gl;
-
-	glDeleteBuffers(1, &gl->buffer.fbo.vertex);
-	glDeleteBuffers(1, &gl->buffer.fbo.texcoord);
-	glDeleteBuffers(1, &gl->buffer.screen.vertex);
-	glDeleteBuffers(1, &gl->buffer.screen.texcoord);
-	glDeleteBuffers(1, &gl->buffer.screen.index);
-	glDeleteTextures(1, &gl->texture.src);
-	glDeleteTextures(1, &gl->texture.fbo);
-	glDeleteFramebuffers(1, &gl->fbo);
-	glDeleteRenderbuffers(1, &gl->rb);
-	glDeleteProgram(gl->program.render_fbo);
-	glDeleteProgram(gl->program.render_screen);
+	struct sprite_state state = {
+		.blend = SPRITE_BLEND_NONE,
+		.texture = app->gl.texture.src,
+		.tex_width = app->gl.tex_width,
+		.tex_height = app->gl.tex_height,
+	};
+	int i, ret;
 
-	deinit_gl_buffer(&app->buf);
+	for (i = 0; i < BULLET_TYPE_COUNT; i++) {
+		app->bullet_sprites[i] = img_bullets[i];
+		app->bullet_sprites[i].u += app->gl.img.x;
+		app->bullet_sprites[i].v += app->gl.img.y;
+	}
+	bullet_quads_init(&app->bullet_quads, app->bullet_sprites);
+	app->quads = malloc(MAX_BULLETS * 4 * sizeof(*app->quads));
+	assert(app->quads);
+
+	ret = sprite_batch_init(&app->sprites, MAX_SPRITES);
+	assert(ret == 0);
+	/* the background is opaque, the rest is blended over it */
+	app->sprite_back = sprite_batch_add_state(&app->sprites, &state);
+	state.layer = 1;
+	state.blend = SPRITE_BLEND_ALPHA;
+	app->sprite_state = sprite_batch_add_state(&app->sprites, &state);
+	assert(app->sprite_back >= 0 && app->sprite_state >= 0);
 }
 
 static void
@@ -408,6 +285,10 @@ player_init(struct player_t *player, int w, int h)
 static void
 enemy_init(struct enemy_t *enemy, int w, int h)
 {
+	const struct bullet_motion *motions;
+	const struct bullet_program *program;
+	int n_motions, ret;
+
 	enemy->x = w / 2;
 	enemy->y = h * 8 / 10;
 	enemy->cw = enemy->ch = 96;
@@ -416,181 +297,88 @@ enemy_init(struct enemy_t *enemy, int w, int h)
 	enemy->cex = enemy->x + enemy->cw / 2;
 	enemy->cey = enemy->y + enemy->ch / 2;
 
-	enemy->bullets = calloc(1, MAX_BULLETS * sizeof(struct enemy_bullet_t));
-	assert(enemy->bullets);
-}
+	enemy->pattern = bullet_pattern_load(PATTERN_FILE);
+	assert(enemy->pattern);
+	motions = bullet_pattern_motions(enemy->pattern, &n_motions);
+	ret = bullet_pool_init(&enemy->bullets, MAX_BULLETS, motions,
+			       n_motions);
+	assert(ret == 0);
 
-static void
-enemy_deinit(struct enemy_t *enemy)
-{
-	free(enemy->bullets);
-}
+	program = bullet_pattern_find(enemy->pattern, "keroame_fbo");
+	assert(program);
+	bullet_emitter_init(&enemy->emitter, program, enemy->x, enemy->y, 1);
 
-static void
-bullet_move(struct enemy_bullet_t *bullet)
-{
-	bullet->x += cos(bullet->angle) * bullet->speed;
-	bullet->y += sin(bullet->angle) * bullet->speed;
-	bullet->count++;
+	enemy->threads = thread_pool_create(0);
+	assert(enemy->threads);
+	bullet_pool_set_threads(&enemy->bullets, enemy->threads);
 }
 
 static void
-bullet_move_with_vec(struct enemy_bullet_t* bullet)
-{
-	bullet->x += bullet->vx;
-	bullet->y += bullet->vy;
-}
-
-static int
-bullet_is_out(struct enemy_bullet_t* bullet, int w, int h)
-{
-	if (bullet->x < -40 || w + 40 < bullet->x ||
-	    bullet->y < -40 || h + 40 < bullet->y) {
-		if (bullet->till < bullet->count)
-			return 1;
-	}
-	return 0;
-}
-
-static void
-bullet_calc(struct enemy_bullet_t *bullets, int w, int h)
+enemy_deinit(struct enemy_t *enemy)
 {
-	int i;
-	for (i = 0; i < MAX_BULLETS; i++) {
-		if (!bullets[i].flag)
-			continue;
-		bullet_move(&bullets[i]);
-		if (bullet_is_out(&bullets[i], w, h))
-			bullets[i].flag = 0;
-	}
+	bullet_pool_fini(&enemy->bullets);
+	thread_pool_destroy(enemy->threads);
+	bullet_pattern_destroy(enemy->pattern);
 }
 
+/* Called from the workers of the pool, each word writing its own range */
 static void
-bullet_init(struct enemy_bullet_t *bullet, int tp, int col, double x,
-                 double y, double ang, double sp)
+emit_bullets(void *data, const struct bullet_bucket *b, int word,
+	     uint64_t visible, int first)
 {
-	bullet->type = tp;
-	bullet->color = col;
-	bullet->x = x;
-	bullet->y = y;
-	bullet->angle = ang;
-	bullet->speed = sp;
-	bullet->count = 0;
-}
+	struct app *app = data;
+	int16_t *quads = (int16_t *)&app->quads[first * 4];
 
-static int
-enemy_usable_bullet(struct enemy_bullet_t* bullets)
-{
-	int i;
-	for (i = 0; i < MAX_BULLETS; i++) {
-		if (bullets[i].flag == 0)
-			return i;
-	}
-	return -1;
+	if (first < MAX_BULLETS)
+		bullet_quads_emit(&app->bullet_quads, quads,
+				  MAX_BULLETS - first, b, word, visible);
 }
 
 static void
-spel_keroame(struct enemy_t* enemy)
+enemy_main(struct enemy_t *enemy, struct app *app, int w, int h)
 {
-	struct enemy_bullet_t *bullets = enemy->bullets;
-	static int keroameTim;
-	static int spelCount = 0;
-	double ang;
-	int t, n, i, k;
-
-	t = spelCount % 20;
-	if (t == 0)
-		keroameTim = 190 + rand() % 30 - 15;
-	if (spelCount % 4 == 0) {
-		ang = M_PI * 1.5 + M_PI / 6.0 *
-			sin(M_PI * 2 / keroameTim * spelCount);
-		for (n = 0; n < 8; n++) {
-			int k = enemy_usable_bullet(bullets);
-			if (k < 0)
-				continue;
-			bullet_init(&bullets[k], 1, 4, enemy->x, enemy->y,
-				    0, 0);
-			bullets[k].flag = 1;
-			bullets[k].vx = cos(ang - M_PI / 8.0 * 4.0 +
-					    M_PI / 8.0 * n + M_PI / 16.0) * 3.0;
-			bullets[k].vy = -sin(ang - M_PI / 8.0 * 4.0 + M_PI /
-					     8.0 * n + M_PI / 16.0) * 3.0;
-			bullets[k].till = 150;
-		}
-	}
-	if (spelCount > 80) {
-		for (i = 0; i < 3; i++) {
-			ang = (rand() % 270 - 45) * M_PI / 180.0;
-			k = enemy_usable_bullet(bullets);
-			if (k < 0)
-				continue;
-			bullet_init(&bullets[k], 2, 4, enemy->x, enemy->y,
-				    0, 0);
-			bullets[k].flag = 1;
-			bullets[k].state = 1;
-			bullets[k].vx = cos(ang) * 1.4 * 1.2;
-			bullets[k].vy = -sin(ang) * 1.4;
-		}
-	}
-	for (i = 0; i < MAX_BULLETS; i++) {
-		double vy;
-		if (!bullets[i].flag)
-			continue;
-		vy = bullets[i].vy;
-		if (bullets[i].state == 0) {
-			if (bullets[i].count < 150)
-				bullets[i].vy -= 0.04;
-			bullet_move_with_vec(&bullets[i]);
-		} else if (bullets[i].state == 1) {
-			if (bullets[i].count < 160)
-				bullets[i].vy -= 0.03;
-			bullet_move_with_vec(&bullets[i]);
-			bullets[i].angle = -atan2(-vy + 0.03, bullets[i].vx);
-		}
-	}
-	spelCount++;
-}
+	int n;
 
-static void
-enemy_main(struct enemy_t *enemy, int w, int h)
-{
-	spel_keroame(enemy);
-	bullet_calc(enemy->bullets, w, h);
+	bullet_emitter_step(&enemy->emitter, &enemy->bullets);
+	n = bullet_pool_update_emit_at(&enemy->bullets, w, h, emit_bullets,
+				       app);
+	app->n_quads = n < MAX_BULLETS ? n : MAX_BULLETS;
 }
 
+/* The sprites, drawn into the scene target */
 static void
-add_vertex(struct gl_buffer *buf, int vx, int vy, int uvx, int uvy)
+draw_scene(void *data, struct render_graph *graph)
 {
-	buf->vertex_buffer[buf->p_vertex_buffer] = vx;
-	buf->p_vertex_buffer++;
-	buf->vertex_buffer[buf->p_vertex_buffer] = vy;
-	buf->p_vertex_buffer++;
-	buf->vertex_buffer[buf->p_vertex_buffer] = 0;
-	buf->p_vertex_buffer++;
-	buf->texcoord_buffer[buf->p_texcoord_buffer] = uvx;
-	buf->p_texcoord_buffer++;
-	buf->texcoord_buffer[buf->p_texcoord_buffer] = uvy;
-	buf->p_texcoord_buffer++;
-	buf->vertex_count++;
-}
+	struct app *app = data;
+	struct gl_info *gl = &app->gl;
 
-static void
-add_rect_vertex(struct gl_buffer *buf, int tlx, int tly, int brx, int bry,
-		int tluvx, int tluvy, int bruvx, int bruvy)
-{
-	add_vertex(buf, tlx, bry, tluvx, tluvy);
-	add_vertex(buf, brx, bry, bruvx, tluvy);
-	add_vertex(buf, tlx, tly, tluvx, bruvy);
-	add_vertex(buf, brx, bry, bruvx, tluvy);
-	add_vertex(buf, tlx, tly, tluvx, bruvy);
-	add_vertex(buf, brx, tly, bruvx, bruvy);
+	glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	sprite_batch_begin(&app->sprites, WINDOW_WIDTH, WINDOW_HEIGHT);
+	sprite_batch_add(&app->sprites, app->sprite_back, 0, 0, WINDOW_WIDTH,
+			 WINDOW_HEIGHT, gl->back.x, gl->back.y,
+			 gl->back.x + TEX_BACK_WIDTH,
+			 gl->back.y + TEX_BACK_HEIGHT);
+	sprite_batch_add(&app->sprites, app->sprite_state, app->player.csx,
+			 app->player.csy, app->player.cex, app->player.cey,
+			 gl->img.x + IMG_PLAYER_X, gl->img.y + IMG_PLAYER_Y,
+			 gl->img.x + IMG_PLAYER_X + TEX_PLAYER_WIDTH,
+			 gl->img.y + IMG_PLAYER_Y + TEX_PLAYER_HEIGHT);
+	sprite_batch_add(&app->sprites, app->sprite_state, app->enemy.csx,
+			 app->enemy.csy, app->enemy.cex, app->enemy.cey,
+			 gl->img.x + IMG_ENEMY_X, gl->img.y + IMG_ENEMY_Y,
+			 gl->img.x + IMG_ENEMY_X + TEX_ENEMY_WIDTH,
+			 gl->img.y + IMG_ENEMY_Y + TEX_ENEMY_HEIGHT);
+
+	sprite_batch_add_quads(&app->sprites, app->sprite_state, app->quads,
+			       app->n_quads);
+	sprite_batch_end(&app->sprites);
 }
 
 static void
-redraw(void *data, struct rect *damage)
+update_rotation(struct gl_info *gl)
 {
-	struct app *app = data;
-	struct gl_info *gl = &app->gl;
 	GLfloat angle;
 	GLfloat rotation[4][4] = {
 		{1, 0, 0, 0},
@@ -602,105 +390,6 @@ redraw(void *data, struct rect *damage)
 	struct timeval tv;
 	uint32_t time;
 
-	int vsx, vsy, vex, vey, usx, usy, uex, uey;
-	struct enemy_bullet_t *bullets = app->enemy.bullets;
-	int i;
-
-	enemy_main(&app->enemy, WINDOW_WIDTH, WINDOW_HEIGHT);
-
-	app->buf.vertex_count = app->buf.p_vertex_buffer
-		= app->buf.p_texcoord_buffer = 0;
-
-	add_rect_vertex(&app->buf, 0, 0, WINDOW_WIDTH,
-			WINDOW_HEIGHT,
-			TEX_BACK_X, TEX_BACK_Y, TEX_BACK_WIDTH,
-			TEX_BACK_HEIGHT);
-	add_rect_vertex(&app->buf, app->player.csx, app->player.csy,
-			app->player.cex, app->player.cey,
-			TEX_PLAYER_X, TEX_PLAYER_Y,
-			TEX_PLAYER_X + TEX_PLAYER_WIDTH,
-			TEX_PLAYER_Y + TEX_PLAYER_HEIGHT);
-	add_rect_vertex(&app->buf, app->enemy.csx, app->enemy.csy,
-			app->enemy.cex, app->enemy.cey,
-			TEX_ENEMY_X, TEX_ENEMY_Y, TEX_ENEMY_X + TEX_ENEMY_WIDTH,
-			TEX_ENEMY_Y + TEX_ENEMY_HEIGHT);
-
-	for (i = 0; i < MAX_BULLETS; i++) {
-		if (!bullets[i].flag)
-			continue;
-		vsx = vsy = vex = vey = usx = usy = uex = uey = 0;
-		switch (bullets[i].type) {
-		case 0:
-			vsx = (int) (bullets[i].x - 4);
-			vsy = (int) (bullets[i].y - 4);
-			vex = (int) (bullets[i].x + 4);
-			vey = (int) (bullets[i].y + 4);
-			usx = TEX_BULLETS_X + bullets[i].color * 8;
-			usy = TEX_BULLETS_Y;
-			uex = usx + 8;
-			uey = 8;
-			break;
-		case 1:
-			vsx = (int) (bullets[i].x - 8);
-			vsy = (int) (bullets[i].y - 8);
-			vex = (int) (bullets[i].x + 8);
-			vey = (int) (bullets[i].y + 8);
-			usx = TEX_BULLETS_X + bullets[i].color * 16;
-			usy = TEX_BULLETS_Y + 8;
-			uex = usx + 16;
-			uey = usy + 16;
-			break;
-		case 2:
-			vsx = (int) (bullets[i].x - 4);
-			vsy = (int) (bullets[i].y - 8);
-			vex = (int) (bullets[i].x + 4);
-			vey = (int) (bullets[i].y + 8);
-			usx = TEX_BULLETS_X + bullets[i].color * 8;
-			usy = TEX_BULLETS_Y + 8 + 16;
-			uex = usx + 8;
-			uey = usy + 16;
-			break;
-		}
-		add_rect_vertex(&app->buf, vsx, vsy, vex, vey, usx, usy, uex,
-				uey);
-	}
-
-	glViewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
-
-	//draw to FBO
-	glUseProgram(gl->program.render_fbo);
-	glBindFramebuffer(GL_FRAMEBUFFER, gl->fbo);
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
-	glClear(GL_COLOR_BUFFER_BIT);
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, gl->texture.src);
-	glUniform1i(gl->sh_loc.fbo.texture, 0);
-	glUniform2f(gl->sh_loc.fbo.screen_size,
-		    WINDOW_WIDTH, WINDOW_HEIGHT);
-	glUniform2f(gl->sh_loc.fbo.tex_size, TEX_WIDTH, TEX_HEIGHT);
-	glBindBuffer(GL_ARRAY_BUFFER, gl->buffer.fbo.vertex);
-	glBufferData(GL_ARRAY_BUFFER,
-		     sizeof(GLshort) * app->buf.p_vertex_buffer,
-		     app->buf.vertex_buffer, GL_STATIC_DRAW);
-	glVertexAttribPointer(gl->sh_loc.fbo.position, 3, GL_SHORT,
-			      GL_FALSE, 0, 0);
-	glBindBuffer(GL_ARRAY_BUFFER, gl->buffer.fbo.texcoord);
-	glBufferData(GL_ARRAY_BUFFER,
-		     sizeof(GLshort) * app->buf.p_texcoord_buffer,
-		     app->buf.texcoord_buffer, GL_STATIC_DRAW);
-	glVertexAttribPointer(gl->sh_loc.fbo.texcoord, 2, GL_SHORT,
-			      GL_FALSE, 0, 0);
-	glDrawArrays(GL_TRIANGLES, 0, app->buf.vertex_count);
-
-	//draw to Screen
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	glUseProgram(gl->program.render_screen);
-	glDisable(GL_BLEND);
-	glClearColor(0.0, 0.0, 0.0, 0.5);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
 	gettimeofday(&tv, NULL);
 	time = tv.tv_sec * 1000 + tv.tv_usec / 1000;
 	angle = (time / speed_div) % 360 * M_PI / 180.0;
@@ -708,25 +397,136 @@ redraw(void *data, struct rect *damage)
 	rotation[0][2] = sin(angle);
 	rotation[2][0] = -sin(angle);
 	rotation[2][2] = cos(angle);
+	memcpy(gl->rotation, rotation, sizeof(rotation));
+}
+
+/* The post-processed scene, rotating in the middle of the window */
+static void
+draw_screen(void *data, struct render_graph *graph)
+{
+	struct gl_info *gl = data;
+	const struct render_target *scene;
+
+	gl_state_use_program(gl->program.render_screen);
+	gl_state_disable(GL_BLEND);
+	glClearColor(0.0, 0.0, 0.0, 0.5);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
 	glUniformMatrix4fv(gl->sh_loc.screen.rotation, 1, GL_FALSE,
-			   (GLfloat *)rotation);
+			   (GLfloat *)gl->rotation);
 
-	glBindTexture(GL_TEXTURE_2D, gl->texture.fbo);
+	scene = render_graph_target(graph, gl->post_output);
+	gl_state_active_texture(GL_TEXTURE0);
+	gl_state_bind_texture(GL_TEXTURE_2D, scene->color);
 	glUniform1i(gl->sh_loc.screen.texture, 0);
-	glBindBuffer(GL_ARRAY_BUFFER, gl->buffer.screen.vertex);
-	glVertexAttribPointer(gl->sh_loc.screen.position, 4, GL_FLOAT,
-			      GL_FALSE, 0, 0);
-	glBindBuffer(GL_ARRAY_BUFFER, gl->buffer.screen.texcoord);
-	glVertexAttribPointer(gl->sh_loc.screen.texcoord, 2, GL_FLOAT,
-			      GL_FALSE, 0, 0);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gl->buffer.screen.index);
+	glUniform2f(gl->sh_loc.screen.tex_scale,
+		    (float)scene->view_width / scene->width,
+		    (float)scene->view_height / scene->height);
+	gl_state_bind_buffer(GL_ARRAY_BUFFER, gl->buffer.screen.vertex);
+	gl_state_vertex_attrib_pointer(gl->sh_loc.screen.position, 4,
+				       GL_FLOAT, GL_FALSE, 0, 0);
+	gl_state_bind_buffer(GL_ARRAY_BUFFER, gl->buffer.screen.texcoord);
+	gl_state_vertex_attrib_pointer(gl->sh_loc.screen.texcoord, 2,
+				       GL_FLOAT, GL_FALSE, 0, 0);
+	gl_state_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, gl->buffer.screen.index);
 	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+}
+
+/*
+ * The scene covers 8/10 of the window, so is drawn at that size, and
+ * post-processed at that size before being rotated onto the window
+ */
+static void
+init_graph(struct app *app)
+{
+	struct gl_info *gl = &app->gl;
+	struct render_graph *graph = &gl->graph;
+	int scene, back, pass, ret;
+
+	render_graph_init(graph, &gl->targets);
+	scene = render_graph_add_target(graph, "scene", GL_RGBA8, 8, 10);
+	gl->post_output = render_graph_add_target(graph, "post", GL_RGBA8, 8,
+						  10);
+	back = render_graph_add_backbuffer(graph);
+
+	pass = render_graph_add_pass(graph, RENDER_PASS_DRAW, "scene",
+				     draw_scene, app);
+	render_graph_write(graph, pass, scene, RENDER_ACCESS_COLOR);
+
+	ret = post_chain_add(&gl->post, graph, POST_EFFECTS, scene,
+			     gl->post_output);
+	assert(ret == 0);
+
+	pass = render_graph_add_pass(graph, RENDER_PASS_DRAW, "screen",
+				     draw_screen, gl);
+	render_graph_read(graph, pass, gl->post_output,
+			  RENDER_ACCESS_TEXTURE);
+	render_graph_write(graph, pass, back, RENDER_ACCESS_COLOR);
+
+	render_graph_compile(graph);
+}
+
+static void
+init_gl(void *data)
+{
+	struct app *app = data;
+	struct gl_info *gl = &app->gl;
+	int ret;
 
-	/* return damage region */
-	damage->x = WINDOW_WIDTH / 10;
-	damage->y = WINDOW_HEIGHT / 10;
-	damage->width = WINDOW_WIDTH * 8 / 10;
-	damage->height = WINDOW_HEIGHT * 8 / 10;
+	init_texture(gl);
+	init_shader(gl);
+	render_target_pool_init(&gl->targets);
+	init_buffer(gl);
+	init_sprites(app);
+	ret = post_chain_init(&gl->post);
+	assert(ret == 0);
+	init_graph(app);
+	damage_init(&gl->damage);
+}
+
+static void
+deinit_gl(void *data)
+{
+	struct app *app = data;
+	struct gl_info *gl = &app->gl;
+
+	gl_state_delete_buffers(1, &gl->buffer.screen.vertex);
+	gl_state_delete_buffers(1, &gl->buffer.screen.texcoord);
+	gl_state_delete_buffers(1, &gl->buffer.screen.index);
+	gl_state_delete_textures(1, &gl->texture.src);
+	post_chain_fini(&gl->post);
+	render_target_pool_fini(&gl->targets);
+	glDeleteProgram(gl->program.render_screen);
+
+	sprite_batch_fini(&app->sprites);
+	free(app->quads);
+}
+
+static void
+redraw(void *data, struct rect *damage)
+{
+	struct app *app = data;
+	struct gl_info *gl = &app->gl;
+	int width = app->info->buffer_width;
+	int height = app->info->buffer_height;
+	static const GLfloat quad_min[3] = { -0.8, -0.8, 0 };
+	static const GLfloat quad_max[3] = { 0.8, 0.8, 0 };
+	GLfloat m[4][4];
+	struct rect rect;
+	int i, j;
+
+	/* the passes only draw what is simulated here */
+	enemy_main(&app->enemy, app, WINDOW_WIDTH, WINDOW_HEIGHT);
+	update_rotation(gl);
+	render_graph_execute(&gl->graph, width, height);
+
+	/* return damage region, where the quad is and was */
+	for (i = 0; i < 4; i++) {
+		for (j = 0; j < 4; j++)
+			m[i][j] = gl->rotation[j][i];
+	}
+	damage_project_box(m, quad_min, quad_max, width, height, &rect);
+	damage_update(&gl->damage, &rect, width, height, damage);
 }
 
 int
@@ -746,6 +546,7 @@ main(int argc, char **argv)
 		},
 	};
 
+	app.info = &info;
 	player_init(&app.player, WINDOW_WIDTH, WINDOW_HEIGHT);
 	enemy_init(&app.enemy, WINDOW_WIDTH, WINDOW_HEIGHT);
 
@@ -0,0 +1,418 @@
+/*
+ * Copyright © 2022 IGEL Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *    Tomohito Esaki <etom@igel.co.jp>
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <GLES3/gl31.h>
+
+#include "gl_state.h"
+
+#define MAX_TEXTURE_UNITS	8
+#define MAX_VERTEX_ATTRIBS	16
+
+#define ARRAY_LENGTH(a) (sizeof (a) / sizeof (a)[0])
+
+struct cached {
+	bool valid;
+	GLuint value;
+};
+
+struct attrib_pointer {
+	bool valid;
+	bool integer;
+	GLuint buffer;
+	GLint size;
+	GLenum type;
+	GLboolean normalized;
+	GLsizei stride;
+	const void *pointer;
+};
+
+static const GLenum tracked_caps[] = {
+	GL_BLEND,
+	GL_DEPTH_TEST,
+	GL_CULL_FACE,
+	GL_SCISSOR_TEST,
+	GL_STENCIL_TEST,
+};
+
+static const GLenum tracked_buffers[] = {
+	GL_ARRAY_BUFFER,
+	GL_ELEMENT_ARRAY_BUFFER,
+	GL_UNIFORM_BUFFER,
+	GL_SHADER_STORAGE_BUFFER,
+};
+
+static struct {
+	struct cached program;
+	struct cached vertex_array;
+	struct cached draw_fbo;
+	struct cached read_fbo;
+	struct cached caps[ARRAY_LENGTH(tracked_caps)];
+	struct {
+		bool valid;
+		GLenum sfactor;
+		GLenum dfactor;
+	} blend_func;
+	struct cached active_texture;
+	struct cached texture_2d[MAX_TEXTURE_UNITS];
+	struct cached buffers[ARRAY_LENGTH(tracked_buffers)];
+	struct attrib_pointer attribs[MAX_VERTEX_ATTRIBS];
+
+	struct gl_state_stats frame;
+	struct gl_state_stats last;
+} state;
+
+static int
+find_index(const GLenum *list, int n, GLenum value)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (list[i] == value)
+			return i;
+	}
+	return -1;
+}
+
+/* Returns true if the call has to reach the driver and updates the cache */
+static bool
+update(struct cached *c, GLuint value)
+{
+	if (c && c->valid && c->value == value) {
+		state.frame.elided++;
+		return false;
+	}
+
+	if (c) {
+		c->valid = true;
+		c->value = value;
+	}
+	state.frame.issued++;
+	return true;
+}
+
+void
+gl_state_invalidate(void)
+{
+	struct gl_state_stats frame = state.frame, last = state.last;
+
+	memset(&state, 0, sizeof(state));
+	state.frame = frame;
+	state.last = last;
+}
+
+void
+gl_state_use_program(GLuint program)
+{
+	if (update(&state.program, program))
+		glUseProgram(program);
+}
+
+void
+gl_state_bind_framebuffer(GLenum target, GLuint framebuffer)
+{
+	switch (target) {
+	case GL_FRAMEBUFFER:
+		if (state.draw_fbo.valid && state.draw_fbo.value == framebuffer &&
+		    state.read_fbo.valid && state.read_fbo.value == framebuffer) {
+			state.frame.elided++;
+			return;
+		}
+		state.draw_fbo.valid = state.read_fbo.valid = true;
+		state.draw_fbo.value = state.read_fbo.value = framebuffer;
+		state.frame.issued++;
+		break;
+	case GL_DRAW_FRAMEBUFFER:
+		if (!update(&state.draw_fbo, framebuffer))
+			return;
+		break;
+	case GL_READ_FRAMEBUFFER:
+		if (!update(&state.read_fbo, framebuffer))
+			return;
+		break;
+	default:
+		update(NULL, framebuffer);
+		break;
+	}
+
+	glBindFramebuffer(target, framebuffer);
+}
+
+static struct cached *
+cap_cache(GLenum cap)
+{
+	int i = find_index(tracked_caps, ARRAY_LENGTH(tracked_caps), cap);
+
+	return i < 0 ? NULL : &state.caps[i];
+}
+
+void
+gl_state_enable(GLenum cap)
+{
+	if (update(cap_cache(cap), GL_TRUE))
+		glEnable(cap);
+}
+
+void
+gl_state_disable(GLenum cap)
+{
+	if (update(cap_cache(cap), GL_FALSE))
+		glDisable(cap);
+}
+
+void
+gl_state_blend_func(GLenum sfactor, GLenum dfactor)
+{
+	if (state.blend_func.valid && state.blend_func.sfactor == sfactor &&
+	    state.blend_func.dfactor == dfactor) {
+		state.frame.elided++;
+		return;
+	}
+
+	state.blend_func.valid = true;
+	state.blend_func.sfactor = sfactor;
+	state.blend_func.dfactor = dfactor;
+	state.frame.issued++;
+	glBlendFunc(sfactor, dfactor);
+}
+
+void
+gl_state_active_texture(GLenum texture)
+{
+	if (update(&state.active_texture, texture))
+		glActiveTexture(texture);
+}
+
+void
+gl_state_bind_texture(GLenum target, GLuint texture)
+{
+	struct cached *c = NULL;
+	GLuint unit = state.active_texture.value - GL_TEXTURE0;
+
+	/* binding to an unknown unit can't be recorded */
+	if (target == GL_TEXTURE_2D && state.active_texture.valid &&
+	    unit < MAX_TEXTURE_UNITS)
+		c = &state.texture_2d[unit];
+
+	if (update(c, texture))
+		glBindTexture(target, texture);
+}
+
+void
+gl_state_bind_buffer(GLenum target, GLuint buffer)
+{
+	struct cached *c = NULL;
+	int i;
+
+	i = find_index(tracked_buffers, ARRAY_LENGTH(tracked_buffers), target);
+	if (i >= 0)
+		c = &state.buffers[i];
+
+	if (update(c, buffer))
+		glBindBuffer(target, buffer);
+}
+
+static void
+attrib_pointer(GLuint index, GLint size, GLenum type, bool integer,
+	       GLboolean normalized, GLsizei stride, const void *pointer)
+{
+	struct cached *array_buffer = &state.buffers[0];
+	struct attrib_pointer *a = NULL;
+
+	if (index < MAX_VERTEX_ATTRIBS && array_buffer->valid)
+		a = &state.attribs[index];
+
+	if (a && a->valid && a->integer == integer &&
+	    a->buffer == array_buffer->value && a->size == size &&
+	    a->type == type && a->normalized == normalized &&
+	    a->stride == stride && a->pointer == pointer) {
+		state.frame.elided++;
+		return;
+	}
+
+	if (a) {
+		a->valid = true;
+		a->integer = integer;
+		a->buffer = array_buffer->value;
+		a->size = size;
+		a->type = type;
+		a->normalized = normalized;
+		a->stride = stride;
+		a->pointer = pointer;
+	}
+	state.frame.issued++;
+	if (integer)
+		glVertexAttribIPointer(index, size, type, stride, pointer);
+	else
+		glVertexAttribPointer(index, size, type, normalized, stride,
+				      pointer);
+}
+
+void
+gl_state_vertex_attrib_pointer(GLuint index, GLint size, GLenum type,
+			       GLboolean normalized, GLsizei stride,
+			       const void *pointer)
+{
+	attrib_pointer(index, size, type, false, normalized, stride, pointer);
+}
+
+void
+gl_state_vertex_attrib_ipointer(GLuint index, GLint size, GLenum type,
+				GLsizei stride, const void *pointer)
+{
+	attrib_pointer(index, size, type, true, GL_FALSE, stride, pointer);
+}
+
+/* The element buffer and attribute pointers belong to the bound VAO */
+static void
+forget_vertex_array_state(void)
+{
+	int i;
+
+	state.buffers[1].valid = false;
+	for (i = 0; i < MAX_VERTEX_ATTRIBS; i++)
+		state.attribs[i].valid = false;
+}
+
+void
+gl_state_bind_vertex_array(GLuint array)
+{
+	if (!update(&state.vertex_array, array))
+		return;
+
+	forget_vertex_array_state();
+	glBindVertexArray(array);
+}
+
+void
+gl_state_bind_buffer_base(GLenum target, GLuint index, GLuint buffer)
+{
+	int i;
+
+	/* also binds the generic target; the indexed one isn't tracked */
+	i = find_index(tracked_buffers, ARRAY_LENGTH(tracked_buffers), target);
+	if (i >= 0) {
+		state.buffers[i].valid = true;
+		state.buffers[i].value = buffer;
+	}
+	state.frame.issued++;
+	glBindBufferBase(target, index, buffer);
+}
+
+/* A deleted name bound in c reverts to 0, as it does in GL */
+static void
+forget(struct cached *c, GLuint name)
+{
+	if (c->valid && c->value == name)
+		c->value = 0;
+}
+
+void
+gl_state_delete_textures(GLsizei n, const GLuint *textures)
+{
+	int i, unit;
+
+	for (i = 0; i < n; i++) {
+		for (unit = 0; unit < MAX_TEXTURE_UNITS; unit++)
+			forget(&state.texture_2d[unit], textures[i]);
+	}
+	glDeleteTextures(n, textures);
+}
+
+void
+gl_state_delete_buffers(GLsizei n, const GLuint *buffers)
+{
+	int i, j;
+
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < (int)ARRAY_LENGTH(tracked_buffers); j++)
+			forget(&state.buffers[j], buffers[i]);
+		/* attributes fetching from it are unbound too */
+		for (j = 0; j < MAX_VERTEX_ATTRIBS; j++) {
+			if (state.attribs[j].buffer == buffers[i])
+				state.attribs[j].valid = false;
+		}
+	}
+	glDeleteBuffers(n, buffers);
+}
+
+void
+gl_state_delete_program(GLuint program)
+{
+	/* deletion waits until it is no longer current; drop it now */
+	if (program && state.program.valid && state.program.value == program)
+		gl_state_use_program(0);
+	glDeleteProgram(program);
+}
+
+void
+gl_state_delete_vertex_arrays(GLsizei n, const GLuint *arrays)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (state.vertex_array.valid &&
+		    state.vertex_array.value == arrays[i]) {
+			state.vertex_array.value = 0;
+			forget_vertex_array_state();
+		}
+	}
+	glDeleteVertexArrays(n, arrays);
+}
+
+void
+gl_state_delete_framebuffers(GLsizei n, const GLuint *framebuffers)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		forget(&state.draw_fbo, framebuffers[i]);
+		forget(&state.read_fbo, framebuffers[i]);
+	}
+	glDeleteFramebuffers(n, framebuffers);
+}
+
+void
+gl_state_end_frame(void)
+{
+#ifdef DEBUG
+	if (state.frame.issued != state.last.issued ||
+	    state.frame.elided != state.last.elided)
+		fprintf(stderr, "gl state: %u calls issued, %u elided\n",
+			state.frame.issued, state.frame.elided);
+#endif
+	state.last = state.frame;
+	state.frame.issued = state.frame.elided = 0;
+}
+
+void
+gl_state_get_stats(struct gl_state_stats *stats)
+{
+	*stats = state.last;
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright © 2022 IGEL Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *    Tomohito Esaki <etom@igel.co.jp>
+ */
+
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+/*
+ * Thin GL state cache.
+ *
+ * Samples issue per-frame state changes through these wrappers instead of
+ * calling GL directly. A call whose value matches the cached one is dropped
+ * before it reaches the driver. The cache only knows about changes made
+ * through the wrappers, so call gl_state_invalidate() after touching the
+ * same state with raw GL calls (e.g. in init_gl()).
+ *
+ * GL unbinds a deleted object, and a later glGen*() may hand out its name
+ * again, so a cached name outliving its object would drop the bind of the
+ * new one. Objects that may be cached are deleted through
+ * gl_state_delete_*() instead of glDelete*().
+ *
+ * GL_ELEMENT_ARRAY_BUFFER and the vertex attribute pointers belong to the
+ * bound vertex array object, so they are forgotten whenever
+ * gl_state_bind_vertex_array() switches to another one.
+ */
+
+struct gl_state_stats {
+	unsigned int issued;
+	unsigned int elided;
+};
+
+void gl_state_invalidate(void);
+
+void gl_state_use_program(GLuint program);
+void gl_state_bind_framebuffer(GLenum target, GLuint framebuffer);
+void gl_state_enable(GLenum cap);
+void gl_state_disable(GLenum cap);
+void gl_state_blend_func(GLenum sfactor, GLenum dfactor);
+void gl_state_active_texture(GLenum texture);
+void gl_state_bind_texture(GLenum target, GLuint texture);
+void gl_state_bind_buffer(GLenum target, GLuint buffer);
+void gl_state_vertex_attrib_pointer(GLuint index, GLint size, GLenum type,
+				    GLboolean normalized, GLsizei stride,
+				    const void *pointer);
+/* The ES 3.0 entry points below need a context of that version */
+void gl_state_vertex_attrib_ipointer(GLuint index, GLint size, GLenum type,
+				     GLsizei stride, const void *pointer);
+void gl_state_bind_vertex_array(GLuint array);
+void gl_state_bind_buffer_base(GLenum target, GLuint index, GLuint buffer);
+
+void gl_state_delete_textures(GLsizei n, const GLuint *textures);
+void gl_state_delete_buffers(GLsizei n, const GLuint *buffers);
+void gl_state_delete_program(GLuint program);
+void gl_state_delete_vertex_arrays(GLsizei n, const GLuint *arrays);
+void gl_state_delete_framebuffers(GLsizei n, const GLuint *framebuffers);
+
+/* Close the current frame's counters; called by app_main() after redraw. */
+void gl_state_end_frame(void);
+/* Counters of the last completed frame. */
+void gl_state_get_stats(struct gl_state_stats *stats);
+
+#endif
@@ -0,0 +1,215 @@
+/*
+ * Copyright © 2022 IGEL Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *    Tomohito Esaki <etom@igel.co.jp>
+ */
+/*
+ * Cost of each post-processing effect at 720p and 1080p.
+ *
+ * Every configuration runs the post chain over a cleared scene target
+ * into the window for PHASE_FRAMES frames at each size, and only the GPU
+ * time of the frame is counted: glFinish() before and after. The first
+ * WARMUP_FRAMES of a phase allocate targets and build shaders and are
+ * not counted; the targets are freed when the phase ends. Effects are
+ * reported as the time they add to a plain copy of the scene, "fused"
+ * and "separate" being all of them in one pass or one pass each.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+
+#include <GLES3/gl3.h>
+
+#include "gl_state.h"
+#include "render_target.h"
+#include "render_graph.h"
+#include "post_chain.h"
+#include "common.h"
+
+#define WINDOW_WIDTH		1920
+#define WINDOW_HEIGHT		1080
+#define PHASE_FRAMES		120
+#define WARMUP_FRAMES		10
+
+static const struct config {
+	const char *name;
+	unsigned int effects;
+} configs[] = {
+	{ "copy", 0 },
+	{ "bloom", POST_BLOOM },
+	{ "grade", POST_GRADE },
+	{ "vignette", POST_VIGNETTE },
+	{ "fused", POST_EFFECTS },
+	{ "separate", POST_EFFECTS | POST_SEPARATE },
+};
+
+#define N_CONFIGS	(sizeof(configs) / sizeof(configs[0]))
+
+static const struct size {
+	const char *name;
+	int width, height;
+} sizes[] = {
+	{ "720p", 1280, 720 },
+	{ "1080p", 1920, 1080 },
+};
+
+#define N_SIZES		(sizeof(sizes) / sizeof(sizes[0]))
+
+struct app {
+	struct render_target_pool targets;
+	struct render_graph graph;
+	struct post_chain post;
+	double msec[N_SIZES][N_CONFIGS];
+	int config;
+	int size;
+	int frame;
+};
+
+static double
+get_msec(void)
+{
+	struct timespec tm;
+
+	clock_gettime(CLOCK_MONOTONIC, &tm);
+	return tm.tv_sec * 1000.0 + tm.tv_nsec / 1000000.0;
+}
+
+static void
+draw_scene(void *data, struct render_graph *graph)
+{
+	glClearColor(0.9, 0.6, 0.3, 1.0);
+	glClear(GL_COLOR_BUFFER_BIT);
+}
+
+static void
+init_graph(struct app *app)
+{
+	struct render_graph *graph = &app->graph;
+	int scene, pass, ret;
+
+	render_graph_init(graph, &app->targets);
+	scene = render_graph_add_target(graph, "scene", GL_RGBA8, 1, 1);
+	pass = render_graph_add_pass(graph, RENDER_PASS_DRAW, "scene",
+				     draw_scene, NULL);
+	render_graph_write(graph, pass, scene, RENDER_ACCESS_COLOR);
+
+	ret = post_chain_add(&app->post, graph, configs[app->config].effects,
+			     scene, render_graph_add_backbuffer(graph));
+	assert(ret == 0);
+	render_graph_compile(graph);
+}
+
+static void
+init_gl(void *data)
+{
+	struct app *app = data;
+	int ret;
+
+	render_target_pool_init(&app->targets);
+	ret = post_chain_init(&app->post);
+	assert(ret == 0);
+	init_graph(app);
+}
+
+static void
+deinit_gl(void *data)
+{
+	struct app *app = data;
+
+	post_chain_fini(&app->post);
+	render_target_pool_fini(&app->targets);
+}
+
+static void
+report(struct app *app)
+{
+	const double *msec;
+	int i, j;
+
+	for (i = 0; i < (int)N_SIZES; i++) {
+		msec = app->msec[i];
+		printf("%-5s copy %.3f ms", sizes[i].name, msec[0]);
+		for (j = 1; j < (int)N_CONFIGS; j++)
+			printf("  %s %+.3f", configs[j].name,
+			       msec[j] - msec[0]);
+		printf("\n");
+	}
+	memset(app->msec, 0, sizeof(app->msec));
+}
+
+static void
+redraw(void *data, struct rect *damage)
+{
+	struct app *app = data;
+	const struct size *size = &sizes[app->size];
+	double start;
+
+	glFinish();
+	start = get_msec();
+	render_graph_execute(&app->graph, size->width, size->height);
+	glFinish();
+	if (app->frame >= WARMUP_FRAMES)
+		app->msec[app->size][app->config] += (get_msec() - start) /
+			(PHASE_FRAMES - WARMUP_FRAMES);
+
+	if (++app->frame < PHASE_FRAMES)
+		return;
+	app->frame = 0;
+	/* the last phase's targets would crowd the pool until they idle out */
+	render_target_pool_fini(&app->targets);
+	render_target_pool_init(&app->targets);
+	if (++app->size == N_SIZES) {
+		app->size = 0;
+		if (++app->config == N_CONFIGS) {
+			app->config = 0;
+			report(app);
+		}
+		init_graph(app);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	struct app app;
+	struct app_info info = {
+		.name = "gl-post-bench",
+		.id = "jp.co.igel.gl-post-bench",
+		.win_width = WINDOW_WIDTH,
+		.win_height = WINDOW_HEIGHT,
+		.cb = {
+			.init_gl = init_gl,
+			.deinit_gl = deinit_gl,
+			.redraw = redraw,
+			.user_data = &app,
+		},
+	};
+
+	memset(&app, 0, sizeof(app));
+	app_main(argc, argv, &info);
+
+	return 0;
+}
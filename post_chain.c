@@ -0,0 +1,371 @@
+/*
+ * Copyright © 2022 IGEL Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *    Tomohito Esaki <etom@igel.co.jp>
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include <GLES3/gl3.h>
+
+#include "gl_state.h"
+#include "shader.h"
+#include "post_chain.h"
+
+/* Scene brightness bloom starts from */
+#define BLOOM_THRESHOLD		0.7f
+
+#define TO_STRING(x)	#x
+static const char *vshader_code = TO_STRING(
+	attribute vec2 position;
+	varying vec2 uv;
+	void main()
+	{
+		gl_Position = vec4(position, 0.0, 1.0);
+		uv = position * 0.5 + 0.5;
+	});
+
+/* Texture coordinates of a 1080p target need more than mediump */
+static const char *fshader_head =
+	"#ifdef GL_FRAGMENT_PRECISION_HIGH\n"
+	"precision highp float;\n"
+	"#else\n"
+	"precision mediump float;\n"
+	"#endif\n";
+
+/* Targets are drawn from the bottom left, src() keeps taps inside */
+static const char *fshader_decls = TO_STRING(
+	varying vec2 uv;
+	uniform sampler2D srcTex;
+	uniform vec2 srcScale;
+	uniform vec2 srcMax;
+	uniform sampler2D bloomTex;
+	uniform vec2 bloomScale;
+	uniform vec2 bloomMax;
+	uniform vec2 texel;
+	uniform float threshold;
+	vec4 src(vec2 p)
+	{
+		return texture2D(srcTex, min(p, srcMax));
+	});
+
+/* Each tap lands between 2x2 texels, 4 taps cover 4x4 */
+static const char *down_code = TO_STRING(
+	void main()
+	{
+		vec2 p = uv * srcScale;
+		vec4 c = src(p - texel);
+		c += src(p + vec2(texel.x, -texel.y));
+		c += src(p + vec2(-texel.x, texel.y));
+		c += src(p + texel);
+		c *= 0.25;
+		gl_FragColor = max(c - threshold, 0.0) / (1.0 - threshold);
+	});
+
+/*
+ * 9 tap gaussian in 5 fetches: the weights of texels 1 and 2, and 3 and
+ * 4, are summed and sampled at their weighted center
+ */
+static const char *blur_code = TO_STRING(
+	void main()
+	{
+		vec2 p = uv * srcScale;
+		vec4 c = src(p) * 0.2270270270;
+		c += src(p + texel * 1.3846153846) * 0.3162162162;
+		c += src(p - texel * 1.3846153846) * 0.3162162162;
+		c += src(p + texel * 3.2307692308) * 0.0702702703;
+		c += src(p - texel * 3.2307692308) * 0.0702702703;
+		gl_FragColor = c;
+	});
+
+/* Per-pixel effects on c, the color at uv, in the order they apply */
+static const struct {
+	const char *name;
+	const char *code;
+} effect_info[POST_EFFECT_COUNT] = {
+	[POST_EFFECT_BLOOM] = { "bloom", TO_STRING(
+		vec2 b = min(uv * bloomScale, bloomMax);
+		c.rgb += texture2D(bloomTex, b).rgb;
+	) },
+	[POST_EFFECT_GRADE] = { "grade", TO_STRING(
+		float l = dot(c.rgb, vec3(0.299, 0.587, 0.114));
+		c.rgb = clamp(mix(vec3(l), c.rgb, 1.25) * 1.05, 0.0, 1.0);
+	) },
+	[POST_EFFECT_VIGNETTE] = { "vignette", TO_STRING(
+		c.rgb *= 1.0 - dot(uv - 0.5, uv - 0.5) * 1.2;
+	) },
+};
+
+static int
+build_program(struct post_program *p, const char *code)
+{
+	struct shader_info shader;
+	char fshader[4096];
+	int len;
+
+	len = snprintf(fshader, sizeof(fshader), "%s%s\n%s\n", fshader_head,
+		       fshader_decls, code);
+	assert(len < (int)sizeof(fshader));
+
+	memset(&shader, 0x0, sizeof(shader));
+	shader.vertex = vshader_code;
+	shader.fragment = fshader;
+	p->program = shader_build_program(&shader);
+	if (!p->program)
+		return -1;
+
+	p->position = glGetAttribLocation(p->program, "position");
+	p->src_tex = glGetUniformLocation(p->program, "srcTex");
+	p->src_scale = glGetUniformLocation(p->program, "srcScale");
+	p->src_max = glGetUniformLocation(p->program, "srcMax");
+	p->bloom_tex = glGetUniformLocation(p->program, "bloomTex");
+	p->bloom_scale = glGetUniformLocation(p->program, "bloomScale");
+	p->bloom_max = glGetUniformLocation(p->program, "bloomMax");
+	p->texel = glGetUniformLocation(p->program, "texel");
+	p->threshold = glGetUniformLocation(p->program, "threshold");
+
+	gl_state_use_program(p->program);
+	glUniform1i(p->src_tex, 0);
+	glUniform1i(p->bloom_tex, 1);
+
+	return 0;
+}
+
+/* Reads the scene once and applies the effects in mask on the way */
+static const struct post_program *
+composite_program(struct post_chain *chain, unsigned int mask)
+{
+	struct post_program *p = &chain->composite[mask];
+	char code[2048];
+	int i, len;
+
+	if (p->program)
+		return p;
+
+	len = snprintf(code, sizeof(code),
+		       "void main()\n{\nvec4 c = src(uv * srcScale);\n");
+	for (i = 0; i < POST_EFFECT_COUNT; i++) {
+		if (mask & (1 << i))
+			len += snprintf(code + len, sizeof(code) - len,
+					"%s\n", effect_info[i].code);
+	}
+	len += snprintf(code + len, sizeof(code) - len,
+			"gl_FragColor = c;\n}\n");
+	assert(len < (int)sizeof(code));
+
+	return build_program(p, code) < 0 ? NULL : p;
+}
+
+int
+post_chain_init(struct post_chain *chain)
+{
+	static const GLfloat quad[] = {
+		-1, -1,
+		1, -1,
+		-1, 1,
+		1, 1,
+	};
+
+	memset(chain, 0, sizeof(*chain));
+	if (build_program(&chain->down, down_code) < 0 ||
+	    build_program(&chain->blur, blur_code) < 0) {
+		fprintf(stderr, "post chain: failed to build shaders\n");
+		post_chain_fini(chain);
+		return -1;
+	}
+
+	glGenBuffers(1, &chain->quad);
+	gl_state_bind_buffer(GL_ARRAY_BUFFER, chain->quad);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+
+	return 0;
+}
+
+void
+post_chain_fini(struct post_chain *chain)
+{
+	int i;
+
+	gl_state_delete_buffers(1, &chain->quad);
+	glDeleteProgram(chain->down.program);
+	glDeleteProgram(chain->blur.program);
+	for (i = 0; i < 1 << POST_EFFECT_COUNT; i++)
+		glDeleteProgram(chain->composite[i].program);
+	memset(chain, 0, sizeof(*chain));
+}
+
+/* Where the drawn part of t ends, scaled to its texture coordinates */
+static void
+set_extent(GLint scale, GLint max, const struct render_target *t)
+{
+	glUniform2f(scale, (float)t->view_width / t->width,
+		    (float)t->view_height / t->height);
+	glUniform2f(max, (t->view_width - 0.5f) / t->width,
+		    (t->view_height - 0.5f) / t->height);
+}
+
+static void
+run_stage(void *data, struct render_graph *graph)
+{
+	const struct post_stage *s = data;
+	const struct post_program *p = s->program;
+	const struct render_target *src, *bloom;
+
+	src = render_graph_target(graph, s->src);
+	gl_state_use_program(p->program);
+	gl_state_disable(GL_BLEND);
+	set_extent(p->src_scale, p->src_max, src);
+	glUniform2f(p->texel, s->dx / src->width, s->dy / src->height);
+	glUniform1f(p->threshold, s->threshold);
+
+	if (s->bloom >= 0) {
+		bloom = render_graph_target(graph, s->bloom);
+		set_extent(p->bloom_scale, p->bloom_max, bloom);
+		gl_state_active_texture(GL_TEXTURE1);
+		gl_state_bind_texture(GL_TEXTURE_2D, bloom->color);
+	}
+	gl_state_active_texture(GL_TEXTURE0);
+	gl_state_bind_texture(GL_TEXTURE_2D, src->color);
+
+	gl_state_bind_buffer(GL_ARRAY_BUFFER, s->chain->quad);
+	glEnableVertexAttribArray(p->position);
+	gl_state_vertex_attrib_pointer(p->position, 2, GL_FLOAT, GL_FALSE, 0,
+				       0);
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
+
+static int
+add_stage(struct post_chain *chain, struct render_graph *graph,
+	  const char *name, const struct post_program *program, int src,
+	  int bloom, int dst, float dx, float dy, float threshold)
+{
+	struct post_stage *s;
+	int pass;
+
+	if (!program || chain->n_stages == POST_MAX_STAGES)
+		return -1;
+
+	s = &chain->stages[chain->n_stages];
+	pass = render_graph_add_pass(graph, RENDER_PASS_DRAW, name, run_stage,
+				     s);
+	if (pass < 0)
+		return -1;
+	chain->n_stages++;
+
+	*s = (struct post_stage){
+		.chain = chain,
+		.program = program,
+		.src = src,
+		.bloom = bloom,
+		.dx = dx,
+		.dy = dy,
+		.threshold = threshold,
+	};
+	render_graph_read(graph, pass, src, RENDER_ACCESS_TEXTURE);
+	if (bloom >= 0)
+		render_graph_read(graph, pass, bloom, RENDER_ACCESS_TEXTURE);
+	render_graph_write(graph, pass, dst, RENDER_ACCESS_COLOR);
+
+	return 0;
+}
+
+/* Half and quarter resolution, blurred back into the quarter target */
+static int
+add_bloom(struct post_chain *chain, struct render_graph *graph, int scene)
+{
+	const struct render_resource *s = &graph->resources[scene];
+	int half, quarter, blur;
+
+	half = render_graph_add_target(graph, "post half", s->format,
+				       s->scale_num, s->scale_den * 2);
+	quarter = render_graph_add_target(graph, "post quarter", s->format,
+					  s->scale_num, s->scale_den * 4);
+	blur = render_graph_add_target(graph, "post blur", s->format,
+				       s->scale_num, s->scale_den * 4);
+	if (half < 0 || quarter < 0 || blur < 0)
+		return -1;
+
+	if (add_stage(chain, graph, "bright", &chain->down, scene, -1, half,
+		      1, 1, BLOOM_THRESHOLD) < 0 ||
+	    add_stage(chain, graph, "downsample", &chain->down, half, -1,
+		      quarter, 1, 1, 0) < 0 ||
+	    add_stage(chain, graph, "blur h", &chain->blur, quarter, -1, blur,
+		      1, 0, 0) < 0 ||
+	    add_stage(chain, graph, "blur v", &chain->blur, blur, -1, quarter,
+		      0, 1, 0) < 0)
+		return -1;
+
+	return quarter;
+}
+
+int
+post_chain_add(struct post_chain *chain, struct render_graph *graph,
+	       unsigned int effects, int scene, int output)
+{
+	const struct render_resource *s = &graph->resources[scene];
+	unsigned int left = effects & POST_EFFECTS, mask;
+	int bloom = -1, ping_pong[2] = { -1, -1 };
+	int i, j, n = 0, src = scene, dst;
+
+	chain->n_stages = 0;
+	if (effects & POST_BLOOM) {
+		bloom = add_bloom(chain, graph, scene);
+		if (bloom < 0)
+			return -1;
+	}
+
+	if (!(effects & POST_SEPARATE) || !left)
+		return add_stage(chain, graph, "composite",
+				 composite_program(chain, left), scene, bloom,
+				 output, 0, 0, 0);
+
+	for (i = 0; i < POST_EFFECT_COUNT; i++) {
+		mask = 1 << i;
+		if (!(left & mask))
+			continue;
+		left &= ~mask;
+
+		/* intermediate results alternate between two targets */
+		dst = output;
+		if (left) {
+			j = n++ & 1;
+			if (ping_pong[j] < 0)
+				ping_pong[j] = render_graph_add_target(graph,
+					j ? "post pong" : "post ping",
+					s->format, s->scale_num, s->scale_den);
+			dst = ping_pong[j];
+			if (dst < 0)
+				return -1;
+		}
+		if (add_stage(chain, graph, effect_info[i].name,
+			      composite_program(chain, mask), src,
+			      mask == POST_BLOOM ? bloom : -1, dst, 0, 0,
+			      0) < 0)
+			return -1;
+		src = dst;
+	}
+
+	return 0;
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright © 2022 IGEL Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *    Tomohito Esaki <etom@igel.co.jp>
+ */
+
+#ifndef POST_CHAIN_H
+#define POST_CHAIN_H
+
+#include "render_graph.h"
+
+/*
+ * Post-processing of a scene target, declared as render graph passes.
+ *
+ * Bloom thresholds the scene into a half resolution target, halves it
+ * again and blurs the quarter resolution result with a 9 tap gaussian,
+ * horizontally into a second target and vertically back, each direction
+ * in 5 bilinear fetches by sampling between texel pairs. The per-pixel
+ * effects, adding the bloom, color grading and the vignette, are then
+ * fused into one shader reading the scene once and writing the output
+ * once. POST_SEPARATE runs them as one pass each instead, ping-ponging
+ * between two full size targets, to measure what the fusion saves.
+ *
+ * The shaders are GLSL ES 1.00, the intermediate targets take the format
+ * of the scene and are sized relative to it.
+ */
+
+enum post_effect {
+	POST_EFFECT_BLOOM,
+	POST_EFFECT_GRADE,
+	POST_EFFECT_VIGNETTE,
+	POST_EFFECT_COUNT,
+};
+
+#define POST_BLOOM		(1 << POST_EFFECT_BLOOM)
+#define POST_GRADE		(1 << POST_EFFECT_GRADE)
+#define POST_VIGNETTE		(1 << POST_EFFECT_VIGNETTE)
+#define POST_EFFECTS		((1 << POST_EFFECT_COUNT) - 1)
+#define POST_SEPARATE		(1 << POST_EFFECT_COUNT)
+
+#define POST_MAX_STAGES		8
+
+struct post_program {
+	GLuint program;
+	GLint position;
+	GLint src_tex, src_scale, src_max;
+	GLint bloom_tex, bloom_scale, bloom_max;
+	GLint texel;
+	GLint threshold;
+};
+
+struct post_chain;
+
+struct post_stage {
+	struct post_chain *chain;
+	const struct post_program *program;
+	int src;		/* resource sampled */
+	int bloom;		/* or -1 */
+	float dx, dy;		/* tap direction, in source texels */
+	float threshold;
+};
+
+struct post_chain {
+	GLuint quad;
+	struct post_program down;
+	struct post_program blur;
+	/* by effect mask, built when first declared */
+	struct post_program composite[1 << POST_EFFECT_COUNT];
+	struct post_stage stages[POST_MAX_STAGES];
+	int n_stages;
+};
+
+/* Returns -1 if a shader fails to build */
+int post_chain_init(struct post_chain *chain);
+void post_chain_fini(struct post_chain *chain);
+
+/*
+ * Declares the passes applying effects, a POST_* mask, to the scene
+ * target and writing output. With no effects the scene is copied.
+ * A chain feeds one graph at a time. Returns -1 if the graph is full.
+ */
+int post_chain_add(struct post_chain *chain, struct render_graph *graph,
+		   unsigned int effects, int scene, int output);
+
+#endif
@@ -0,0 +1,415 @@
+/*
+ * Copyright © 2022 IGEL Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *    Tomohito Esaki <etom@igel.co.jp>
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include <GLES3/gl31.h>
+
+#include "gl_state.h"
+#include "shader.h"
+#include "render_graph.h"
+
+/* Barrier bit making storage writes visible to each access */
+static const GLbitfield access_barrier[] = {
+	[RENDER_ACCESS_STORAGE] = GL_SHADER_STORAGE_BARRIER_BIT,
+	[RENDER_ACCESS_VERTEX] = GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT,
+	[RENDER_ACCESS_INDEX] = GL_ELEMENT_ARRAY_BARRIER_BIT,
+	[RENDER_ACCESS_UNIFORM] = GL_UNIFORM_BARRIER_BIT,
+	[RENDER_ACCESS_TEXTURE] = GL_TEXTURE_FETCH_BARRIER_BIT,
+	[RENDER_ACCESS_COLOR] = GL_FRAMEBUFFER_BARRIER_BIT,
+};
+
+#define ALL_BARRIERS	(GL_SHADER_STORAGE_BARRIER_BIT |		\
+			 GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT |		\
+			 GL_ELEMENT_ARRAY_BARRIER_BIT |			\
+			 GL_UNIFORM_BARRIER_BIT |			\
+			 GL_TEXTURE_FETCH_BARRIER_BIT |			\
+			 GL_FRAMEBUFFER_BARRIER_BIT)
+
+void
+render_graph_init(struct render_graph *graph,
+		  struct render_target_pool *targets)
+{
+	memset(graph, 0, sizeof(*graph));
+	graph->targets = targets;
+}
+
+static int
+add_resource(struct render_graph *graph, enum render_resource_type type,
+	     const char *name)
+{
+	struct render_resource *r;
+
+	if (graph->n_resources == RENDER_GRAPH_MAX_RESOURCES)
+		return -1;
+
+	r = &graph->resources[graph->n_resources];
+	memset(r, 0, sizeof(*r));
+	r->type = type;
+	r->name = name;
+	r->scale_num = r->scale_den = 1;
+
+	return graph->n_resources++;
+}
+
+int
+render_graph_add_buffer(struct render_graph *graph, const char *name)
+{
+	return add_resource(graph, RENDER_RESOURCE_BUFFER, name);
+}
+
+int
+render_graph_add_target(struct render_graph *graph, const char *name,
+			GLenum format, int scale_num, int scale_den)
+{
+	int i = add_resource(graph, RENDER_RESOURCE_TARGET, name);
+
+	if (i >= 0) {
+		graph->resources[i].format = format;
+		graph->resources[i].scale_num = scale_num;
+		graph->resources[i].scale_den = scale_den;
+	}
+
+	return i;
+}
+
+int
+render_graph_add_backbuffer(struct render_graph *graph)
+{
+	return add_resource(graph, RENDER_RESOURCE_BACKBUFFER, "backbuffer");
+}
+
+int
+render_graph_add_pass(struct render_graph *graph, enum render_pass_type type,
+		      const char *name, render_pass_func run, void *data)
+{
+	struct render_pass *p;
+
+	if (graph->n_passes == RENDER_GRAPH_MAX_PASSES)
+		return -1;
+
+	p = &graph->passes[graph->n_passes];
+	memset(p, 0, sizeof(*p));
+	p->type = type;
+	p->name = name;
+	p->run = run;
+	p->data = data;
+	p->output = -1;
+
+	return graph->n_passes++;
+}
+
+void
+render_graph_read(struct render_graph *graph, int pass, int resource,
+		  enum render_access access)
+{
+	struct render_pass *p = &graph->passes[pass];
+
+	assert(p->n_reads < RENDER_PASS_MAX_USES);
+	p->reads[p->n_reads++] = (struct render_use){ resource, access };
+}
+
+void
+render_graph_write(struct render_graph *graph, int pass, int resource,
+		   enum render_access access)
+{
+	struct render_pass *p = &graph->passes[pass];
+
+	assert(p->n_writes < RENDER_PASS_MAX_USES);
+	p->writes[p->n_writes++] = (struct render_use){ resource, access };
+	if (access == RENDER_ACCESS_COLOR) {
+		/* one color output per pass */
+		assert(p->output < 0);
+		p->output = resource;
+	}
+}
+
+static int
+pass_uses(const struct render_pass *p, int resource)
+{
+	int i;
+
+	for (i = 0; i < p->n_reads; i++) {
+		if (p->reads[i].resource == resource)
+			return 1;
+	}
+	for (i = 0; i < p->n_writes; i++) {
+		if (p->writes[i].resource == resource)
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Lets the pass drawing the source of a copy draw into its destination
+ * instead, when nothing else could tell the difference
+ */
+static int
+merge_copy(struct render_graph *graph, int copy)
+{
+	struct render_pass *c = &graph->passes[copy], *p;
+	const struct render_resource *src, *dst;
+	int i, source, producer = -1;
+
+	assert(c->n_reads == 1 && c->output >= 0);
+	source = c->reads[0].resource;
+	src = &graph->resources[source];
+	dst = &graph->resources[c->output];
+	if (src->type != RENDER_RESOURCE_TARGET ||
+	    src->scale_num * dst->scale_den !=
+	    dst->scale_num * src->scale_den ||
+	    (dst->type == RENDER_RESOURCE_TARGET &&
+	     dst->format != src->format))
+		return 0;
+
+	/* drawn by one earlier pass, read by the copy only */
+	for (i = 0; i < graph->n_passes; i++) {
+		p = &graph->passes[i];
+		if (i == copy || p->culled || !pass_uses(p, source))
+			continue;
+		if (producer >= 0 || i > copy || p->type != RENDER_PASS_DRAW ||
+		    p->output != source)
+			return 0;
+		producer = i;
+	}
+	if (producer < 0)
+		return 0;
+
+	/* and the destination is left alone in between */
+	for (i = producer + 1; i < copy; i++) {
+		if (!graph->passes[i].culled &&
+		    pass_uses(&graph->passes[i], c->output))
+			return 0;
+	}
+
+	p = &graph->passes[producer];
+	for (i = 0; i < p->n_writes; i++) {
+		if (p->writes[i].resource == source)
+			p->writes[i].resource = c->output;
+	}
+	p->output = c->output;
+	c->culled = 1;
+#ifdef DEBUG
+	fprintf(stderr, "render graph: %s draws into %s, %s dropped\n",
+		p->name, dst->name, c->name);
+#endif
+
+	return 1;
+}
+
+void
+render_graph_compile(struct render_graph *graph)
+{
+	int needed[RENDER_GRAPH_MAX_RESOURCES];
+	struct render_pass *p;
+	struct render_resource *r;
+	int i, j, live;
+
+	for (i = 0; i < graph->n_passes; i++) {
+		if (graph->passes[i].type == RENDER_PASS_COPY)
+			merge_copy(graph, i);
+	}
+
+	/* buffers outlive the frame and the window is shown */
+	for (i = 0; i < graph->n_resources; i++)
+		needed[i] = graph->resources[i].type != RENDER_RESOURCE_TARGET;
+
+	for (i = graph->n_passes - 1; i >= 0; i--) {
+		p = &graph->passes[i];
+		if (p->culled)
+			continue;
+		for (j = 0, live = 0; j < p->n_writes; j++)
+			live |= needed[p->writes[j].resource];
+		if (!live) {
+			p->culled = 1;
+#ifdef DEBUG
+			fprintf(stderr, "render graph: %s culled\n", p->name);
+#endif
+			continue;
+		}
+		for (j = 0; j < p->n_reads; j++)
+			needed[p->reads[j].resource] = 1;
+	}
+
+	for (i = 0; i < graph->n_resources; i++)
+		graph->resources[i].first = graph->resources[i].last = -1;
+	for (i = 0; i < graph->n_passes; i++) {
+		p = &graph->passes[i];
+		if (p->culled)
+			continue;
+		/* only blits need ES 3.0, the rest is drawn by the samples */
+		assert(p->type != RENDER_PASS_COPY ||
+		       shader_gl_version() >= 30);
+		for (j = 0; j < graph->n_resources; j++) {
+			r = &graph->resources[j];
+			if (!pass_uses(p, j))
+				continue;
+			if (r->first < 0)
+				r->first = i;
+			r->last = i;
+		}
+	}
+}
+
+/* Size of a resource in a width x height window */
+static void
+resource_size(const struct render_graph *graph,
+	      const struct render_resource *r, int *width, int *height)
+{
+	*width = graph->width * r->scale_num / r->scale_den;
+	*height = graph->height * r->scale_num / r->scale_den;
+	if (*width < 1)
+		*width = 1;
+	if (*height < 1)
+		*height = 1;
+}
+
+/* Issues the barriers owed to the storage writes this pass accesses */
+static void
+pass_barrier(struct render_graph *graph, const struct render_pass *p)
+{
+	const struct render_use *use;
+	GLbitfield bits = 0;
+	int i;
+
+	for (i = 0; i < p->n_reads + p->n_writes; i++) {
+		use = i < p->n_reads ? &p->reads[i] :
+			&p->writes[i - p->n_reads];
+		bits |= graph->resources[use->resource].pending &
+			access_barrier[use->access];
+	}
+	if (!bits)
+		return;
+
+	glMemoryBarrier(bits);
+	for (i = 0; i < graph->n_resources; i++)
+		graph->resources[i].pending &= ~bits;
+}
+
+/* Binds the color output of pass, its contents are dropped on first use */
+static void
+bind_output(struct render_graph *graph, int pass, int resource)
+{
+	const struct render_resource *r = &graph->resources[resource];
+	struct render_target *t = r->target;
+
+	if (r->type == RENDER_RESOURCE_BACKBUFFER) {
+		gl_state_bind_framebuffer(GL_FRAMEBUFFER, 0);
+		glViewport(0, 0, graph->width, graph->height);
+	} else if (r->first == pass) {
+		render_target_begin_pass(t);
+	} else {
+		gl_state_bind_framebuffer(GL_FRAMEBUFFER, t->fbo);
+		glViewport(0, 0, t->view_width, t->view_height);
+	}
+}
+
+static void
+blit(struct render_graph *graph, int pass, const struct render_pass *p)
+{
+	const struct render_target *src, *dst;
+	int width, height;
+
+	src = graph->resources[p->reads[0].resource].target;
+	dst = graph->resources[p->output].target;
+	bind_output(graph, pass, p->output);
+	gl_state_bind_framebuffer(GL_READ_FRAMEBUFFER, src->fbo);
+
+	width = dst ? dst->view_width : graph->width;
+	height = dst ? dst->view_height : graph->height;
+	glBlitFramebuffer(0, 0, src->view_width, src->view_height, 0, 0,
+			  width, height, GL_COLOR_BUFFER_BIT,
+			  width == src->view_width &&
+			  height == src->view_height ? GL_NEAREST : GL_LINEAR);
+}
+
+void
+render_graph_execute(struct render_graph *graph, int width, int height)
+{
+	struct render_resource *r;
+	struct render_target *output;
+	struct render_pass *p;
+	int i, j, w, h;
+
+	graph->width = width;
+	graph->height = height;
+
+	for (i = 0; i < graph->n_passes; i++) {
+		p = &graph->passes[i];
+		if (p->culled)
+			continue;
+
+		for (j = 0; j < graph->n_resources; j++) {
+			r = &graph->resources[j];
+			if (r->type != RENDER_RESOURCE_TARGET || r->first != i)
+				continue;
+			resource_size(graph, r, &w, &h);
+			r->target = render_target_acquire(graph->targets, w, h,
+							  r->format, 0);
+			assert(r->target);
+		}
+
+		pass_barrier(graph, p);
+
+		switch (p->type) {
+		case RENDER_PASS_COMPUTE:
+			p->run(p->data, graph);
+			break;
+		case RENDER_PASS_DRAW:
+			output = NULL;
+			if (p->output >= 0) {
+				bind_output(graph, i, p->output);
+				output = graph->resources[p->output].target;
+			}
+			p->run(p->data, graph);
+			if (output)
+				render_target_end_pass(output);
+			break;
+		case RENDER_PASS_COPY:
+			blit(graph, i, p);
+			break;
+		}
+
+		for (j = 0; j < p->n_writes; j++) {
+			r = &graph->resources[p->writes[j].resource];
+			if (p->writes[j].access == RENDER_ACCESS_STORAGE)
+				r->pending = ALL_BARRIERS;
+		}
+
+		for (j = 0; j < graph->n_resources; j++) {
+			r = &graph->resources[j];
+			if (r->type != RENDER_RESOURCE_TARGET || r->last != i)
+				continue;
+			render_target_release(r->target);
+			r->target = NULL;
+		}
+	}
+
+	render_target_pool_end_frame(graph->targets);
+}
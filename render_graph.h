@@ -0,0 +1,148 @@
+/*
+ * Copyright © 2022 IGEL Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *    Tomohito Esaki <etom@igel.co.jp>
+ */
+
+#ifndef RENDER_GRAPH_H
+#define RENDER_GRAPH_H
+
+#include "render_target.h"
+
+/*
+ * Frame described as passes over resources.
+ *
+ * A sample declares its buffers, transient color targets and the window
+ * once, then the passes in submission order with what each reads and
+ * writes. render_graph_compile() plans the frame:
+ *
+ * - a copy pass whose source is drawn by a single pass, read by nothing
+ *   else and as big as the destination is dropped, and that pass draws
+ *   straight into the destination; other copies are blits.
+ * - passes whose writes nobody reads are culled. Buffers and the window
+ *   are always read, by the next frame or the compositor.
+ * - targets are acquired from the pool right before their first pass
+ *   and released after their last one, so targets whose lifetimes do
+ *   not overlap share memory.
+ *
+ * render_graph_execute() then runs the passes, binding the color output
+ * of draw passes with its viewport. Shader storage writes are not
+ * coherent: the graph remembers them across frames and issues the
+ * glMemoryBarrier() bits of the first later access of each kind, once.
+ */
+
+#define RENDER_GRAPH_MAX_RESOURCES	16
+#define RENDER_GRAPH_MAX_PASSES		16
+#define RENDER_PASS_MAX_USES		4
+
+/* How a pass uses a resource */
+enum render_access {
+	RENDER_ACCESS_STORAGE,	/* shader storage load or store */
+	RENDER_ACCESS_VERTEX,	/* vertex attribute fetch */
+	RENDER_ACCESS_INDEX,
+	RENDER_ACCESS_UNIFORM,
+	RENDER_ACCESS_TEXTURE,	/* sampled */
+	RENDER_ACCESS_COLOR,	/* color attachment */
+};
+
+enum render_resource_type {
+	RENDER_RESOURCE_BUFFER,		/* owned by the sample */
+	RENDER_RESOURCE_TARGET,		/* from the pool, one frame */
+	RENDER_RESOURCE_BACKBUFFER,
+};
+
+struct render_resource {
+	enum render_resource_type type;
+	const char *name;
+	GLenum format;
+	int scale_num, scale_den;	/* of the window size */
+	int first, last;		/* passes using it, -1 if none */
+	GLbitfield pending;		/* barriers owed to storage writes */
+	struct render_target *target;
+};
+
+enum render_pass_type {
+	RENDER_PASS_COMPUTE,
+	RENDER_PASS_DRAW,
+	RENDER_PASS_COPY,
+};
+
+struct render_graph;
+
+typedef void (*render_pass_func)(void *data, struct render_graph *graph);
+
+struct render_use {
+	int resource;
+	enum render_access access;
+};
+
+struct render_pass {
+	enum render_pass_type type;
+	const char *name;
+	render_pass_func run;
+	void *data;
+	struct render_use reads[RENDER_PASS_MAX_USES];
+	struct render_use writes[RENDER_PASS_MAX_USES];
+	int n_reads, n_writes;
+	int culled;
+	int output;	/* color output of draw and copy passes, or -1 */
+};
+
+struct render_graph {
+	struct render_target_pool *targets;
+	struct render_resource resources[RENDER_GRAPH_MAX_RESOURCES];
+	struct render_pass passes[RENDER_GRAPH_MAX_PASSES];
+	int n_resources, n_passes;
+	int width, height;
+};
+
+void render_graph_init(struct render_graph *graph,
+		       struct render_target_pool *targets);
+
+/* Declare resources, return their handle or -1 */
+int render_graph_add_buffer(struct render_graph *graph, const char *name);
+int render_graph_add_target(struct render_graph *graph, const char *name,
+			    GLenum format, int scale_num, int scale_den);
+int render_graph_add_backbuffer(struct render_graph *graph);
+
+/* Declares the next pass, run is NULL for copies; returns its handle */
+int render_graph_add_pass(struct render_graph *graph,
+			  enum render_pass_type type, const char *name,
+			  render_pass_func run, void *data);
+void render_graph_read(struct render_graph *graph, int pass, int resource,
+		       enum render_access access);
+void render_graph_write(struct render_graph *graph, int pass, int resource,
+			enum render_access access);
+
+void render_graph_compile(struct render_graph *graph);
+/* Runs the frame for a width x height window */
+void render_graph_execute(struct render_graph *graph, int width, int height);
+
+/* The pool target behind a target resource while the frame runs */
+static inline const struct render_target *
+render_graph_target(struct render_graph *graph, int resource)
+{
+	return graph->resources[resource].target;
+}
+
+#endif
@@ -0,0 +1,292 @@
+/*
+ * Copyright © 2022 IGEL Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *    Tomohito Esaki <etom@igel.co.jp>
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include <GLES3/gl3.h>
+
+#include "gl_state.h"
+#include "shader.h"
+#include "render_target.h"
+
+#define ALIGN_UP(x, a)	(((x) + (a) - 1) / (a) * (a))
+
+static int
+format_bytes(GLenum format)
+{
+	switch (format) {
+	case 0:
+		return 0;
+	case GL_RGB565:
+	case GL_RGBA4:
+	case GL_RGB5_A1:
+	case GL_DEPTH_COMPONENT16:
+		return 2;
+	default:
+		return 4;
+	}
+}
+
+void
+render_target_pool_init(struct render_target_pool *pool)
+{
+	memset(pool, 0, sizeof(*pool));
+}
+
+static void
+target_free(struct render_target_pool *pool, struct render_target *t)
+{
+	/* a reused name must not look bound already */
+	gl_state_delete_framebuffers(1, &t->fbo);
+	gl_state_delete_textures(1, &t->color);
+	glDeleteRenderbuffers(1, &t->depth);
+	pool->bytes -= t->bytes;
+	pool->n_targets--;
+#ifdef DEBUG
+	fprintf(stderr, "render target: %dx%d freed, %zu KiB in %d targets\n",
+		t->width, t->height, pool->bytes / 1024, pool->n_targets);
+#endif
+	memset(t, 0, sizeof(*t));
+}
+
+void
+render_target_pool_fini(struct render_target_pool *pool)
+{
+	int i;
+
+	gl_state_bind_framebuffer(GL_FRAMEBUFFER, 0);
+	for (i = 0; i < RENDER_TARGET_POOL_MAX; i++) {
+		if (pool->targets[i].fbo)
+			target_free(pool, &pool->targets[i]);
+	}
+}
+
+static void
+init_color(struct render_target *t)
+{
+	glGenTextures(1, &t->color);
+	gl_state_bind_texture(GL_TEXTURE_2D, t->color);
+	if (shader_gl_version() >= 30) {
+		glTexStorage2D(GL_TEXTURE_2D, 1, t->color_format, t->width,
+			       t->height);
+	} else {
+		/* unsized formats only */
+		assert(t->color_format == GL_RGBA8);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, t->width, t->height, 0,
+			     GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			       GL_TEXTURE_2D, t->color, 0);
+}
+
+static GLenum
+depth_attachment(const struct render_target *t)
+{
+	if (t->depth_format == GL_DEPTH24_STENCIL8 ||
+	    t->depth_format == GL_DEPTH32F_STENCIL8)
+		return GL_DEPTH_STENCIL_ATTACHMENT;
+
+	return GL_DEPTH_ATTACHMENT;
+}
+
+static void
+init_depth(struct render_target *t)
+{
+	glGenRenderbuffers(1, &t->depth);
+	glBindRenderbuffer(GL_RENDERBUFFER, t->depth);
+	glRenderbufferStorage(GL_RENDERBUFFER, t->depth_format, t->width,
+			      t->height);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, depth_attachment(t),
+				  GL_RENDERBUFFER, t->depth);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+}
+
+static int
+target_init(struct render_target_pool *pool, struct render_target *t,
+	    int width, int height, GLenum color_format, GLenum depth_format)
+{
+	GLenum status;
+
+	t->color_format = color_format;
+	t->depth_format = depth_format;
+	t->width = ALIGN_UP(width, RENDER_TARGET_ALIGN);
+	t->height = ALIGN_UP(height, RENDER_TARGET_ALIGN);
+	t->bytes = (size_t)t->width * t->height *
+		(format_bytes(color_format) + format_bytes(depth_format));
+
+	glGenFramebuffers(1, &t->fbo);
+	gl_state_bind_framebuffer(GL_FRAMEBUFFER, t->fbo);
+	if (color_format)
+		init_color(t);
+	if (depth_format)
+		init_depth(t);
+	status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	gl_state_bind_framebuffer(GL_FRAMEBUFFER, 0);
+
+	pool->bytes += t->bytes;
+	pool->n_targets++;
+#ifdef DEBUG
+	fprintf(stderr, "render target: %dx%d allocated, %zu KiB in %d "
+		"targets\n", t->width, t->height, pool->bytes / 1024,
+		pool->n_targets);
+#endif
+
+	if (status != GL_FRAMEBUFFER_COMPLETE) {
+		fprintf(stderr, "render target: incomplete framebuffer 0x%x\n",
+			status);
+		target_free(pool, t);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* A free target with these attachments */
+static int
+target_matches(const struct render_target *t, GLenum color_format,
+	       GLenum depth_format)
+{
+	return t->fbo && !t->in_use && t->color_format == color_format &&
+	       t->depth_format == depth_format;
+}
+
+struct render_target *
+render_target_acquire(struct render_target_pool *pool, int width,
+		      int height, GLenum color_format, GLenum depth_format)
+{
+	struct render_target *t, *best = NULL, *slot = NULL;
+	long area = (long)width * height;
+	int i;
+
+	assert(width > 0 && height > 0);
+
+	for (i = 0; i < RENDER_TARGET_POOL_MAX; i++) {
+		t = &pool->targets[i];
+		if (!t->fbo && !slot)
+			slot = t;
+		if (!target_matches(t, color_format, depth_format) ||
+		    t->width < width || t->height < height ||
+		    (long)t->width * t->height > area * 2)
+			continue;
+		if (!best || (long)t->width * t->height <
+			     (long)best->width * best->height)
+			best = t;
+	}
+
+	if (!best) {
+		/*
+		 * Free targets of these formats are too small or too big.
+		 * Those drawn last frame are likely wanted by another pass
+		 * of this one, so they only go to make room.
+		 */
+		for (i = 0; i < RENDER_TARGET_POOL_MAX; i++) {
+			t = &pool->targets[i];
+			if (target_matches(t, color_format, depth_format) &&
+			    t->idle_frames > 1)
+				target_free(pool, t);
+			if (!t->fbo && !slot)
+				slot = t;
+		}
+		for (i = 0; i < RENDER_TARGET_POOL_MAX && !slot; i++) {
+			t = &pool->targets[i];
+			if (target_matches(t, color_format, depth_format)) {
+				target_free(pool, t);
+				slot = t;
+			}
+		}
+		if (!slot) {
+			fprintf(stderr, "render target: pool is full\n");
+			return NULL;
+		}
+		if (target_init(pool, slot, width, height, color_format,
+				depth_format) < 0)
+			return NULL;
+		best = slot;
+	}
+
+	best->in_use = 1;
+	best->idle_frames = 0;
+	best->view_width = width;
+	best->view_height = height;
+
+	return best;
+}
+
+void
+render_target_release(struct render_target *target)
+{
+	assert(target->in_use);
+	target->in_use = 0;
+}
+
+void
+render_target_begin_pass(struct render_target *target)
+{
+	GLenum attachments[2];
+	int n = 0;
+
+	gl_state_bind_framebuffer(GL_FRAMEBUFFER, target->fbo);
+	glViewport(0, 0, target->view_width, target->view_height);
+
+	if (shader_gl_version() < 30)
+		return;
+	if (target->color)
+		attachments[n++] = GL_COLOR_ATTACHMENT0;
+	if (target->depth)
+		attachments[n++] = depth_attachment(target);
+	glInvalidateFramebuffer(GL_FRAMEBUFFER, n, attachments);
+}
+
+void
+render_target_end_pass(struct render_target *target)
+{
+	GLenum attachment;
+
+	if (!target->depth || shader_gl_version() < 30)
+		return;
+	attachment = depth_attachment(target);
+	glInvalidateFramebuffer(GL_FRAMEBUFFER, 1, &attachment);
+}
+
+void
+render_target_pool_end_frame(struct render_target_pool *pool)
+{
+	struct render_target *t;
+	int i;
+
+	for (i = 0; i < RENDER_TARGET_POOL_MAX; i++) {
+		t = &pool->targets[i];
+		if (t->fbo && !t->in_use &&
+		    ++t->idle_frames >= RENDER_TARGET_IDLE_FRAMES)
+			target_free(pool, t);
+	}
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright © 2022 IGEL Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *    Tomohito Esaki <etom@igel.co.jp>
+ */
+
+#ifndef RENDER_TARGET_H
+#define RENDER_TARGET_H
+
+#include <stddef.h>
+
+/*
+ * Pool of offscreen render targets.
+ *
+ * A pass acquires a target for the size and attachments it needs, a
+ * color texture and/or a depth renderbuffer, 0 for none, and releases it
+ * once the frame no longer samples it. Free targets are reused for any
+ * request of the same formats that fits and covers at least half of
+ * their area, so a shrinking window keeps its target; a new one is
+ * rounded up to RENDER_TARGET_ALIGN, so a growing one reallocates every
+ * few steps only. Targets left unused for RENDER_TARGET_IDLE_FRAMES are
+ * freed.
+ *
+ * Contents never survive a pass: render_target_begin_pass() invalidates
+ * every attachment and render_target_end_pass() the depth one, so tiled
+ * GPUs neither load nor store what nobody reads. Invalidation needs
+ * OpenGL ES 3.0 and is skipped on 2.0.
+ */
+
+#define RENDER_TARGET_POOL_MAX		8
+#define RENDER_TARGET_ALIGN		64
+#define RENDER_TARGET_IDLE_FRAMES	60
+
+struct render_target {
+	GLuint fbo;
+	GLuint color;		/* texture */
+	GLuint depth;		/* renderbuffer */
+	GLenum color_format;
+	GLenum depth_format;
+	int width, height;	/* allocated */
+	int view_width, view_height;	/* drawn, from the bottom left */
+	int in_use;
+	int idle_frames;
+	size_t bytes;
+};
+
+struct render_target_pool {
+	struct render_target targets[RENDER_TARGET_POOL_MAX];
+	int n_targets;
+	size_t bytes;
+};
+
+void render_target_pool_init(struct render_target_pool *pool);
+void render_target_pool_fini(struct render_target_pool *pool);
+
+/*
+ * Returns a target of at least width x height with the given sized
+ * internal formats, or NULL if the pool is full or the framebuffer is
+ * incomplete.
+ */
+struct render_target *
+render_target_acquire(struct render_target_pool *pool, int width,
+		      int height, GLenum color_format, GLenum depth_format);
+/* Returns target to its pool */
+void render_target_release(struct render_target *target);
+
+/* Binds target and sets the viewport to its view, discarding the contents */
+void render_target_begin_pass(struct render_target *target);
+/* Discards the depth of the bound target, nothing reads it after the pass */
+void render_target_end_pass(struct render_target *target);
+
+/* Frees the targets idle for too long; call once per frame */
+void render_target_pool_end_frame(struct render_target_pool *pool);
+
+#endif
@@ -124,3 +124,16 @@ exit:
 
 	return program;
 }
+
+int
+shader_gl_version(void)
+{
+	const char *version = (const char *)glGetString(GL_VERSION);
+	int major, minor;
+
+	if (!version ||
+	    sscanf(version, "OpenGL ES %d.%d", &major, &minor) != 2)
+		return 0;
+
+	return major * 10 + minor;
+}
@@ -40,4 +40,7 @@ struct shader_info {
 
 unsigned int shader_build_program(struct shader_info *shader);
 
+/* ES version of the current context as major * 10 + minor, 0 if unknown */
+int shader_gl_version(void);
+
 #endif
@@ -0,0 +1,145 @@
+/*
+ * Copyright © 2022 IGEL Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *    Tomohito Esaki <etom@igel.co.jp>
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "sim_pipeline.h"
+
+#define SIM_REPORT_FRAMES	300
+
+/* sem_wait() that retries when a signal interrupts it */
+static void
+wait_sem(sem_t *sem)
+{
+	while (sem_wait(sem) < 0 && errno == EINTR)
+		;
+}
+
+/* Returns 1 if it had to sleep */
+static int
+wait_counted(sem_t *sem)
+{
+	if (sem_trywait(sem) == 0)
+		return 0;
+	wait_sem(sem);
+	return 1;
+}
+
+static void *
+sim_thread(void *data)
+{
+	struct sim_pipeline *sp = data;
+	int write = 0;
+
+	for (;;) {
+		if (wait_counted(&sp->free))
+			atomic_fetch_add_explicit(&sp->sim_stalls, 1,
+						  memory_order_relaxed);
+		if (atomic_load_explicit(&sp->quit, memory_order_acquire))
+			break;
+
+		sp->simulate(sp->data, sp->state[write]);
+		sem_post(&sp->ready);
+		write ^= 1;
+	}
+
+	return NULL;
+}
+
+int
+sim_pipeline_start(struct sim_pipeline *sp,
+		   void (*simulate)(void *data, void *state), void *data,
+		   void *state0, void *state1)
+{
+	memset(sp, 0, sizeof(*sp));
+	sp->simulate = simulate;
+	sp->data = data;
+	sp->state[0] = state0;
+	sp->state[1] = state1;
+	atomic_init(&sp->quit, 0);
+	atomic_init(&sp->sim_stalls, 0);
+
+	if (sem_init(&sp->free, 0, 2) < 0)
+		return -1;
+	if (sem_init(&sp->ready, 0, 0) < 0) {
+		sem_destroy(&sp->free);
+		return -1;
+	}
+	if (pthread_create(&sp->thread, NULL, sim_thread, sp) != 0) {
+		sem_destroy(&sp->ready);
+		sem_destroy(&sp->free);
+		return -1;
+	}
+
+	return 0;
+}
+
+void
+sim_pipeline_stop(struct sim_pipeline *sp)
+{
+	atomic_store_explicit(&sp->quit, 1, memory_order_release);
+	/* wakes the worker if it waits for a buffer */
+	sem_post(&sp->free);
+	pthread_join(sp->thread, NULL);
+
+	sem_destroy(&sp->ready);
+	sem_destroy(&sp->free);
+}
+
+void *
+sim_pipeline_acquire(struct sim_pipeline *sp)
+{
+	sp->stats.render_stalls += wait_counted(&sp->ready);
+
+	return sp->state[sp->read];
+}
+
+void
+sim_pipeline_release(struct sim_pipeline *sp)
+{
+	sp->read ^= 1;
+	sem_post(&sp->free);
+
+	if (++sp->stats.frames < SIM_REPORT_FRAMES)
+		return;
+	sp->stats.sim_stalls = atomic_exchange_explicit(&sp->sim_stalls, 0,
+							memory_order_relaxed);
+#ifdef DEBUG
+	fprintf(stderr, "sim pipeline: draw stalled %u, simulation stalled "
+		"%u times in %u frames\n", sp->stats.render_stalls,
+		sp->stats.sim_stalls, sp->stats.frames);
+#endif
+	sp->last = sp->stats;
+	memset(&sp->stats, 0, sizeof(sp->stats));
+}
+
+void
+sim_pipeline_get_stats(struct sim_pipeline *sp,
+		       struct sim_pipeline_stats *stats)
+{
+	*stats = sp->last;
+}
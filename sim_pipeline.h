@@ -0,0 +1,80 @@
+/*
+ * Copyright © 2022 IGEL Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *    Tomohito Esaki <etom@igel.co.jp>
+ */
+#ifndef SIM_PIPELINE_H
+#define SIM_PIPELINE_H
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+
+/*
+ * Simulation running one frame ahead of rendering.
+ *
+ * A worker thread calls simulate() to write frame N + 1 into one of two
+ * state buffers while the render thread draws frame N from the other, so
+ * a frame costs about the longer of the two instead of their sum. The
+ * buffers are handed over through two semaphores and never locked: an
+ * uncontended post or wait is a single atomic operation, and a side only
+ * sleeps when the other one is a whole buffer behind. Such a wait counts
+ * as a stall of the waiting side.
+ */
+
+struct sim_pipeline_stats {
+	unsigned int render_stalls;	/* draw waited for the simulation */
+	unsigned int sim_stalls;	/* simulation waited for the draw */
+	unsigned int frames;
+};
+
+struct sim_pipeline {
+	void (*simulate)(void *data, void *state);
+	void *data;
+	void *state[2];
+	sem_t free;		/* buffers simulate() may write */
+	sem_t ready;		/* simulated buffers not drawn yet */
+	int read;		/* buffer of the next acquire */
+	atomic_int quit;
+	atomic_uint sim_stalls;
+	pthread_t thread;
+	struct sim_pipeline_stats stats;
+	struct sim_pipeline_stats last;
+};
+
+/* Starts the worker, which begins with state0 right away */
+int sim_pipeline_start(struct sim_pipeline *sp,
+		       void (*simulate)(void *data, void *state), void *data,
+		       void *state0, void *state1);
+/* Lets the worker finish its frame and joins it */
+void sim_pipeline_stop(struct sim_pipeline *sp);
+
+/* Waits for the next simulated frame; states come in simulation order */
+void *sim_pipeline_acquire(struct sim_pipeline *sp);
+/* Hands the acquired state back once nothing reads it any more */
+void sim_pipeline_release(struct sim_pipeline *sp);
+
+void sim_pipeline_get_stats(struct sim_pipeline *sp,
+			    struct sim_pipeline_stats *stats);
+
+#endif
@@ -0,0 +1,348 @@
+/*
+ * Copyright © 2022 IGEL Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *    Tomohito Esaki <etom@igel.co.jp>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <GLES3/gl3.h>
+
+#include "gl_state.h"
+#include "shader.h"
+#include "sprite_batch.h"
+
+#define QUAD_BYTES	(4 * sizeof(struct sprite_vertex))
+/* Frames per stats period, and per debug report */
+#define SPRITE_REPORT_FRAMES	300
+
+#define TO_STRING(x)	#x
+static const char *vert_shader_text = TO_STRING(
+	attribute vec2 position;
+	attribute vec2 texcoord;
+	varying vec2 texcoordVarying;
+	uniform vec2 screenSize;
+	uniform vec2 texSize;
+	void main()
+	{
+		gl_Position = vec4(position * 2.0 / screenSize - 1.0,
+				   0.0, 1.0);
+		texcoordVarying = texcoord / texSize;
+	});
+
+static const char *frag_shader_text = TO_STRING(
+	precision mediump float;
+	varying vec2 texcoordVarying;
+	uniform sampler2D texture;
+	void main()
+	{
+		gl_FragColor = texture2D(texture, texcoordVarying);
+	});
+
+static void
+init_index(struct sprite_batch *batch)
+{
+	GLushort *index;
+	int i;
+
+	index = malloc(batch->capacity * 6 * sizeof(*index));
+	assert(index);
+	for (i = 0; i < batch->capacity; i++) {
+		index[i * 6 + 0] = i * 4 + 0;
+		index[i * 6 + 1] = i * 4 + 1;
+		index[i * 6 + 2] = i * 4 + 2;
+		index[i * 6 + 3] = i * 4 + 1;
+		index[i * 6 + 4] = i * 4 + 2;
+		index[i * 6 + 5] = i * 4 + 3;
+	}
+
+	glGenBuffers(1, &batch->index);
+	gl_state_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, batch->index);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+		     batch->capacity * 6 * sizeof(*index), index,
+		     GL_STATIC_DRAW);
+	free(index);
+}
+
+int
+sprite_batch_init(struct sprite_batch *batch, int capacity)
+{
+	struct shader_info shader;
+
+	assert(capacity > 0 && capacity <= SPRITE_BATCH_MAX_QUADS);
+	memset(batch, 0, sizeof(*batch));
+	batch->capacity = capacity;
+#ifdef DEBUG
+	batch->count_pixels = 1;
+#endif
+
+	memset(&shader, 0, sizeof(shader));
+	shader.vertex = vert_shader_text;
+	shader.fragment = frag_shader_text;
+	batch->program = shader_build_program(&shader);
+	if (!batch->program)
+		return -1;
+
+	batch->sh_position = glGetAttribLocation(batch->program, "position");
+	batch->sh_texcoord = glGetAttribLocation(batch->program, "texcoord");
+	batch->sh_screen_size = glGetUniformLocation(batch->program,
+						     "screenSize");
+	batch->sh_tex_size = glGetUniformLocation(batch->program, "texSize");
+	gl_state_use_program(batch->program);
+	glUniform1i(glGetUniformLocation(batch->program, "texture"), 0);
+
+	init_index(batch);
+
+	/* frames bigger than this fall back to drawing from the bins */
+	if (shader_gl_version() >= 30)
+		batch->use_stream =
+			stream_buffer_init(&batch->stream,
+					   4 * capacity * QUAD_BYTES) == 0;
+
+	return 0;
+}
+
+void
+sprite_batch_fini(struct sprite_batch *batch)
+{
+	int i;
+
+	for (i = 0; i < batch->n_bins; i++)
+		free(batch->bins[i].vertex);
+	if (batch->use_stream)
+		stream_buffer_fini(&batch->stream);
+	gl_state_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	gl_state_delete_buffers(1, &batch->index);
+	gl_state_use_program(0);
+	glDeleteProgram(batch->program);
+}
+
+static int
+state_compare(const struct sprite_state *a, const struct sprite_state *b)
+{
+	if (a->layer != b->layer)
+		return a->layer < b->layer ? -1 : 1;
+	if (a->blend != b->blend)
+		return a->blend < b->blend ? -1 : 1;
+	if (a->texture != b->texture)
+		return a->texture < b->texture ? -1 : 1;
+	return 0;
+}
+
+int
+sprite_batch_add_state(struct sprite_batch *batch,
+		       const struct sprite_state *state)
+{
+	struct sprite_bin *bin;
+	int i, n = batch->n_bins;
+
+	if (n == SPRITE_BATCH_MAX_STATES)
+		return -1;
+
+	bin = &batch->bins[n];
+	bin->vertex = malloc(batch->capacity * QUAD_BYTES);
+	if (!bin->vertex)
+		return -1;
+	bin->state = *state;
+	bin->count = 0;
+
+	/* keep order sorted, equal states in creation order */
+	for (i = n; i > 0; i--) {
+		if (state_compare(&batch->bins[batch->order[i - 1]].state,
+				  state) <= 0)
+			break;
+		batch->order[i] = batch->order[i - 1];
+	}
+	batch->order[i] = n;
+	batch->n_bins++;
+
+	return n;
+}
+
+void
+sprite_batch_add_quads(struct sprite_batch *batch, int state,
+		       const struct sprite_vertex *quads, int count)
+{
+	struct sprite_bin *bin = &batch->bins[state];
+	int n;
+
+	while (count > 0) {
+		if (bin->count == batch->capacity)
+			sprite_batch_flush(batch);
+		n = batch->capacity - bin->count;
+		n = count < n ? count : n;
+		memcpy(&bin->vertex[bin->count * 4], quads, n * QUAD_BYTES);
+		bin->count += n;
+		quads += n * 4;
+		count -= n;
+	}
+}
+
+void
+sprite_batch_use(struct sprite_batch *batch, int state)
+{
+	const struct sprite_state *s = &batch->bins[state].state;
+
+	gl_state_use_program(batch->program);
+	glUniform2f(batch->sh_screen_size, batch->width, batch->height);
+	glUniform2f(batch->sh_tex_size, s->tex_width, s->tex_height);
+	gl_state_active_texture(GL_TEXTURE0);
+	gl_state_bind_texture(GL_TEXTURE_2D, s->texture);
+	if (s->blend == SPRITE_BLEND_ALPHA) {
+		gl_state_enable(GL_BLEND);
+		gl_state_blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	} else {
+		gl_state_disable(GL_BLEND);
+	}
+}
+
+static inline int
+clip(int v, int max)
+{
+	return v < 0 ? 0 : v > max ? max : v;
+}
+
+/* Screen area covered by the quads of bin */
+static unsigned long long
+bin_pixels(struct sprite_batch *batch, const struct sprite_bin *bin)
+{
+	const struct sprite_vertex *v;
+	unsigned long long pixels = 0;
+	int i, w, h;
+
+	for (i = 0; i < bin->count; i++) {
+		v = &bin->vertex[i * 4];
+		w = clip(v[1].x, batch->width) - clip(v[2].x, batch->width);
+		h = clip(v[1].y, batch->height) - clip(v[2].y, batch->height);
+		if (w > 0 && h > 0)
+			pixels += w * h;
+	}
+
+	return pixels;
+}
+
+/* Copies the bins into the stream in draw order, returns the first offset */
+static GLintptr
+stream_bins(struct sprite_batch *batch, int quads)
+{
+	struct sprite_bin *bin;
+	GLintptr offset;
+	char *p;
+	int i;
+
+	p = stream_buffer_map(&batch->stream, quads * QUAD_BYTES, &offset);
+	if (!p)
+		return -1;
+	for (i = 0; i < batch->n_bins; i++) {
+		bin = &batch->bins[batch->order[i]];
+		memcpy(p, bin->vertex, bin->count * QUAD_BYTES);
+		p += bin->count * QUAD_BYTES;
+	}
+	stream_buffer_unmap(&batch->stream, quads * QUAD_BYTES);
+
+	return offset;
+}
+
+void
+sprite_batch_flush(struct sprite_batch *batch)
+{
+	const GLsizei stride = sizeof(struct sprite_vertex);
+	struct sprite_bin *bin;
+	const char *vertex;
+	unsigned long long pixels;
+	GLintptr offset = -1;
+	int i, quads = 0;
+
+	for (i = 0; i < batch->n_bins; i++)
+		quads += batch->bins[i].count;
+	if (!quads)
+		return;
+
+	if (batch->use_stream)
+		offset = stream_bins(batch, quads);
+	gl_state_bind_buffer(GL_ARRAY_BUFFER,
+			     offset < 0 ? 0 : batch->stream.buffer);
+	gl_state_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, batch->index);
+	glEnableVertexAttribArray(batch->sh_position);
+	glEnableVertexAttribArray(batch->sh_texcoord);
+
+	for (i = 0; i < batch->n_bins; i++) {
+		bin = &batch->bins[batch->order[i]];
+		if (!bin->count)
+			continue;
+
+		vertex = offset < 0 ? (const char *)bin->vertex :
+			(const char *)offset;
+		sprite_batch_use(batch, batch->order[i]);
+		gl_state_vertex_attrib_pointer(batch->sh_position, 2, GL_SHORT,
+					       GL_FALSE, stride, vertex);
+		gl_state_vertex_attrib_pointer(batch->sh_texcoord, 2, GL_SHORT,
+					       GL_FALSE, stride,
+					       vertex + 2 * sizeof(GLshort));
+		glDrawElements(GL_TRIANGLES, bin->count * 6,
+			       GL_UNSIGNED_SHORT, 0);
+
+		batch->stats.draws++;
+		if (batch->count_pixels) {
+			pixels = bin_pixels(batch, bin);
+			if (bin->state.blend == SPRITE_BLEND_NONE)
+				batch->stats.opaque_pixels += pixels;
+			else
+				batch->stats.blended_pixels += pixels;
+		}
+
+		if (offset >= 0)
+			offset += bin->count * QUAD_BYTES;
+		bin->count = 0;
+	}
+}
+
+void
+sprite_batch_end(struct sprite_batch *batch)
+{
+	sprite_batch_flush(batch);
+	if (batch->use_stream)
+		stream_buffer_end_frame(&batch->stream);
+
+	if (++batch->stats.frames < SPRITE_REPORT_FRAMES)
+		return;
+#ifdef DEBUG
+	fprintf(stderr, "sprite batch: %llu opaque, %llu blended pixels/frame, "
+		"%u draws in %u frames\n",
+		batch->stats.opaque_pixels / batch->stats.frames,
+		batch->stats.blended_pixels / batch->stats.frames,
+		batch->stats.draws, batch->stats.frames);
+#endif
+	batch->last = batch->stats;
+	memset(&batch->stats, 0, sizeof(batch->stats));
+}
+
+void
+sprite_batch_get_stats(struct sprite_batch *batch,
+		       struct sprite_batch_stats *stats)
+{
+	*stats = batch->last;
+}
@@ -0,0 +1,169 @@
+/*
+ * Copyright © 2022 IGEL Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *    Tomohito Esaki <etom@igel.co.jp>
+ */
+
+#ifndef SPRITE_BATCH_H
+#define SPRITE_BATCH_H
+
+#include "stream_buffer.h"
+
+/*
+ * Batched screen-space sprites.
+ *
+ * A sprite is a quad of 4 packed vertices, pixel position and texel
+ * coordinates, drawn through one static index buffer shared by every
+ * quad. Quads are queued in the bin of their state (layer, blend mode and
+ * texture), and sprite_batch_flush() draws the bins sorted by that state:
+ * layers are drawn bottom up, and submission order is only kept within a
+ * bin. A bin that fills up flushes the whole batch.
+ *
+ * State changes go through gl_state. Vertex data is streamed with
+ * stream_buffer on ES 3.0 and drawn from the bins on ES 2.0.
+ *
+ * SPRITE_BLEND_NONE is for opaque sprites: fragments that blending would
+ * not change are written without reading back the target. Opaque bins
+ * belong in their own layer under the blended ones. The screen area of
+ * both kinds is counted for the stats while count_pixels is set, which
+ * DEBUG builds do by default; it costs a walk over every flushed quad.
+ */
+
+#define SPRITE_BATCH_MAX_STATES	8
+/* Quads addressable with 16-bit indices */
+#define SPRITE_BATCH_MAX_QUADS	16384
+
+enum sprite_blend {
+	SPRITE_BLEND_NONE,
+	SPRITE_BLEND_ALPHA,
+};
+
+struct sprite_state {
+	int layer;
+	enum sprite_blend blend;
+	GLuint texture;
+	int tex_width, tex_height;
+};
+
+struct sprite_vertex {
+	GLshort x, y;
+	GLshort u, v;
+};
+
+struct sprite_batch_stats {
+	unsigned long long opaque_pixels;	/* on-screen quad area */
+	unsigned long long blended_pixels;
+	unsigned int draws;
+	unsigned int frames;
+};
+
+struct sprite_bin {
+	struct sprite_state state;
+	struct sprite_vertex *vertex;
+	int count;
+};
+
+struct sprite_batch {
+	GLuint program;
+	GLuint sh_position;
+	GLuint sh_texcoord;
+	GLuint sh_screen_size;
+	GLuint sh_tex_size;
+	GLuint index;
+	struct stream_buffer stream;
+	int use_stream;
+	int capacity;
+	int width, height;
+	struct sprite_bin bins[SPRITE_BATCH_MAX_STATES];
+	int n_bins;
+	int order[SPRITE_BATCH_MAX_STATES];	/* bins sorted by state */
+	int count_pixels;
+	struct sprite_batch_stats stats;
+	struct sprite_batch_stats last;
+};
+
+/* capacity is the number of quads each bin holds before a flush */
+int sprite_batch_init(struct sprite_batch *batch, int capacity);
+void sprite_batch_fini(struct sprite_batch *batch);
+
+/* Adds a bin for state, returns its handle for sprite_batch_add() or -1 */
+int sprite_batch_add_state(struct sprite_batch *batch,
+			   const struct sprite_state *state);
+
+/* Starts a frame drawn to a width x height target */
+static inline void
+sprite_batch_begin(struct sprite_batch *batch, int width, int height)
+{
+	batch->width = width;
+	batch->height = height;
+}
+
+/* Draws and empties all bins */
+void sprite_batch_flush(struct sprite_batch *batch);
+/* Flushes and closes the frame; call after the last flush of the frame */
+void sprite_batch_end(struct sprite_batch *batch);
+
+/* Counters summed over the last report period, quads drawn by flushes only */
+void sprite_batch_get_stats(struct sprite_batch *batch,
+			    struct sprite_batch_stats *stats);
+
+/* Queues count quads written with sprite_quad() elsewhere */
+void sprite_batch_add_quads(struct sprite_batch *batch, int state,
+			    const struct sprite_vertex *quads, int count);
+
+/*
+ * Binds the program and the given state, for callers drawing their own
+ * vertices in the sprite_vertex format.
+ */
+void sprite_batch_use(struct sprite_batch *batch, int state);
+
+/*
+ * Writes the 4 vertices of the window rectangle (x0, y0)-(x1, y1), y up,
+ * showing the texels (u0, v0)-(u1, v1), v down, so that the texture
+ * appears upright.
+ */
+static inline void
+sprite_quad(struct sprite_vertex *v, int x0, int y0, int x1, int y1, int u0,
+	    int v0, int u1, int v1)
+{
+	v[0] = (struct sprite_vertex){ x0, y1, u0, v0 };
+	v[1] = (struct sprite_vertex){ x1, y1, u1, v0 };
+	v[2] = (struct sprite_vertex){ x0, y0, u0, v1 };
+	v[3] = (struct sprite_vertex){ x1, y0, u1, v1 };
+}
+
+/* Queues a sprite_quad() */
+static inline void
+sprite_batch_add(struct sprite_batch *batch, int state, int x0, int y0,
+		 int x1, int y1, int u0, int v0, int u1, int v1)
+{
+	struct sprite_bin *bin = &batch->bins[state];
+
+	if (bin->count == batch->capacity)
+		sprite_batch_flush(batch);
+
+	sprite_quad(&bin->vertex[bin->count++ * 4], x0, y0, x1, y1, u0, v0,
+		    u1, v1);
+}
+
+#endif
@@ -0,0 +1,189 @@
+/*
+ * Copyright © 2022 IGEL Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *    Tomohito Esaki <etom@igel.co.jp>
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <GLES3/gl3.h>
+
+#include "gl_state.h"
+#include "stream_buffer.h"
+
+/* Enough for any vertex attribute type */
+#define STREAM_ALIGN		16
+/* Frames per stats period, and per debug report */
+#define STREAM_REPORT_FRAMES	300
+
+#define ALIGN_UP(x, a)	(((x) + (a) - 1) / (a) * (a))
+
+int
+stream_buffer_init(struct stream_buffer *sb, GLsizeiptr size)
+{
+	memset(sb, 0, sizeof(*sb));
+	sb->size = ALIGN_UP(size, STREAM_ALIGN);
+
+	glGenBuffers(1, &sb->buffer);
+	gl_state_bind_buffer(GL_ARRAY_BUFFER, sb->buffer);
+	glBufferData(GL_ARRAY_BUFFER, sb->size, NULL, GL_STREAM_DRAW);
+	if (glGetError() != GL_NO_ERROR) {
+		stream_buffer_fini(sb);
+		return -1;
+	}
+
+	return 0;
+}
+
+void
+stream_buffer_fini(struct stream_buffer *sb)
+{
+	int i;
+
+	for (i = 0; i < sb->n_frames; i++)
+		glDeleteSync(sb->frames[(sb->first + i) %
+					STREAM_BUFFER_FRAMES].fence);
+	gl_state_bind_buffer(GL_ARRAY_BUFFER, 0);
+	gl_state_delete_buffers(1, &sb->buffer);
+	memset(sb, 0, sizeof(*sb));
+}
+
+/* Waits for the oldest in-flight frame and releases its space */
+static void
+retire_frame(struct stream_buffer *sb)
+{
+	struct stream_frame *f = &sb->frames[sb->first];
+	GLenum ret;
+
+	ret = glClientWaitSync(f->fence, 0, 0);
+	if (ret == GL_TIMEOUT_EXPIRED) {
+		sb->stats.stalls++;
+		do {
+			ret = glClientWaitSync(f->fence,
+					       GL_SYNC_FLUSH_COMMANDS_BIT,
+					       1000000000);
+		} while (ret == GL_TIMEOUT_EXPIRED);
+	}
+	glDeleteSync(f->fence);
+
+	sb->used -= f->bytes;
+	sb->first = (sb->first + 1) % STREAM_BUFFER_FRAMES;
+	sb->n_frames--;
+}
+
+void *
+stream_buffer_map(struct stream_buffer *sb, GLsizeiptr size,
+		  GLintptr *offset)
+{
+	GLintptr start = ALIGN_UP(sb->head, STREAM_ALIGN);
+	GLsizeiptr need;
+
+	if (size > sb->size)
+		return NULL;
+
+	/* never split a range, skip the tail of the ring instead */
+	if (start + size > sb->size)
+		start = 0;
+	need = (start >= sb->head ? start - sb->head :
+		sb->size - sb->head) + size;
+
+	while (sb->used + sb->frame_bytes + need > sb->size) {
+		if (!sb->n_frames)
+			return NULL;
+		retire_frame(sb);
+	}
+
+	sb->frame_bytes += need - size;
+	sb->head = start;
+	*offset = start;
+
+	gl_state_bind_buffer(GL_ARRAY_BUFFER, sb->buffer);
+	return glMapBufferRange(GL_ARRAY_BUFFER, start, size,
+				GL_MAP_WRITE_BIT |
+				GL_MAP_UNSYNCHRONIZED_BIT |
+				GL_MAP_INVALIDATE_RANGE_BIT |
+				GL_MAP_FLUSH_EXPLICIT_BIT);
+}
+
+void
+stream_buffer_unmap(struct stream_buffer *sb, GLsizeiptr used)
+{
+	gl_state_bind_buffer(GL_ARRAY_BUFFER, sb->buffer);
+	if (used > 0)
+		glFlushMappedBufferRange(GL_ARRAY_BUFFER, 0, used);
+	glUnmapBuffer(GL_ARRAY_BUFFER);
+
+	sb->head += used;
+	sb->frame_bytes += used;
+	sb->stats.bytes += used;
+}
+
+GLintptr
+stream_buffer_upload(struct stream_buffer *sb, const void *data,
+		     GLsizeiptr size)
+{
+	GLintptr offset;
+	void *p;
+
+	p = stream_buffer_map(sb, size, &offset);
+	if (!p)
+		return -1;
+	memcpy(p, data, size);
+	stream_buffer_unmap(sb, size);
+
+	return offset;
+}
+
+void
+stream_buffer_end_frame(struct stream_buffer *sb)
+{
+	struct stream_frame *f;
+
+	if (sb->n_frames == STREAM_BUFFER_FRAMES)
+		retire_frame(sb);
+
+	f = &sb->frames[(sb->first + sb->n_frames) % STREAM_BUFFER_FRAMES];
+	f->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	f->bytes = sb->frame_bytes;
+	sb->n_frames++;
+	sb->used += sb->frame_bytes;
+	sb->frame_bytes = 0;
+
+	if (++sb->stats.frames < STREAM_REPORT_FRAMES)
+		return;
+#ifdef DEBUG
+	fprintf(stderr, "stream buffer: %llu bytes/frame, %u stalls in %u "
+		"frames\n", sb->stats.bytes / sb->stats.frames,
+		sb->stats.stalls, sb->stats.frames);
+#endif
+	sb->last = sb->stats;
+	memset(&sb->stats, 0, sizeof(sb->stats));
+}
+
+void
+stream_buffer_get_stats(struct stream_buffer *sb,
+			struct stream_buffer_stats *stats)
+{
+	*stats = sb->last;
+}
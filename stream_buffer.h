@@ -0,0 +1,94 @@
+/*
+ * Copyright © 2022 IGEL Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *    Tomohito Esaki <etom@igel.co.jp>
+ */
+
+#ifndef STREAM_BUFFER_H
+#define STREAM_BUFFER_H
+
+/*
+ * Ring of vertex data streamed to the GPU.
+ *
+ * Each frame's writes are appended to one large GL_ARRAY_BUFFER and
+ * mapped with GL_MAP_UNSYNCHRONIZED_BIT, so the driver neither copies
+ * nor synchronizes. stream_buffer_end_frame() puts a fence behind the
+ * frame; space is only reused once the fence of the frame that wrote it
+ * has signaled. Waiting on a fence that is still pending counts as a
+ * stall.
+ *
+ * The buffer is bound through gl_state, so callers mixing raw GL buffer
+ * binds must invalidate the cache as usual. Needs OpenGL ES 3.0.
+ */
+
+#define STREAM_BUFFER_FRAMES	4
+
+struct stream_buffer_stats {
+	unsigned long long bytes;
+	unsigned int stalls;
+	unsigned int frames;
+};
+
+struct stream_frame {
+	GLsync fence;
+	GLsizeiptr bytes;
+};
+
+struct stream_buffer {
+	GLuint buffer;
+	GLsizeiptr size;
+	GLintptr head;
+	GLsizeiptr used;	/* bytes of in-flight frames, with padding */
+	GLsizeiptr frame_bytes;	/* bytes of the frame being written */
+	struct stream_frame frames[STREAM_BUFFER_FRAMES];
+	int first;
+	int n_frames;
+	struct stream_buffer_stats stats;
+	struct stream_buffer_stats last;
+};
+
+int stream_buffer_init(struct stream_buffer *sb, GLsizeiptr size);
+void stream_buffer_fini(struct stream_buffer *sb);
+
+/*
+ * Reserves size bytes and maps them for writing; offset receives their
+ * position in the buffer for vertex attribute pointers. Returns NULL if
+ * size does not fit in the ring. Only one range can be mapped at a time.
+ */
+void *stream_buffer_map(struct stream_buffer *sb, GLsizeiptr size,
+			GLintptr *offset);
+/* Ends the mapping; only the first used bytes of the range are kept */
+void stream_buffer_unmap(struct stream_buffer *sb, GLsizeiptr used);
+
+/* Copies data into the ring, returns its offset or -1 */
+GLintptr stream_buffer_upload(struct stream_buffer *sb, const void *data,
+			      GLsizeiptr size);
+
+/* Fences the frame's writes; call once per frame after its last draw */
+void stream_buffer_end_frame(struct stream_buffer *sb);
+
+/* Counters summed over the last report period */
+void stream_buffer_get_stats(struct stream_buffer *sb,
+			     struct stream_buffer_stats *stats);
+
+#endif
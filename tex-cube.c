@@ -28,17 +28,18 @@
 #include <string.h>
 #include <math.h>
 #include <assert.h>
-#include <cairo.h>
 
 #include <GLES2/gl2.h>
 
 #include "shader.h"
+#include "atlas.h"
+#include "gl_state.h"
+#include "damage.h"
 #include "common.h"
 
 #define WINDOW_WIDTH		500
 #define WINDOW_HEIGHT		500
-#define TEX_WIDTH               256
-#define TEX_HEIGHT              256
+#define ATLAS_FILE		"images/atlas.bin"
 
 struct gl_info {
 	GLuint sh_position;
@@ -46,22 +47,27 @@ struct gl_info {
 	GLuint sh_texture;
 	GLuint sh_proj;
 	GLuint sh_model;
+	GLuint sh_tex_rect;
 	GLuint texture;
+	/* images/back.png in the atlas: offset and size in texture units */
+	GLfloat tex_rect[4];
 	GLuint buffers[3];
 	GLuint program;
+	struct damage damage;
 };
 
 #define TO_STRING(x)	#x
 static const char *vert_shader_text = TO_STRING(
 	uniform mat4 proj;
 	uniform mat4 model;
+	uniform vec4 texRect;
 	attribute vec3 position;
 	attribute vec2 texcoord;
 	varying vec2 texcoordVarying;
 	void main()
 	{
 		gl_Position = proj * model * vec4(position, 1.0);
-		texcoordVarying = texcoord;
+		texcoordVarying = texRect.xy + texcoord * texRect.zw;
 	});
 
 static const char *frag_shader_text = TO_STRING(
@@ -69,39 +75,26 @@ static const char *frag_shader_text = TO_STRING(
 	varying vec2 texcoordVarying;
 	uniform sampler2D texture;
 	void main() {
-		gl_FragColor = texture2D(texture, texcoordVarying).bgra;
+		gl_FragColor = texture2D(texture, texcoordVarying);
 	});
 
-static GLuint
-create_texture()
+static void
+load_texture(struct gl_info *gl)
 {
-	cairo_surface_t *bg;
-	cairo_surface_t *img;
-	cairo_t *cr;
-	unsigned char *data;
-	GLuint texture;
-
-	bg = cairo_image_surface_create_from_png("images/back.png");
-
-	img = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
-					 TEX_WIDTH, TEX_HEIGHT);
-	cr = cairo_create(img);
-
-	cairo_set_source_surface(cr, bg, 0, 0);
-	cairo_paint(cr);
-	cairo_surface_flush(img);
-	cairo_destroy(cr);
-
-	data = cairo_image_surface_get_data(img);
-	glGenTextures(1, &texture);
-	glBindTexture(GL_TEXTURE_2D, texture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, TEX_WIDTH, TEX_HEIGHT, 0,
-		     GL_RGBA, GL_UNSIGNED_BYTE, data);
-
-	cairo_surface_destroy(bg);
-	cairo_surface_destroy(img);
-
-	return texture;
+	const struct atlas_entry *back;
+	struct atlas atlas;
+	int ret;
+
+	ret = atlas_open_best(&atlas, ATLAS_FILE);
+	assert(ret == 0);
+	back = atlas_find(&atlas, "back");
+	assert(back);
+	gl->tex_rect[0] = (GLfloat)back->x / atlas.header->width;
+	gl->tex_rect[1] = (GLfloat)back->y / atlas.header->height;
+	gl->tex_rect[2] = (GLfloat)back->w / atlas.header->width;
+	gl->tex_rect[3] = (GLfloat)back->h / atlas.header->height;
+	gl->texture = atlas_create_texture(&atlas);
+	atlas_close(&atlas);
 }
 
 static void init_gl_buffer(struct gl_info *gl)
@@ -198,7 +191,7 @@ init_gl(void *data)
 	struct gl_info *gl = data;
 	struct shader_info shader;
 
-	gl->texture = create_texture();
+	load_texture(gl);
 
 	memset(&shader, 0x0, sizeof(shader));
 	shader.vertex = vert_shader_text;
@@ -207,7 +200,6 @@ init_gl(void *data)
 	assert(gl->program);
 	glUseProgram(gl->program);
 
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glEnable(GL_BLEND);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
@@ -216,6 +208,8 @@ init_gl(void *data)
 	gl->sh_texture = glGetUniformLocation(gl->program, "texture");
 	gl->sh_proj = glGetUniformLocation(gl->program, "proj");
 	gl->sh_model = glGetUniformLocation(gl->program, "model");
+	gl->sh_tex_rect = glGetUniformLocation(gl->program, "texRect");
+	glUniform4fv(gl->sh_tex_rect, 1, gl->tex_rect);
 	glEnableVertexAttribArray(gl->sh_position);
 	glEnableVertexAttribArray(gl->sh_texcoord);
 
@@ -224,6 +218,7 @@ init_gl(void *data)
 	glCullFace(GL_BACK);
 
 	init_gl_buffer(gl);
+	damage_init(&gl->damage);
 }
 
 static void
@@ -231,8 +226,8 @@ deinit_gl(void *data)
 {
 	struct gl_info *gl = data;
 
-	glDeleteBuffers(3, gl->buffers);
-	glDeleteTextures(1, &gl->texture);
+	gl_state_delete_buffers(3, gl->buffers);
+	gl_state_delete_textures(1, &gl->texture);
 	glDeleteProgram(gl->program);
 }
 
@@ -352,6 +347,10 @@ redraw(void *data, struct rect *damage)
 	};
 	static GLfloat rot_x = 0;
 	static GLfloat rot_y = 0;
+	static const GLfloat cube_min[3] = { -0.5, -0.5, -0.5 };
+	static const GLfloat cube_max[3] = { 0.5, 0.5, 0.5 };
+	GLfloat mvp[4][4];
+	struct rect rect;
 
 	rot_x += 0.5;
 	rot_y += 0.3;
@@ -370,24 +369,26 @@ redraw(void *data, struct rect *damage)
 	glClearColor(0.0, 0.0, 0.0, 0.5);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, gl->texture);
+	gl_state_active_texture(GL_TEXTURE0);
+	gl_state_bind_texture(GL_TEXTURE_2D, gl->texture);
 	glUniform1i(gl->sh_texture, 0);
 
-	glBindBuffer(GL_ARRAY_BUFFER, gl->buffers[0]);
-	glVertexAttribPointer(gl->sh_position, 3, GL_FLOAT, GL_FALSE, 0, 0);
+	gl_state_bind_buffer(GL_ARRAY_BUFFER, gl->buffers[0]);
+	gl_state_vertex_attrib_pointer(gl->sh_position, 3, GL_FLOAT, GL_FALSE,
+				       0, 0);
 
-	glBindBuffer(GL_ARRAY_BUFFER, gl->buffers[1]);
-	glVertexAttribPointer(gl->sh_texcoord, 2, GL_FLOAT, GL_FALSE, 0, 0);
+	gl_state_bind_buffer(GL_ARRAY_BUFFER, gl->buffers[1]);
+	gl_state_vertex_attrib_pointer(gl->sh_texcoord, 2, GL_FLOAT, GL_FALSE,
+				       0, 0);
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gl->buffers[2]);
+	gl_state_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, gl->buffers[2]);
 	glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_SHORT, 0);
 
-	/* return damage region */
-	damage->x = WINDOW_WIDTH / 4;
-	damage->y = WINDOW_HEIGHT / 4;
-	damage->width = WINDOW_WIDTH / 2;
-	damage->height = WINDOW_HEIGHT / 2;
+	/* return damage region, where the cube is and was */
+	mult_matrix(projection, model, mvp);
+	damage_project_box(mvp, cube_min, cube_max, WINDOW_WIDTH,
+			   WINDOW_HEIGHT, &rect);
+	damage_update(&gl->damage, &rect, WINDOW_WIDTH, WINDOW_HEIGHT, damage);
 }
 
 int
@@ -0,0 +1,173 @@
+/*
+ * Copyright © 2022 IGEL Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *    Tomohito Esaki <etom@igel.co.jp>
+ */
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <assert.h>
+
+#include <GLES3/gl3.h>
+
+#include "gl_state.h"
+#include "text.h"
+
+#define QUAD_BYTES	(4 * sizeof(struct sprite_vertex))
+
+void
+text_font_init_grid(struct text_font *font, GLuint texture, int tex_width,
+		    int tex_height, int x, int y, int cell_width,
+		    int cell_height, int columns, const char *chars)
+{
+	unsigned char c;
+	int i;
+
+	memset(font, 0, sizeof(*font));
+	font->texture = texture;
+	font->tex_width = tex_width;
+	font->tex_height = tex_height;
+	font->x = x;
+	font->y = y;
+	font->cell_width = cell_width;
+	font->cell_height = cell_height;
+	font->columns = columns;
+
+	for (i = 0; i < TEXT_FONT_CHARS; i++)
+		font->cell[i] = -1;
+	/* the first cell of a character wins */
+	for (i = 0; chars[i]; i++) {
+		c = chars[i];
+		if (c < TEXT_FONT_CHARS && font->cell[c] < 0)
+			font->cell[c] = i;
+	}
+}
+
+void
+text_label_init(struct text_label *label, const struct text_font *font,
+		int x, int y, enum text_align align)
+{
+	memset(label, 0, sizeof(*label));
+	label->font = font;
+	label->x = x;
+	label->y = y;
+	label->align = align;
+
+	glGenBuffers(1, &label->buffer);
+	gl_state_bind_buffer(GL_ARRAY_BUFFER, label->buffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(label->vertex), NULL,
+		     GL_DYNAMIC_DRAW);
+}
+
+void
+text_label_fini(struct text_label *label)
+{
+	gl_state_delete_buffers(1, &label->buffer);
+	label->buffer = 0;
+}
+
+static void
+write_glyph(struct text_label *label, int i, int len, unsigned char c)
+{
+	const struct text_font *font = label->font;
+	int cw = font->cell_width, ch = font->cell_height;
+	int cell = c < TEXT_FONT_CHARS ? font->cell[c] : -1;
+	int x, u, v;
+
+	if (cell < 0) {
+		memset(&label->vertex[i * 4], 0, QUAD_BYTES);
+		return;
+	}
+
+	if (label->align == TEXT_ALIGN_RIGHT)
+		x = label->x - (len - i) * cw;
+	else
+		x = label->x + i * cw;
+	u = font->x + cell % font->columns * cw;
+	v = font->y + cell / font->columns * ch;
+	sprite_quad(&label->vertex[i * 4], x, label->y, x + cw,
+		    label->y + ch, u, v, u + cw, v + ch);
+}
+
+void
+text_label_set(struct text_label *label, const char *text)
+{
+	int len = strnlen(text, TEXT_LABEL_MAX);
+	int i, first = len, last = -1;
+	/* right aligned text moves as a whole when its length changes */
+	int moved = label->align == TEXT_ALIGN_RIGHT && len != label->len;
+
+	for (i = 0; i < len; i++) {
+		if (!moved && i < label->len && label->text[i] == text[i])
+			continue;
+		write_glyph(label, i, len, text[i]);
+		label->text[i] = text[i];
+		first = i < first ? i : first;
+		last = i;
+	}
+	label->len = len;
+
+	if (last < first)
+		return;
+	gl_state_bind_buffer(GL_ARRAY_BUFFER, label->buffer);
+	glBufferSubData(GL_ARRAY_BUFFER, first * QUAD_BYTES,
+			(last - first + 1) * QUAD_BYTES,
+			&label->vertex[first * 4]);
+}
+
+void
+text_label_printf(struct text_label *label, const char *fmt, ...)
+{
+	char text[TEXT_LABEL_MAX + 1];
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(text, sizeof(text), fmt, ap);
+	va_end(ap);
+
+	text_label_set(label, text);
+}
+
+void
+text_label_draw(struct text_label *label, struct sprite_batch *batch,
+		int state)
+{
+	const GLsizei stride = sizeof(struct sprite_vertex);
+
+	if (!label->len)
+		return;
+	/* the quads are drawn through the batch's index buffer */
+	assert(batch->capacity >= TEXT_LABEL_MAX);
+
+	sprite_batch_use(batch, state);
+	gl_state_bind_buffer(GL_ARRAY_BUFFER, label->buffer);
+	gl_state_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, batch->index);
+	glEnableVertexAttribArray(batch->sh_position);
+	glEnableVertexAttribArray(batch->sh_texcoord);
+	gl_state_vertex_attrib_pointer(batch->sh_position, 2, GL_SHORT,
+				       GL_FALSE, stride, 0);
+	gl_state_vertex_attrib_pointer(batch->sh_texcoord, 2, GL_SHORT,
+				       GL_FALSE, stride,
+				       (const void *)(2 * sizeof(GLshort)));
+	glDrawElements(GL_TRIANGLES, label->len * 6, GL_UNSIGNED_SHORT, 0);
+}
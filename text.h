@@ -0,0 +1,108 @@
+/*
+ * Copyright © 2022 IGEL Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *    Tomohito Esaki <etom@igel.co.jp>
+ */
+#ifndef TEXT_H
+#define TEXT_H
+
+#include <stdint.h>
+
+#include "sprite_batch.h"
+
+/*
+ * Text from a monospace glyph atlas.
+ *
+ * A text_font maps ASCII characters to the cells of a grid in a texture:
+ * a strip that is already part of an image (text_font_init_grid()), or
+ * glyphs cairo rasterizes once at startup (text_font_rasterize() in
+ * text_cairo.c).
+ *
+ * A text_label owns a vertex buffer with one sprite quad per character and
+ * draws it with the sprite batch program. Setting its text only rewrites
+ * the quads of the characters that changed, so a counter costs no
+ * allocation, texture upload or rasterization per frame, only a few bytes
+ * of glBufferSubData when its value changes.
+ */
+
+#define TEXT_LABEL_MAX		16
+#define TEXT_FONT_CHARS		128
+
+enum text_align {
+	TEXT_ALIGN_LEFT,
+	TEXT_ALIGN_RIGHT,
+};
+
+struct text_font {
+	GLuint texture;
+	int tex_width, tex_height;
+	int x, y;			/* top left of the grid, in texels */
+	int cell_width, cell_height;
+	int columns;
+	int16_t cell[TEXT_FONT_CHARS];	/* cell of each character or -1 */
+};
+
+struct text_label {
+	const struct text_font *font;
+	GLuint buffer;
+	/* bottom left corner, or bottom right for TEXT_ALIGN_RIGHT, y up */
+	int x, y;
+	enum text_align align;
+	int len;
+	char text[TEXT_LABEL_MAX];
+	struct sprite_vertex vertex[TEXT_LABEL_MAX * 4];
+};
+
+/*
+ * Font of the cell_width x cell_height cells from (x, y) in texture, row by
+ * row with columns cells each. chars lists the character of every cell.
+ */
+void text_font_init_grid(struct text_font *font, GLuint texture,
+			 int tex_width, int tex_height, int x, int y,
+			 int cell_width, int cell_height, int columns,
+			 const char *chars);
+
+/*
+ * Rasterizes chars with cairo in white into a new texture, which the
+ * caller deletes. Returns -1 on failure.
+ */
+int text_font_rasterize(struct text_font *font, const char *family,
+			double size, const char *chars);
+
+void text_label_init(struct text_label *label, const struct text_font *font,
+		     int x, int y, enum text_align align);
+void text_label_fini(struct text_label *label);
+
+/* Characters the font lacks are left blank, text is cut at TEXT_LABEL_MAX */
+void text_label_set(struct text_label *label, const char *text);
+void text_label_printf(struct text_label *label, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+/*
+ * Draws the label right away with the given sprite batch state, which has
+ * to use the font's texture. Flush the batch first to draw above it.
+ */
+void text_label_draw(struct text_label *label, struct sprite_batch *batch,
+		     int state);
+
+#endif
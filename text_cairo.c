@@ -0,0 +1,117 @@
+/*
+ * Copyright © 2022 IGEL Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *    Tomohito Esaki <etom@igel.co.jp>
+ */
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <cairo.h>
+
+#include <GLES3/gl3.h>
+
+#include "gl_state.h"
+#include "text.h"
+
+#define RASTER_COLUMNS	16
+
+static cairo_t *
+create_context(cairo_surface_t *surface, const char *family, double size)
+{
+	cairo_t *cr = cairo_create(surface);
+
+	cairo_select_font_face(cr, family, CAIRO_FONT_SLANT_NORMAL,
+			       CAIRO_FONT_WEIGHT_NORMAL);
+	cairo_set_font_size(cr, size);
+
+	return cr;
+}
+
+int
+text_font_rasterize(struct text_font *font, const char *family, double size,
+		    const char *chars)
+{
+	cairo_surface_t *surface;
+	cairo_font_extents_t font_ext;
+	cairo_text_extents_t ext;
+	cairo_t *cr;
+	char glyph[2] = "";
+	int i, n = strlen(chars), columns, cw = 1, ch, width, height;
+	GLuint texture;
+
+	if (!n)
+		return -1;
+
+	/* measure on a scratch surface */
+	surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 1, 1);
+	cr = create_context(surface, family, size);
+	cairo_font_extents(cr, &font_ext);
+	for (i = 0; i < n; i++) {
+		glyph[0] = chars[i];
+		cairo_text_extents(cr, glyph, &ext);
+		if (ceil(ext.x_advance) > cw)
+			cw = ceil(ext.x_advance);
+	}
+	ch = ceil(font_ext.ascent + font_ext.descent);
+	cairo_destroy(cr);
+	cairo_surface_destroy(surface);
+
+	columns = n < RASTER_COLUMNS ? n : RASTER_COLUMNS;
+	width = columns * cw;
+	height = (n + columns - 1) / columns * ch;
+
+	surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width,
+					     height);
+	if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+		fprintf(stderr, "text: %s\n", cairo_status_to_string(
+				cairo_surface_status(surface)));
+		cairo_surface_destroy(surface);
+		return -1;
+	}
+	cr = create_context(surface, family, size);
+	cairo_set_source_rgb(cr, 1.0, 1.0, 1.0);
+	for (i = 0; i < n; i++) {
+		glyph[0] = chars[i];
+		cairo_move_to(cr, i % columns * cw,
+			      i / columns * ch + font_ext.ascent);
+		cairo_show_text(cr, glyph);
+	}
+	cairo_destroy(cr);
+	cairo_surface_flush(surface);
+
+	/* white glyphs, so cairo's BGRA byte order doesn't matter */
+	glGenTextures(1, &texture);
+	gl_state_bind_texture(GL_TEXTURE_2D, texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA,
+		     GL_UNSIGNED_BYTE, cairo_image_surface_get_data(surface));
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	cairo_surface_destroy(surface);
+
+	text_font_init_grid(font, texture, width, height, 0, 0, cw, ch,
+			    columns, chars);
+
+	return 0;
+}
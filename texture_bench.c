@@ -0,0 +1,224 @@
+/*
+ * Copyright © 2022 IGEL Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *    Tomohito Esaki <etom@igel.co.jp>
+ */
+/*
+ * Fill rate of the sprite atlas uncompressed and in ETC2.
+ *
+ * Every frame covers the window OVERDRAW times with blended copies of the
+ * whole atlas at half size, so without mipmaps each pixel fetches about
+ * four texels and the frame is bound by texture bandwidth and blending.
+ * The two textures take turns for PHASE_FRAMES frames each, and only the
+ * GPU time of the draws is counted: glFinish() before and after.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+
+#include <GLES3/gl3.h>
+
+#include "shader.h"
+#include "atlas.h"
+#include "gl_state.h"
+#include "sprite_batch.h"
+#include "common.h"
+
+#define WINDOW_WIDTH		1024
+#define WINDOW_HEIGHT		768
+#define ATLAS_FILE		"images/atlas.bin"
+#define ATLAS_ETC2_FILE		"images/atlas-etc2.bin"
+#define OVERDRAW		16
+#define PHASE_FRAMES		120
+
+enum {
+	MODE_RGBA8,
+	MODE_ETC2,
+	MODE_COUNT,
+};
+
+struct mode {
+	const char *name;
+	GLuint texture;
+	int state;
+	double msec;
+};
+
+struct app {
+	struct sprite_batch sprites;
+	struct mode modes[MODE_COUNT];
+	int n_modes;
+	int tex_width, tex_height;
+	int mode;
+	int frame;
+};
+
+static double
+get_msec(void)
+{
+	struct timespec tm;
+
+	clock_gettime(CLOCK_MONOTONIC, &tm);
+	return tm.tv_sec * 1000.0 + tm.tv_nsec / 1000000.0;
+}
+
+static int
+load_mode(struct app *app, int i, const char *name, const char *path)
+{
+	struct mode *mode = &app->modes[i];
+	struct sprite_state state;
+	struct atlas atlas;
+
+	if (atlas_open(&atlas, path) < 0)
+		return -1;
+
+	mode->name = name;
+	mode->texture = atlas_create_texture(&atlas);
+	app->tex_width = atlas.header->width;
+	app->tex_height = atlas.header->height;
+	atlas_close(&atlas);
+
+	state = (struct sprite_state){
+		.layer = 0,
+		.blend = SPRITE_BLEND_ALPHA,
+		.texture = mode->texture,
+		.tex_width = app->tex_width,
+		.tex_height = app->tex_height,
+	};
+	mode->state = sprite_batch_add_state(&app->sprites, &state);
+	assert(mode->state >= 0);
+
+	return 0;
+}
+
+static void
+init_gl(void *data)
+{
+	struct app *app = data;
+	int ret;
+
+	ret = sprite_batch_init(&app->sprites, 1024);
+	assert(ret == 0);
+
+	ret = load_mode(app, MODE_RGBA8, "rgba8", ATLAS_FILE);
+	assert(ret == 0);
+	app->n_modes = 1;
+
+	if (shader_gl_version() < 30)
+		printf("ETC2 needs ES 3.0, timing rgba8 only\n");
+	else if (load_mode(app, MODE_ETC2, "etc2", ATLAS_ETC2_FILE) < 0)
+		printf("no ETC2 atlas, timing rgba8 only\n");
+	else
+		app->n_modes = 2;
+}
+
+static void
+deinit_gl(void *data)
+{
+	struct app *app = data;
+	int i;
+
+	for (i = 0; i < app->n_modes; i++)
+		gl_state_delete_textures(1, &app->modes[i].texture);
+	sprite_batch_fini(&app->sprites);
+}
+
+static void
+draw_scene(struct app *app, const struct mode *mode)
+{
+	int tw = app->tex_width / 2, th = app->tex_height / 2;
+	int layer, x, y, x0;
+
+	sprite_batch_begin(&app->sprites, WINDOW_WIDTH, WINDOW_HEIGHT);
+	for (layer = 0; layer < OVERDRAW; layer++) {
+		/* stagger the layers so tile edges don't line up */
+		x0 = -(layer * 37 % tw);
+		for (y = -(layer * 23 % th); y < WINDOW_HEIGHT; y += th)
+			for (x = x0; x < WINDOW_WIDTH; x += tw)
+				sprite_batch_add(&app->sprites, mode->state,
+						 x, y, x + tw, y + th, 0, 0,
+						 app->tex_width,
+						 app->tex_height);
+	}
+	sprite_batch_end(&app->sprites);
+}
+
+static void
+redraw(void *data, struct rect *damage)
+{
+	struct app *app = data;
+	struct mode *mode = &app->modes[app->mode];
+	double start;
+	int i;
+
+	glViewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
+	glClearColor(0.0, 0.0, 0.0, 1.0);
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	glFinish();
+	start = get_msec();
+	draw_scene(app, mode);
+	glFinish();
+	mode->msec += get_msec() - start;
+
+	if (++app->frame < PHASE_FRAMES)
+		return;
+	app->frame = 0;
+	if (++app->mode < app->n_modes)
+		return;
+	app->mode = 0;
+
+	for (i = 0; i < app->n_modes; i++) {
+		printf("%s %.3f ms/frame  ", app->modes[i].name,
+		       app->modes[i].msec / PHASE_FRAMES);
+		app->modes[i].msec = 0;
+	}
+	printf("(%d layers of %dx%d)\n", OVERDRAW, WINDOW_WIDTH,
+	       WINDOW_HEIGHT);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct app app;
+	struct app_info info = {
+		.name = "gl-texture-bench",
+		.id = "jp.co.igel.gl-texture-bench",
+		.win_width = WINDOW_WIDTH,
+		.win_height = WINDOW_HEIGHT,
+		.cb = {
+			.init_gl = init_gl,
+			.deinit_gl = deinit_gl,
+			.redraw = redraw,
+			.user_data = &app,
+		},
+	};
+
+	memset(&app, 0, sizeof(app));
+	app_main(argc, argv, &info);
+
+	return 0;
+}
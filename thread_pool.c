@@ -0,0 +1,297 @@
+/*
+ * Copyright © 2022 IGEL Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *    Tomohito Esaki <etom@igel.co.jp>
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "thread_pool.h"
+
+#define CACHE_LINE	64
+#define ALIGN_UP(x, a)	(((x) + (a) - 1) / (a) * (a))
+
+/*
+ * Chase-Lev deque. The owner pops from the bottom, thieves take from the
+ * top. Tasks are only pushed by thread_pool_run() while all workers are
+ * parked, so the buffer never grows under a running thief.
+ */
+struct worker {
+	_Alignas(CACHE_LINE) atomic_long top;
+	_Alignas(CACHE_LINE) atomic_long bottom;
+	int *tasks;
+	long size;
+	struct thread_pool *pool;
+	int index;
+	pthread_t thread;
+};
+
+struct thread_pool {
+	struct worker *workers;
+	int n_workers;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	unsigned int generation;
+	int quit;
+
+	thread_pool_func func;
+	void *data;
+	_Alignas(CACHE_LINE) atomic_int active;
+};
+
+static int
+deque_pop(struct worker *w, int *task)
+{
+	long b = atomic_load_explicit(&w->bottom, memory_order_relaxed) - 1;
+	long t;
+	int ret = 0;
+
+	atomic_store_explicit(&w->bottom, b, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+	t = atomic_load_explicit(&w->top, memory_order_relaxed);
+
+	if (t <= b) {
+		*task = w->tasks[b];
+		ret = 1;
+		if (t == b) {
+			/* last task, race the thieves for it */
+			if (!atomic_compare_exchange_strong_explicit(
+					&w->top, &t, t + 1,
+					memory_order_seq_cst,
+					memory_order_relaxed))
+				ret = 0;
+			atomic_store_explicit(&w->bottom, b + 1,
+					      memory_order_relaxed);
+		}
+	} else {
+		atomic_store_explicit(&w->bottom, b + 1, memory_order_relaxed);
+	}
+
+	return ret;
+}
+
+/* Returns 1 on success, 0 if empty and -1 if it lost a race */
+static int
+deque_steal(struct worker *w, int *task)
+{
+	long t = atomic_load_explicit(&w->top, memory_order_acquire);
+	long b;
+
+	atomic_thread_fence(memory_order_seq_cst);
+	b = atomic_load_explicit(&w->bottom, memory_order_acquire);
+	if (t >= b)
+		return 0;
+
+	*task = w->tasks[t];
+	if (!atomic_compare_exchange_strong_explicit(&w->top, &t, t + 1,
+						     memory_order_seq_cst,
+						     memory_order_relaxed))
+		return -1;
+
+	return 1;
+}
+
+static void
+worker_work(struct worker *w)
+{
+	struct thread_pool *pool = w->pool;
+	int n = pool->n_workers;
+	int task, busy, i;
+
+	while (deque_pop(w, &task))
+		pool->func(pool->data, task, w->index);
+
+	/* steal until a full sweep finds every deque empty */
+	do {
+		busy = 0;
+		for (i = 1; i < n; i++) {
+			struct worker *victim;
+			int ret;
+
+			victim = &pool->workers[(w->index + i) % n];
+			while ((ret = deque_steal(victim, &task)) != 0) {
+				if (ret > 0)
+					pool->func(pool->data, task, w->index);
+				busy = 1;
+			}
+		}
+	} while (busy);
+}
+
+static void *
+worker_thread(void *data)
+{
+	struct worker *w = data;
+	struct thread_pool *pool = w->pool;
+	unsigned int seen = 0;
+
+	for (;;) {
+		pthread_mutex_lock(&pool->lock);
+		while (pool->generation == seen && !pool->quit)
+			pthread_cond_wait(&pool->cond, &pool->lock);
+		seen = pool->generation;
+		pthread_mutex_unlock(&pool->lock);
+
+		if (pool->quit)
+			break;
+
+		worker_work(w);
+		atomic_fetch_sub_explicit(&pool->active, 1,
+					  memory_order_release);
+	}
+
+	return NULL;
+}
+
+struct thread_pool *
+thread_pool_create(int n_threads)
+{
+	struct thread_pool *pool;
+	size_t size;
+	int i;
+
+	if (n_threads <= 0)
+		n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (n_threads <= 0)
+		n_threads = 1;
+
+	pool = calloc(1, sizeof(*pool));
+	if (!pool)
+		return NULL;
+
+	size = ALIGN_UP(n_threads * sizeof(struct worker), CACHE_LINE);
+	pool->workers = aligned_alloc(CACHE_LINE, size);
+	if (!pool->workers) {
+		free(pool);
+		return NULL;
+	}
+	memset(pool->workers, 0, size);
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+
+	for (i = 0; i < n_threads; i++) {
+		struct worker *w = &pool->workers[i];
+
+		w->pool = pool;
+		w->index = i;
+		atomic_init(&w->top, 0);
+		atomic_init(&w->bottom, 0);
+		if (i == 0)
+			continue;
+
+		if (pthread_create(&w->thread, NULL, worker_thread, w) != 0)
+			break;
+	}
+	/* run with whatever threads could be started */
+	pool->n_workers = i;
+
+	return pool;
+}
+
+void
+thread_pool_destroy(struct thread_pool *pool)
+{
+	int i;
+
+	if (!pool)
+		return;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->quit = 1;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 1; i < pool->n_workers; i++)
+		pthread_join(pool->workers[i].thread, NULL);
+
+	for (i = 0; i < pool->n_workers; i++)
+		free(pool->workers[i].tasks);
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->workers);
+	free(pool);
+}
+
+int
+thread_pool_size(const struct thread_pool *pool)
+{
+	return pool->n_workers;
+}
+
+void
+thread_pool_run(struct thread_pool *pool, thread_pool_func func,
+		void *data, int n_tasks)
+{
+	int n = pool->n_workers;
+	int i, task;
+
+	if (n == 1 || n_tasks == 1) {
+		for (task = 0; task < n_tasks; task++)
+			func(data, task, 0);
+		return;
+	}
+
+	/* contiguous runs keep neighbouring tasks on one core */
+	for (i = 0; i < n; i++) {
+		struct worker *w = &pool->workers[i];
+		int first = (long)n_tasks * i / n;
+		int last = (long)n_tasks * (i + 1) / n;
+
+		if (w->size < last - first) {
+			int *tasks = realloc(w->tasks,
+					     (last - first) * sizeof(int));
+			assert(tasks);
+			w->tasks = tasks;
+			w->size = last - first;
+		}
+		/* pushed in reverse so the owner pops them in order */
+		for (task = first; task < last; task++)
+			w->tasks[last - 1 - task] = task;
+		atomic_store_explicit(&w->top, 0, memory_order_relaxed);
+		atomic_store_explicit(&w->bottom, last - first,
+				      memory_order_relaxed);
+	}
+
+	pool->func = func;
+	pool->data = data;
+	atomic_store_explicit(&pool->active, n - 1, memory_order_relaxed);
+
+	pthread_mutex_lock(&pool->lock);
+	pool->generation++;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	worker_work(&pool->workers[0]);
+
+	/* the deques are reused by the next run, wait for every thief */
+	while (atomic_load_explicit(&pool->active, memory_order_acquire))
+		sched_yield();
+}
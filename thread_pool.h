@@ -0,0 +1,53 @@
+/*
+ * Copyright © 2022 IGEL Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *    Tomohito Esaki <etom@igel.co.jp>
+ */
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+/*
+ * Fork/join thread pool for per-frame data parallel work.
+ *
+ * thread_pool_run() deals the tasks out to per-worker deques and blocks
+ * until all of them are done; the calling thread works as worker 0. A
+ * worker that drains its own deque steals from the others, so uneven
+ * tasks still keep every core busy. Tasks must only write to data they
+ * own: which worker runs a task is not deterministic.
+ */
+
+struct thread_pool;
+
+typedef void (*thread_pool_func)(void *data, int task, int worker);
+
+/* n_threads includes the caller; 0 uses one thread per online CPU */
+struct thread_pool *thread_pool_create(int n_threads);
+void thread_pool_destroy(struct thread_pool *pool);
+
+int thread_pool_size(const struct thread_pool *pool);
+
+void thread_pool_run(struct thread_pool *pool, thread_pool_func func,
+		     void *data, int n_tasks);
+
+#endif